@@ -0,0 +1,86 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "record.h"
+#include "taskstats.h"
+
+/*
+ * Delta-encoded capture data (RECORD_ENCODING_DELTA). The data is a
+ * sequence of self-contained blocks, each a DeltaBlockHeader followed by
+ * frames. A frame starts with varint((target << 1) | is_delta):
+ *
+ *  - keyframe: the raw record, record_size bytes
+ *  - delta:    a bitmap of the fields that changed since the previous
+ *              record of the same target, then one zigzag varint per set
+ *              bit (the raw bytes for string fields). The timestamp field
+ *              is stored as a delta-of-delta.
+ *
+ * The first frame of every target in a block is a keyframe, so a reader
+ * can start decoding at any block.
+ */
+#define DELTA_BLOCK_MAGIC 0x4b4c424eU   /* "NBLK" */
+#define DELTA_BLOCK_SIZE  (64 << 10)
+#define DELTA_BLOCK_SPAN  (60LL * 1000000000)
+
+struct DeltaBlockHeader {
+    uint32_t magic;
+    uint32_t size;          /* bytes of frames following the header */
+    uint32_t n_frames;
+    uint32_t reserved;
+    int64_t first_timestamp;
+    int64_t last_timestamp;
+};
+
+/* previous record of one target within the current block */
+struct DeltaState {
+    uint64_t block;         /* block the record belongs to, 0 for none */
+    int64_t timestamp_delta;
+    char *record;
+};
+
+struct DeltaEncoder {
+    FILE *file;
+    const struct RecordField *fields;
+    int n_fields;
+    int timestamp_field;
+    size_t record_size;
+
+    char *buf;
+    size_t len;
+    uint64_t block;
+    struct DeltaBlockHeader header;
+
+    struct DeltaState *states;
+    int n_states;
+
+    unsigned long long bytes_in, bytes_out;
+};
+
+int delta_encoder_init(struct DeltaEncoder *enc, FILE *file);
+int delta_encoder_write(struct DeltaEncoder *enc,
+                        const struct TaskStatistics *stats);
+int delta_encoder_finish(struct DeltaEncoder *enc);
+
+struct DeltaDecoder {
+    const struct RecordReader *reader;
+    int timestamp_field;
+    const char *block;      /* header of the block being decoded */
+    const char *pos, *end;
+    uint64_t block_no;
+    char *record;
+
+    struct DeltaState *states;
+    int n_states;
+};
+
+int delta_decoder_init(struct DeltaDecoder *dec,
+                       const struct RecordReader *reader);
+/* returns the next record, NULL at the end of the data or on corruption */
+const void* delta_decoder_next(struct DeltaDecoder *dec);
+/* skips whole blocks that end before timestamp */
+void delta_decoder_seek(struct DeltaDecoder *dec, int64_t timestamp);
+void delta_decoder_free(struct DeltaDecoder *dec);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,174 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <netlink/socket.h>
+#include <netlink/handlers.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <time.h>
+#include "exec.h"
+#include "histogram.h"
+#include "procs.h"
+#include "queue.h"
+#include "rawnl.h"
+#include "target.h"
+#include "threads.h"
+#include "ticker.h"
+
+/* lower bound of the in-flight table size, must be a power of 2 */
+#define MIN_INFLIGHT 256
+/* targets a worker takes at a time, from its own share or from another */
+#define SWEEP_CHUNK  32
+#define MAX_WORKERS  64
+/*
+ * CPU time and delays of a target between two samples, in ns per ns of
+ * wall clock, above which --max-period falls back to the tick period and
+ * below which it doubles the target's period
+ */
+#define ADAPT_BUSY   0.01
+#define ADAPT_IDLE   0.001
+/*
+ * ticks a retired thread or scanned process is held before its index is
+ * reused, replies still in flight and its records in the queue are
+ * told apart by the generation meanwhile
+ */
+#define RECYCLE_TICKS 16
+
+enum NetlinkTransport {
+    NETLINK_LIBNL,  /* libnl messages and callbacks */
+    NETLINK_RAW     /* RawNetlink, see rawnl.h */
+};
+
+struct InflightQuery {
+    unsigned int seq;
+    unsigned int tick;
+    int target;
+    unsigned int generation;    /* of the target when it was queried */
+    time_t t_send;
+    int in_use;
+    struct ProcSupplement proc; /* read right after the query was put */
+};
+
+struct RetiredTarget {
+    int target;
+    unsigned int tick;      /* sweep it was dropped from the live list */
+};
+
+struct QueryEngine;
+
+/*
+ * A netlink socket with the queries it has in flight. Shard 0 is served by
+ * the tick thread in its event loop, every other shard by a worker thread
+ * of its own that sleeps on its epoll instance between sweeps.
+ */
+struct QueryShard {
+    struct QueryEngine *engine;
+    struct nl_sock *netlink_socket;
+    struct nl_cb *callbacks;
+    struct RawNetlink raw;
+    int netlink_fd;
+    int epoll_fd;           /* workers only, -1 for shard 0 */
+    int event_fd;           /* wakes the worker up for a sweep or the end */
+    pthread_t thread;
+    int started;
+
+    struct InflightQuery *inflight;
+    unsigned int inflight_mask;
+    unsigned int next_seq;
+    int n_inflight;
+    unsigned int tick;      /* sweep of the queries being put */
+
+    /*
+     * requests of the current tick, sent with a single nl_sendto, or with
+     * a single sendmmsg of datagrams of up to BATCH_SIZE bytes for raw
+     */
+    char *batch;
+    size_t batch_len, batch_cap;
+    unsigned int batch_first_seq;
+
+    unsigned long long n_sent, n_received, n_errors, n_lost, n_stray;
+    unsigned long long n_stolen, n_skipped;
+
+    /*
+     * live targets of the sweep still to be queried from this share, the
+     * first index in the low and the end in the high 32 bits. The owner
+     * takes chunks from the front, idle workers from the back
+     */
+    alignas(CACHE_LINE_SIZE) unsigned long long pending;
+};
+
+/*
+ * Query engine. The ticker's timerfd drives the ticks and the non-blocking
+ * netlink socket of shard 0 is watched by the same epoll instance. Each
+ * tick the queries of all live targets are packed into few datagrams, the
+ * replies are drained as they arrive and matched back to their target by
+ * sequence number. Task targets are watched by their pidfds in the same
+ * epoll instance too, and queried one last time when they exit.
+ *
+ * With several workers the live targets are split evenly between the
+ * shards every tick and every worker sends the queries of its share in
+ * chunks of SWEEP_CHUNK, then takes chunks from the back of the shares of
+ * the others. A tick is skipped as an overrun while the previous sweep is
+ * still being sent, so the records of tick k all carry the tick id k.
+ */
+struct QueryEngine {
+    enum NetlinkTransport transport;
+    int family_id;
+    int epoll_fd;
+    struct Ticker ticker;
+    /* signalfd of SIGINT/SIGTERM, which end the run, and SIGUSR2, which
+       dumps the histograms; -1 if unused */
+    int signal_fd;
+    time_t period;
+
+    struct TargetList *targets;
+    int n_alive;            /* live targets that are not threads of a group */
+
+    /* indices of the targets still being queried */
+    int *live;
+    int n_live, live_cap;
+    /* transient targets dropped from live, oldest first, to be released */
+    struct RetiredTarget *retired;
+    int n_retired, retired_cap;
+
+    /* set when per-thread sampling of thread groups is enabled */
+    struct ThreadScanner *scanner;
+    /* set by --top, which samples every process of the host */
+    struct ProcScanner *procs;
+    /* set by --proc-stats, tasks have their /proc files read with queries */
+    int proc_stats;
+    /* longest period of a task in ticks with --max-period, 1 otherwise */
+    unsigned int max_interval;
+
+    /* custom commands, started together with the first tick */
+    struct Command *commands;
+    int n_commands;
+
+    struct ConcurrentQueue *que;
+
+    struct QueryShard *shards;
+    int n_shards;
+    unsigned int tick;      /* id of the current sweep, 0 before the first */
+    int n_unsent;           /* targets of the sweep not sent yet */
+    unsigned int inflight_slots;    /* size the in-flight tables grow to */
+    time_t t_stop;          /* once set, workers drain their replies until */
+
+    /* counters reported at exit, the shards' are added up at the end */
+    unsigned long long n_ticks, n_overruns;
+    unsigned long long n_sent, n_received, n_errors, n_lost, n_stray;
+    unsigned long long n_stolen, n_skipped;
+
+    /* per stage latencies, the output stages are recorded by the writer */
+    struct StageHistograms latency;
+    time_t dump_interval;   /* print the histograms this often, 0 never */
+    time_t next_dump;
+};
+
+int query_engine_init(struct QueryEngine *engine, struct ConcurrentQueue *que,
+                      struct TargetList *targets, time_t period,
+                      enum TickerMode tick_mode, int tick_cpu,
+                      enum NetlinkTransport transport, int n_workers);
+int query_engine_run(struct QueryEngine *engine);
+void query_engine_destroy(struct QueryEngine *engine);
+
+#endif
\ No newline at end of file
@@ -3,6 +3,25 @@
 
 #include "utils.h"
 
-int exec_command(int argc, char *argv[], char* redict_out);
+/*
+ * Custom command. It is forked right away so that it can be added to the
+ * targets, but held at a start barrier until sampling is armed. It is not
+ * reaped before the engine saw it exit, so its pid cannot be reused.
+ */
+struct Command {
+    int pid;
+    int barrier_fd;     /* write end of the start barrier, -1 once started */
+    int status;         /* wait status once reaped, -1 if unknown */
+    int reaped;
+};
+
+int command_spawn(struct Command *command, int argc, char *argv[],
+                  char *redirect_out);
+/* lets the command exec */
+void command_start(struct Command *command);
+/* reaps the command, returns 1 once it exited */
+int command_reap(struct Command *command, int options);
+void command_print_status(const struct Command *command);
+void command_destroy(struct Command *command);
 
 #endif
\ No newline at end of file
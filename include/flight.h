@@ -0,0 +1,67 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stddef.h>
+#include <time.h>
+#include "record.h"
+#include "taskstats.h"
+
+/*
+ * Flight recorder of --flight-recorder: samples are kept in memory for the
+ * last pre seconds and only written out when a trigger fires, together
+ * with the samples of the post seconds that follow.
+ */
+#define FLIGHT_INITIAL_RECORDS 1024
+/* bound of the ring, the oldest samples are overwritten beyond it */
+#define FLIGHT_MAX_RECORDS     (1 << 18)
+#define FLIGHT_MAX_TRIGGERS    16
+
+/*
+ * FIELD>N fires on a sample with the field above N, rise(FIELD)>N on a
+ * field growing by more than N since the previous sample of the target.
+ * N may end in ns, us, ms or s for the fields counting nanoseconds.
+ */
+struct Trigger {
+    const char *text;
+    const struct RecordField *field;
+    int rise;
+    unsigned long long threshold;
+    unsigned long long n_fired;
+};
+
+int trigger_parse(struct Trigger *trigger, const char *text);
+
+enum FlightAction {
+    FLIGHT_HOLD,    /* the sample is kept in the ring */
+    FLIGHT_DUMP,    /* a trigger fired: write the ring, then the sample */
+    FLIGHT_PASS     /* within a post-trigger window: write the sample */
+};
+
+struct FlightRecorder {
+    time_t pre, post;
+    struct Trigger triggers[FLIGHT_MAX_TRIGGERS];
+    int n_triggers;
+
+    /* samples of the last pre seconds, oldest at head */
+    struct TaskStatistics *ring;
+    size_t cap, head, len;
+
+    /* last sample of every target, for the rise triggers */
+    struct TaskStatistics *last;
+    int n_last;
+
+    time_t recording_until;     /* end of the post-trigger window, or 0 */
+    unsigned long long n_dumps, n_overwritten;
+};
+
+int flight_recorder_init(struct FlightRecorder *fr, time_t pre, time_t post);
+int flight_recorder_add_trigger(struct FlightRecorder *fr, const char *text);
+/* fired is set to the trigger that fired, if one did */
+enum FlightAction flight_recorder_push(struct FlightRecorder *fr,
+                                       const struct TaskStatistics *stats,
+                                       const struct Trigger **fired);
+/* oldest sample of the ring, removed from it, NULL once empty */
+const struct TaskStatistics* flight_recorder_pop(struct FlightRecorder *fr);
+void flight_recorder_free(struct FlightRecorder *fr);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,69 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Formatting of the text output without stdio. The format_* functions write
+ * at p, do not terminate the string and return the end of what they wrote;
+ * the caller makes sure there is room for it.
+ */
+#define FORMAT_U64_LEN 20
+
+char *format_u64(char *p, unsigned long long value);
+char *format_int(char *p, int value);
+char *format_hex(char *p, unsigned int value);
+/* printf's %<width>llu and %<width>.3f */
+char *format_u64_right(char *p, unsigned long long value, int width);
+char *format_fixed3(char *p, double value, int width);
+
+/* inline so that the lengths of literals are known at compile time */
+static inline char *format_str(char *p, const char *s) {
+    size_t n = strlen(s);
+    memcpy(p, s, n);
+    return p + n;
+}
+
+/* %<width>s */
+static inline char *format_str_right(char *p, const char *s, int width) {
+    int n = strlen(s);
+    if (n < width) {
+        memset(p, ' ', width - n);
+        p += width - n;
+    }
+    memcpy(p, s, n);
+    return p + n;
+}
+
+/* %-<width>s */
+static inline char *format_str_left(char *p, const char *s, int width) {
+    int n = strlen(s);
+    memcpy(p, s, n);
+    if (n < width) {
+        memset(p + n, ' ', width - n);
+        return p + width;
+    }
+    return p + n;
+}
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+/* output of one thread, written out with a single write() per flush */
+struct OutputBuffer {
+    int fd;
+    char *data;
+    size_t len, cap;
+    unsigned long long n_flushes;
+    unsigned long long bytes_out;
+};
+
+int output_buffer_init(struct OutputBuffer *out, int fd, size_t cap);
+/* room for n more bytes, flushes first if they do not fit */
+char *output_buffer_reserve(struct OutputBuffer *out, size_t n);
+/* takes the bytes up to end, a pointer into the reserved room */
+void output_buffer_commit(struct OutputBuffer *out, const char *end);
+int output_buffer_flush(struct OutputBuffer *out);
+void output_buffer_free(struct OutputBuffer *out);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Log-linear histogram in the style of HdrHistogram: every power of two is
+ * split into HISTOGRAM_SUB_COUNT linear buckets, so any recorded value is
+ * off by at most 1/HISTOGRAM_SUB_COUNT. Values are nanoseconds, larger ones
+ * than 2^HISTOGRAM_MAX_BITS land in the last bucket.
+ */
+#define HISTOGRAM_SUB_BITS  5
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS  40
+#define HISTOGRAM_BUCKETS   \
+    ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT)
+
+/*
+ * one writer thread, or several with histogram_record_shared, readers may
+ * look at it any time
+ */
+struct Histogram {
+    unsigned long long counts[HISTOGRAM_BUCKETS];
+    unsigned long long n, total, max;
+};
+
+void histogram_record(struct Histogram *histogram, time_t value);
+void histogram_record_shared(struct Histogram *histogram, time_t value);
+unsigned long long histogram_percentile(const struct Histogram *histogram,
+                                        double percentile);
+
+/* stages of the sampling pipeline, from the tick to the output file */
+enum Stage {
+    STAGE_TICK,         /* lateness of the tick */
+    STAGE_KILL,         /* liveness check of a target */
+    STAGE_SEND,         /* sending the queries of a tick */
+    STAGE_ROUND_TRIP,   /* query sent to reply received */
+    STAGE_PARSE,        /* reply to record published */
+    STAGE_QUEUE,        /* record published to record popped */
+    STAGE_FORMAT,       /* record to output bytes */
+    STAGE_WRITE,        /* output bytes to the file, per batch for text */
+    N_STAGES
+};
+
+struct StageHistograms {
+    struct Histogram stages[N_STAGES];
+};
+
+const char* stage_name(enum Stage stage);
+
+void stage_histograms_print(FILE *file, const struct StageHistograms *h);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,53 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <netlink/socket.h>
+#include <netlink/handlers.h>
+#include <pthread.h>
+#include "queue.h"
+
+/* number of CPUs whose exit events are read by one socket and thread */
+#define DEFAULT_CPU_GROUP 8
+#define CPUMASK_LEN       128
+
+struct ExitListener;
+
+struct ListenerGroup {
+    struct ExitListener *listener;
+    struct nl_sock *netlink_socket;
+    struct nl_cb *callbacks;
+    char cpumask[CPUMASK_LEN];
+    int *cpus;
+    int n_cpus;
+    pthread_t thread;
+    int started;
+
+    /* counters reported at exit */
+    unsigned long long n_events, n_overflows;
+};
+
+/*
+ * Receives the taskstats the kernel sends for every task exiting on a set of
+ * CPUs. The CPUs are split into groups, each served by its own netlink socket
+ * registered with TASKSTATS_CMD_ATTR_REGISTER_CPUMASK and a reader thread
+ * pinned to those CPUs. Every event is published to the queue as a record of
+ * the given target.
+ */
+struct ExitListener {
+    struct ConcurrentQueue *que;
+    int target;
+    int family_id;
+    struct ListenerGroup *groups;
+    int n_groups;
+    int stop;
+};
+
+/* cpulist is in the kernel's list format, e.g. "0-3,8", NULL for all CPUs */
+int exit_listener_init(struct ExitListener *listener,
+                       struct ConcurrentQueue *que, int target,
+                       const char *cpulist, int group_size);
+int exit_listener_start(struct ExitListener *listener);
+void exit_listener_stop(struct ExitListener *listener);
+void exit_listener_destroy(struct ExitListener *listener);
+
+#endif
\ No newline at end of file
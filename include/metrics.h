@@ -0,0 +1,88 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include <time.h>
+#include "histogram.h"
+#include "queue.h"
+#include "rates.h"
+#include "target.h"
+#include "taskstats.h"
+
+/* snapshots are published at most this often */
+#define METRICS_PUBLISH_INTERVAL (50 * 1000000LL)
+#define METRICS_MAX_CLIENTS      64
+#define METRICS_REQUEST_LEN      4096
+
+/*
+ * latest record of one target, with its rates once it has two. The entry
+ * is dropped once the target is retired
+ */
+struct MetricsEntry {
+    int command_type;       /* 0 until the target has a record */
+    int pid;
+    const char *path;
+    struct TaskStatistics stats;
+    int has_rates;
+    struct TaskRates rates;
+};
+
+struct MetricsSnapshot {
+    struct MetricsEntry *entries;
+    int n_entries, cap;
+    unsigned long long n_records;
+};
+
+struct MetricsClient {
+    int fd;
+    char request[METRICS_REQUEST_LEN];
+    size_t request_len;
+    char *response;
+    size_t response_len, sent;
+};
+
+/*
+ * Prometheus text endpoint of --metrics. The processing thread updates the
+ * back snapshot in place and swaps it with the front one, a scrape copies
+ * the front snapshot and formats the copy. The lock is only held for the
+ * swap and the copy, so the processing thread never waits for a scrape.
+ * The server thread serves all clients from one epoll loop.
+ */
+struct MetricsServer {
+    int listen_fd, epoll_fd, stop_fd;
+    char *path;             /* Unix socket to remove at exit, or NULL */
+    pthread_t thread;
+    int started;
+
+    /* processing thread side */
+    const struct TargetList *targets;
+    struct RateTracker rates;
+    time_t next_publish;
+
+    pthread_mutex_t lock;
+    struct MetricsSnapshot buffers[2];
+    struct MetricsSnapshot *front, *back;
+
+    /* server thread side */
+    struct MetricsSnapshot copy;
+    struct MetricsClient clients[METRICS_MAX_CLIENTS];
+    const struct StageHistograms *latency;
+    const struct ConcurrentQueue *que;
+    unsigned long long n_scrapes;
+};
+
+/* address is a Unix socket path, or HOST:PORT for TCP such as :9100 */
+int metrics_server_init(struct MetricsServer *server, const char *address,
+                        const struct TargetList *targets,
+                        const struct StageHistograms *latency,
+                        const struct ConcurrentQueue *que);
+int metrics_server_start(struct MetricsServer *server);
+/* called by the processing thread */
+void metrics_server_update(struct MetricsServer *server,
+                           const struct TaskStatistics *stats,
+                           int command_type, int pid, const char *path);
+void metrics_server_publish(struct MetricsServer *server, int force);
+void metrics_server_stop(struct MetricsServer *server);
+void metrics_server_destroy(struct MetricsServer *server);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef PROCFILES_H
+#define PROCFILES_H
+
+/* files of struct ProcFiles, bits of ProcSupplement.valid */
+enum ProcFile {
+    PROC_FILE_STAT,         /* rss and cpu */
+    PROC_FILE_SCHEDSTAT,    /* run_time and wait_time */
+    N_PROC_FILES
+};
+
+/*
+ * what --proc-stats adds to a sample of a task, the numbers taskstats lacks.
+ * Cancelled write bytes are in taskstats already
+ */
+struct ProcSupplement {
+    unsigned long long rss;         /* resident bytes */
+    unsigned long long run_time;    /* ns on a CPU */
+    unsigned long long wait_time;   /* ns runnable on a run queue */
+    int cpu;                        /* CPU of the run queue it last ran on */
+    int valid;                      /* 1 << PROC_FILE_* of the files read */
+};
+
+/*
+ * /proc files of one task, opened once when the task goes live and re-read
+ * with pread at offset 0 on every query, -1 for those that could not be
+ * opened. Threads of a group read /proc/<tgid>/task/<tid>, any other task
+ * /proc/<pid>, where the rss is the process' and schedstat the main
+ * thread's.
+ */
+struct ProcFiles {
+    int fds[N_PROC_FILES];
+};
+
+void proc_files_init(struct ProcFiles *files);
+/* returns the number of files opened, tgid is 0 unless pid is a thread */
+int proc_files_open(struct ProcFiles *files, int tgid, int pid);
+void proc_files_read(const struct ProcFiles *files,
+                     struct ProcSupplement *supplement);
+void proc_files_close(struct ProcFiles *files);
+
+/* columns after task_stats_format's, each followed by a tab as well */
+#define PROC_SUPPLEMENT_STR_LEN (4 * 21)
+char *proc_supplement_format(const struct ProcSupplement *supplement, char *p);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,53 @@
+#ifndef PROCS_H
+#define PROCS_H
+
+#include <dirent.h>
+#include <regex.h>
+#include <time.h>
+#include "target.h"
+
+#define PROC_MAX_MATCHES 16
+/* scans a new process is matched on, the second one catches an exec */
+#define PROC_MATCH_CHECKS 2
+
+struct ProcEntry {
+    int pid;
+    int target;                 /* -1 while it matches no pattern */
+    unsigned int generation;    /* of the target, which may be reused */
+    int n_checks;
+    unsigned long long start;   /* start time in ticks, tells a zombie or
+                                   a known process from a reused PID */
+};
+
+/*
+ * Discovers the processes of the host for --top and --match and adds each
+ * one as a TGID target. /proc stays open and is re-read on the
+ * --thread-scan cadence, or early when a query found a process gone. The
+ * sorted list of the previous scan is merged with the new one, so only the
+ * processes that appeared are looked at, and both lists are reused from
+ * scan to scan. With --match patterns only the processes whose comm or
+ * command line matches one become targets, the others are remembered as
+ * not matching until another process shows up with their PID.
+ */
+struct ProcScanner {
+    struct TargetList *targets;
+    DIR *proc_dir;
+    struct ProcEntry *entries, *spare;
+    int n_entries, entries_cap, spare_cap;
+    regex_t patterns[PROC_MAX_MATCHES];
+    int n_patterns;             /* none to take every process */
+    time_t interval;
+    time_t next_scan;
+    int requested;
+    unsigned long long n_added, n_gone;
+};
+
+int proc_scanner_init(struct ProcScanner *scanner, struct TargetList *targets,
+                      time_t interval);
+/* processes matching the extended regular expression become targets */
+int proc_scanner_add_match(struct ProcScanner *scanner, const char *pattern);
+/* rescans if due, returns the number of processes that were added */
+int proc_scanner_poll(struct ProcScanner *scanner, time_t now);
+void proc_scanner_free(struct ProcScanner *scanner);
+
+#endif
\ No newline at end of file
@@ -2,20 +2,62 @@
 #define QUEUE_H
 
 #include "taskstats.h"
-#include <pthread.h>
+#include <stdalign.h>
 
+#define CACHE_LINE_SIZE 64
+#define DEFAULT_QUEUE_SIZE 1024
+
+/* what a producer does when every slot is taken */
+enum QueueFullPolicy {
+    QUEUE_FULL_BLOCK,       /* wait for the consumer */
+    QUEUE_FULL_DROP_OLDEST, /* discard the oldest unread record */
+    QUEUE_FULL_DROP_NEWEST  /* discard the record being added */
+};
+
+struct QueueSlot {
+    alignas(CACHE_LINE_SIZE) unsigned long seq;
+    unsigned long pos;
+    struct TaskStatistics stats;
+};
+
+/*
+ * Bounded lock-free ring of TaskStatistics held by value. Every slot has
+ * a sequence number telling whether it is free, being filled or ready, so
+ * any number of producers can claim slots and fill them in place. The
+ * consumer copies records out in batches and only sleeps on a futex when
+ * the ring is empty.
+ */
 struct ConcurrentQueue {
-    struct TaskStatistics **taskstats;
-    int front, tail;
-    pthread_mutex_t lock;
-    pthread_cond_t space_cond;
-    pthread_cond_t data_cond;
+    struct QueueSlot *slots;
+    unsigned long capacity, mask;
+    enum QueueFullPolicy policy;
+
+    alignas(CACHE_LINE_SIZE) unsigned long tail;
+    alignas(CACHE_LINE_SIZE) unsigned long head;
+    alignas(CACHE_LINE_SIZE) int consumer_waiting;
+    int producer_waiting;
+    int closed;
+    unsigned long long n_dropped;
 };
 
+int concurrent_queue_init(struct ConcurrentQueue * const q,
+                          unsigned long capacity,
+                          enum QueueFullPolicy policy);
+void concurrent_queue_destroy(struct ConcurrentQueue * const q);
+
+/* returns a slot to fill in place, or NULL if the record was dropped */
+struct TaskStatistics* concurrent_queue_claim(struct ConcurrentQueue * const q);
+void concurrent_queue_publish(struct ConcurrentQueue * const q,
+                              struct TaskStatistics* taskstat);
+void concurrent_queue_push(struct ConcurrentQueue * const q,
+                           const struct TaskStatistics* taskstat);
 
-void concurrent_queue_init(struct ConcurrentQueue * const q);
-void concurrent_queue_push(struct ConcurrentQueue * const q, 
-                           struct TaskStatistics* taskstat);
-struct TaskStatistics* concurrent_queue_pop(struct ConcurrentQueue * const q);
+/*
+ * Copies up to max records into out, blocking while the queue is empty.
+ * Returns 0 once the queue is closed and fully drained.
+ */
+int concurrent_queue_pop_batch(struct ConcurrentQueue * const q,
+                               struct TaskStatistics* out, int max);
+void concurrent_queue_close(struct ConcurrentQueue * const q);
 
 #endif
\ No newline at end of file
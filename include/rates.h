@@ -0,0 +1,66 @@
+#ifndef RATES_H
+#define RATES_H
+
+#include <time.h>
+#include "taskstats.h"
+
+/*
+ * Rates of a target between two consecutive samples, written by --rates.
+ * Times are in percent of one CPU, delays in ms per second and all other
+ * counters per second.
+ */
+struct TaskRates {
+    int target;
+    int pid;
+    time_t timestamp;
+    time_t interval;    /* ns since the previous sample */
+    char comm[TS_COMM_LEN];
+
+    double cpu, user, system;
+    double read_bytes, write_bytes;
+    double read_syscalls, write_syscalls;
+    double cpu_delay, blkio_delay, swapin_delay, freepages_delay;
+    double minflt, majflt;
+    double nvcsw, nivcsw;
+    /* from the /proc files of --proc-stats */
+    double rss;             /* MB */
+    double run_queue_wait;  /* ms per second */
+    int last_cpu;
+};
+
+/* previous sample of one target, timestamp 0 for none */
+struct RateState {
+    time_t timestamp;
+    int pid;
+    unsigned int generation;
+    struct taskstats stats;
+    struct ProcSupplement proc;
+};
+
+struct RateTracker {
+    struct RateState *states;
+    int n_states;
+    unsigned long long n_resets;
+};
+
+void rate_tracker_init(struct RateTracker *tracker);
+/*
+ * Remembers the sample and fills rates since the previous one of the same
+ * target. Returns 1 when rates were filled, 0 for the first sample of a
+ * task, -1 on allocation failure. A task that is not the one sampled
+ * before, after a PID reuse, starts over.
+ */
+int rate_tracker_update(struct RateTracker *tracker,
+                        const struct TaskStatistics *stats,
+                        struct TaskRates *rates);
+void rate_tracker_free(struct RateTracker *tracker);
+
+/* one text line of rates, without the newline */
+#define TASK_RATES_STR_LEN 512
+char* task_rates_format(const struct TaskRates *rates, char *p);
+extern const char task_rates_columns[];
+/* the columns --proc-stats appends, each with its leading tab */
+char* task_rates_format_proc(const struct TaskRates *rates, char *p);
+extern const char task_rates_proc_columns[];
+
+#endif
\ No newline at end of file
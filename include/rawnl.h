@@ -0,0 +1,63 @@
+#ifndef RAWNL_H
+#define RAWNL_H
+
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <stddef.h>
+
+/* datagrams read by one recvmmsg, each holds one reply of the kernel */
+#define RAW_NETLINK_RECV_BATCH 64
+#define RAW_NETLINK_RECV_SIZE  4096
+/* datagrams written by one sendmmsg */
+#define RAW_NETLINK_SEND_BATCH 16
+
+/* query of one target; a copy of a template with seq and value patched */
+struct RawRequest {
+    struct nlmsghdr header;
+    struct genlmsghdr genl;
+    struct nlattr attr;
+    __u32 value;
+};
+
+#define RAW_REQUEST_LEN NLMSG_ALIGN(sizeof(struct RawRequest))
+
+/*
+ * Lean taskstats transport of --netlink raw: a plain NETLINK_GENERIC socket
+ * without libnl. Queries are copied from prebuilt templates, sent in batches
+ * of datagrams with sendmmsg and their replies received with recvmmsg into
+ * buffers reused for the whole run, where they are decoded in place.
+ */
+struct RawNetlink {
+    int fd;
+    int family_id;
+    /* templates of TASKSTATS_CMD_ATTR_PID, _TGID and of cgroups */
+    struct RawRequest templates[3];
+
+    /* RAW_NETLINK_RECV_BATCH of each */
+    struct mmsghdr *messages;
+    struct iovec *iovecs;
+    char *buffers;
+
+    unsigned long long n_send_calls, n_receive_calls, n_truncated;
+};
+
+int raw_netlink_init(struct RawNetlink *raw, int rcvbuf, int sndbuf);
+/* writes RAW_REQUEST_LEN bytes of the query of a target to p */
+void raw_netlink_put_query(const struct RawNetlink *raw, char *p,
+                           int command_type, int value, unsigned int seq);
+/*
+ * sends len bytes of queries as datagrams of at most datagram_len bytes,
+ * returns 0 or a negative errno
+ */
+int raw_netlink_send(struct RawNetlink *raw, const char *data, size_t len,
+                     size_t datagram_len);
+/* receives a batch of datagrams, returns their number, 0 if none, -1 */
+int raw_netlink_receive(struct RawNetlink *raw);
+
+/* datagram i of the last batch and its length */
+struct nlmsghdr* raw_netlink_datagram(const struct RawNetlink *raw, int i,
+                                      int *len);
+
+void raw_netlink_destroy(struct RawNetlink *raw);
+
+#endif
\ No newline at end of file
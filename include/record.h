@@ -0,0 +1,97 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "taskstats.h"
+#include "target.h"
+
+/*
+ * Binary capture format written by --out-format=binary. A file starts with
+ * a RecordFileHeader, followed by n_fields RecordField entries describing
+ * the layout of one record and n_targets RecordTarget entries. The data
+ * starts at header_size and runs to the end of the file: fixed-size records
+ * for RECORD_ENCODING_RAW, blocks of delta frames (see delta.h) for
+ * RECORD_ENCODING_DELTA. All integers are in host byte order.
+ *
+ * The header is written when the run starts, so the target table only
+ * lists the targets known then. The threads, --top and --match processes
+ * and commands added later are found by the pid, tgid and ac_comm of their
+ * records only, and the index of an exited one may be reused by another,
+ * which then has the next generation.
+ */
+#define RECORD_MAGIC "MNRECORD"
+#define RECORD_FORMAT_VERSION 2
+#define RECORD_FIELD_NAME_LEN 32
+#define RECORD_ALIGN 64
+
+enum RecordEncoding {
+    RECORD_ENCODING_RAW,
+    RECORD_ENCODING_DELTA
+};
+
+enum RecordFieldType {
+    RECORD_FIELD_UINT,
+    RECORD_FIELD_INT,
+    RECORD_FIELD_STR
+};
+
+struct RecordFileHeader {
+    char magic[8];
+    uint32_t format_version;
+    uint32_t taskstats_version;
+    uint32_t header_size;
+    uint32_t record_size;
+    uint32_t n_fields;
+    uint32_t n_targets;
+    uint32_t encoding;
+    uint32_t reserved;
+};
+
+struct RecordField {
+    char name[RECORD_FIELD_NAME_LEN];
+    uint32_t offset;
+    uint16_t size;
+    uint16_t type;
+};
+
+struct RecordTarget {
+    int32_t command_type;
+    int32_t pid;
+};
+
+/* layout of struct TaskStatistics as written to the capture */
+extern const struct RecordField record_fields[];
+extern const int record_n_fields;
+
+int record_write_header(FILE *file, const struct TargetList *targets,
+                        enum RecordEncoding encoding);
+int record_write(FILE *file, const struct TaskStatistics *stats);
+
+/* read-only view of a capture mapped into memory */
+struct RecordReader {
+    void *map;
+    size_t map_size;
+    const struct RecordFileHeader *header;
+    const struct RecordField *fields;
+    const struct RecordTarget *targets;
+    const char *records;
+    size_t data_size;
+    size_t n_records;   /* only for RECORD_ENCODING_RAW */
+};
+
+int record_reader_open(struct RecordReader *reader, const char *path);
+void record_reader_close(struct RecordReader *reader);
+const struct RecordField* record_reader_field(const struct RecordReader *reader,
+                                              const char *name);
+
+static inline const void* record_reader_get(const struct RecordReader *reader,
+                                            size_t idx) {
+    return reader->records + idx * reader->header->record_size;
+}
+
+uint64_t record_field_uint(const struct RecordField *field, const void *record);
+int64_t record_field_int(const struct RecordField *field, const void *record);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,175 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "taskstats.h"
+
+/*
+ * Shared memory export of --shm NAME: the segment /NAME holds a ShmHeader
+ * followed by n_slots ShmSlot, one per target in the order of the targets.
+ * Every slot keeps the last SHM_HISTORY records of its target in a ring,
+ * head counts the records published so far. Each entry is guarded by its
+ * own seqlock: the sequence is odd while the writer updates the entry, so
+ * a reader copies an entry and retries if the sequence was odd or moved.
+ * The index of an exited thread or scanned process is reused by another
+ * one, whose records carry the next generation of the target.
+ *
+ * The reader below is all a co-located process needs, it takes no locks
+ * and makes no system calls after opening the segment.
+ */
+#define SHM_MAGIC "MNSHM001"
+#define SHM_HISTORY 16
+#define SHM_SLOTS   1024
+
+struct ShmHeader {
+    char magic[8];
+    uint32_t record_size;   /* sizeof(struct TaskStatistics) of the writer */
+    uint32_t history;
+    uint32_t n_slots;
+    uint32_t n_targets;     /* slots in use, grows while mn runs */
+    uint64_t slot_size;
+    int64_t period;         /* sampling period in ns */
+    int32_t writer_pid;
+    uint32_t reserved;
+};
+
+struct ShmEntry {
+    uint32_t seq;
+    uint32_t reserved;
+    struct TaskStatistics stats;
+};
+
+struct ShmSlot {
+    int32_t command_type;   /* TASKSTATS_CMD_ATTR_PID, _TGID, ... */
+    int32_t pid;
+    uint64_t head;
+    struct ShmEntry entries[SHM_HISTORY];
+};
+
+/* writer side, run by mn */
+struct ShmExport {
+    char *name;
+    void *map;
+    size_t size;
+    struct ShmHeader *header;
+    struct ShmSlot *slots;
+    unsigned long long n_published, n_skipped;
+};
+
+int shm_export_init(struct ShmExport *shm, const char *name, time_t period);
+void shm_export_publish(struct ShmExport *shm,
+                        const struct TaskStatistics *stats,
+                        int command_type, int pid);
+void shm_export_destroy(struct ShmExport *shm);
+
+/* reader side */
+struct ShmReader {
+    void *map;
+    size_t size;
+    const struct ShmHeader *header;
+    const struct ShmSlot *slots;
+};
+
+static inline void shm_reader_close(struct ShmReader *reader) {
+    if (reader->map) {
+        munmap(reader->map, reader->size);
+    }
+    memset(reader, 0, sizeof(*reader));
+}
+
+/* returns 0 on success, -1 if the segment is missing or of another mn */
+static inline int shm_reader_open(struct ShmReader *reader, const char *name) {
+    char path[256];
+    struct stat st;
+    memset(reader, 0, sizeof(*reader));
+    if (name[0] == '/') {
+        name++;
+    }
+    if (snprintf(path, sizeof(path), "/%s", name) >= (int)sizeof(path)) {
+        return -1;
+    }
+    int fd = shm_open(path, O_RDONLY, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(struct ShmHeader)) {
+        close(fd);
+        return -1;
+    }
+    reader->size = st.st_size;
+    reader->map = mmap(NULL, reader->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (reader->map == MAP_FAILED) {
+        reader->map = NULL;
+        return -1;
+    }
+    reader->header = (const struct ShmHeader*)reader->map;
+    reader->slots = (const struct ShmSlot*)(reader->header + 1);
+    if (memcmp(reader->header->magic, SHM_MAGIC, 8) ||
+        reader->header->record_size != sizeof(struct TaskStatistics) ||
+        reader->header->slot_size != sizeof(struct ShmSlot) ||
+        reader->header->history != SHM_HISTORY ||
+        sizeof(struct ShmHeader) + (size_t)reader->header->n_slots *
+            sizeof(struct ShmSlot) > reader->size) {
+        shm_reader_close(reader);
+        return -1;
+    }
+    return 0;
+}
+
+static inline int shm_reader_n_targets(const struct ShmReader *reader) {
+    return __atomic_load_n(&reader->header->n_targets, __ATOMIC_ACQUIRE);
+}
+
+/* consistent copy of an entry, retried while the writer is at it */
+static inline void shm_reader_copy(const struct ShmEntry *entry,
+                                   struct TaskStatistics *stats) {
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        if (!(seq & 1)) {
+            memcpy(stats, &entry->stats, sizeof(*stats));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == seq) {
+                return;
+            }
+        }
+    }
+}
+
+/*
+ * Copies up to max records of the target, the latest first, and returns
+ * how many were copied; 0 when the target has none yet.
+ */
+static inline int shm_reader_history(const struct ShmReader *reader,
+                                     int target, struct TaskStatistics *out,
+                                     int max) {
+    if (target < 0 || target >= shm_reader_n_targets(reader)) {
+        return 0;
+    }
+    const struct ShmSlot *slot = &reader->slots[target];
+    uint64_t head = __atomic_load_n(&slot->head, __ATOMIC_ACQUIRE);
+    int n = 0;
+    while (n < max && n < SHM_HISTORY && head > (uint64_t)n) {
+        shm_reader_copy(&slot->entries[(head - 1 - n) % SHM_HISTORY],
+                        &out[n]);
+        if (n && out[n].timestamp >= out[n - 1].timestamp) {
+            /* the writer went round the ring meanwhile */
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+static inline int shm_reader_latest(const struct ShmReader *reader,
+                                    int target, struct TaskStatistics *out) {
+    return shm_reader_history(reader, target, out, 1);
+}
+
+#endif
\ No newline at end of file
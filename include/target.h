@@ -0,0 +1,75 @@
+#ifndef TARGET_H
+#define TARGET_H
+
+#include <linux/cgroupstats.h>
+#include "procfiles.h"
+
+#define TARGET_CHUNK_SHIFT 8
+#define TARGET_CHUNK_SIZE  (1 << TARGET_CHUNK_SHIFT)
+#define TARGET_MAX_CHUNKS  4096
+
+/* command_type of a cgroup target, whose pid is the open cgroup directory */
+#define TARGET_CGROUP      CGROUPSTATS_CMD_GET
+
+struct Target {
+    int command_type;   /* TASKSTATS_CMD_ATTR_PID, _TGID or TARGET_CGROUP */
+    int pid;
+    int alive;
+    unsigned int generation;    /* bumped each time the index is reused */
+    int group;          /* index of the thread group target, -1 if none */
+    char *path;         /* cgroup directory, NULL for tasks */
+    int pidfd;          /* exit notification of a task, -1 if none */
+    int scanned;        /* a process found in /proc by --top or --match */
+    int match;          /* 1 + index of the --match pattern, 0 if none */
+    struct ProcFiles files; /* open while live with --proc-stats */
+    /* sampling every interval ticks with --max-period, due at next_tick */
+    unsigned int interval, next_tick;
+    unsigned int last_tick;     /* sweep of the last sample */
+    unsigned long long busy;    /* its CPU time and delays in ns */
+    int has_sample;             /* busy and last_tick are set */
+};
+
+/*
+ * List of monitored targets. Targets live in fixed-size chunks so they never
+ * move once added, and a record can refer to its target by index from
+ * another thread. The indices of retired threads and scanned processes are
+ * released to be reused by the targets added next, each reuse bumps the
+ * generation of the target so a record or a scanner can tell the new one.
+ */
+struct TargetList {
+    struct Target *chunks[TARGET_MAX_CHUNKS];
+    int n_targets;
+    int *free;          /* released indices, reused last first */
+    int n_free, free_cap;
+};
+
+void target_list_init(struct TargetList *list);
+int target_list_add(struct TargetList *list, int command_type, int pid);
+int target_list_add_cgroup(struct TargetList *list, const char *path);
+int target_list_load(struct TargetList *list, const char *path);
+/* once nothing queries the target any more its index may be reused */
+int target_list_release(struct TargetList *list, int idx);
+void target_list_free(struct TargetList *list);
+
+/*
+ * threads and the processes of /proc scans come and go with the scans, the run
+ * does not wait for them to exit and they are retired by ESRCH replies
+ */
+static inline int target_is_transient(const struct Target *target) {
+    return target->group >= 0 || target->scanned;
+}
+
+/* the target is still alive and the one added as the given generation */
+static inline int target_is_current(const struct Target *target,
+                                    unsigned int generation) {
+    return __atomic_load_n(&target->alive, __ATOMIC_RELAXED) &&
+           target->generation == generation;
+}
+
+static inline struct Target* target_list_get(const struct TargetList *list,
+                                             int idx) {
+    return &list->chunks[idx >> TARGET_CHUNK_SHIFT]
+                        [idx & (TARGET_CHUNK_SIZE - 1)];
+}
+
+#endif
\ No newline at end of file
@@ -1,20 +1,62 @@
 #ifndef TASKSTATS_H
 #define TASKSTATS_H
 
+#include <linux/cgroupstats.h>
 #include <linux/taskstats.h>
 #include <stddef.h>
 #include <time.h>
+#include "procfiles.h"
 
 struct TaskStatistics {
+    int target;     /* index of the queried target in the TargetList */
     int pid;
     int tgid;
+    unsigned int tick;  /* sweep that queried it, 0 for exit events */
+    int match;          /* --match pattern of the target, 0 if none */
+    unsigned int generation;    /* of the target, which tells a reuse */
     time_t timestamp;
     struct taskstats stats;
+    struct cgroupstats cgroup;  /* filled for cgroup targets only */
+    struct ProcSupplement proc; /* filled with --proc-stats only */
 };
 
+struct nlattr;
+struct nlmsghdr;
+
+/* room task_stats_format and cgroup_stats_format may need for one line */
+#define TASK_STATS_STR_LEN   768
+#define CGROUP_STATS_STR_LEN 128
+/* room of one human readable report */
+#define TASK_STATS_REPORT_LEN 4096
+
+/* fills pid, tgid and stats from a TASKSTATS_TYPE_AGGR_PID/TGID attribute */
+void task_stats_parse_aggregate(struct nlattr* aggregate,
+                                struct TaskStatistics* stats);
+/*
+ * fills pid, tgid and stats or cgroup from a taskstats or cgroupstats reply,
+ * decoded in place from the receive buffer
+ */
+void task_stats_parse_reply(const struct nlmsghdr* hdr,
+                            struct TaskStatistics* stats);
+
 void print_task_stats(const struct TaskStatistics* stats,
                       int human_readable);
 
 char* task_stats2str(const struct TaskStatistics* stats, char* buf, size_t len);
 
+void print_cgroup_stats(const struct TaskStatistics* stats);
+
+char* cgroup_stats2str(const struct TaskStatistics* stats, char* buf,
+                       size_t len);
+
+/*
+ * Same output as above written at p without the terminating '\0', these
+ * return the end of the output
+ */
+char* task_stats_format(const struct TaskStatistics* stats, char* p);
+char* task_stats_format_report(const struct TaskStatistics* stats,
+                               int human_readable, char* p);
+char* cgroup_stats_format(const struct TaskStatistics* stats, char* p);
+char* cgroup_stats_format_report(const struct TaskStatistics* stats, char* p);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+#include <dirent.h>
+#include <time.h>
+#include "target.h"
+
+#define DEFAULT_THREAD_SCAN (1000 * 1000000LL)
+
+struct ThreadEntry {
+    int tid;
+    int target;
+    unsigned int generation;    /* of the target, which may be reused */
+};
+
+/* threads of one monitored thread group, sorted by tid */
+struct ThreadGroupScan {
+    int target;
+    int tgid;
+    DIR *task_dir;
+    struct ThreadEntry *threads;
+    int n_threads;
+};
+
+/*
+ * Discovers the threads of every TGID target and adds each one as a PID
+ * target of its own. /proc/<tgid>/task stays open and is re-read on a slower
+ * cadence than the sampling period, or early when a thread has exited.
+ */
+struct ThreadScanner {
+    struct TargetList *targets;
+    struct ThreadGroupScan *groups;
+    int n_groups;
+    time_t interval;
+    time_t next_scan;
+    int requested;
+};
+
+int thread_scanner_init(struct ThreadScanner *scanner,
+                        struct TargetList *targets, time_t interval);
+/* rescans if due, returns the number of threads that were added */
+int thread_scanner_poll(struct ThreadScanner *scanner, time_t now);
+void thread_scanner_free(struct ThreadScanner *scanner);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,50 @@
+#ifndef TICKER_H
+#define TICKER_H
+
+#include <time.h>
+
+/* bounds of the adaptive spin window of the hybrid modes */
+#define TICKER_MIN_SPIN   (5 * 1000LL)
+#define TICKER_MAX_SPIN   (500 * 1000LL)
+#define TICKER_FIFO_PRIORITY 10
+
+enum TickerMode {
+    TICKER_SLEEP,   /* wake up from the timer at the deadline */
+    TICKER_HYBRID,  /* wake up a little early and spin to the deadline */
+    TICKER_FIFO     /* hybrid on a pinned CPU with SCHED_FIFO priority */
+};
+
+/*
+ * Tick source of the engine. Deadlines are absolute on CLOCK_MONOTONIC so
+ * they neither drift nor follow wall clock jumps, and the timerfd is armed
+ * one-shot for every tick. In the hybrid modes it fires a spin window ahead
+ * of the deadline; the window follows the observed timer lateness so that
+ * spinning costs only what the timer resolution requires.
+ */
+struct Ticker {
+    enum TickerMode mode;
+    int cpu;                /* CPU of TICKER_FIFO, -1 for any */
+    int fd;
+    time_t period;
+    time_t next;            /* deadline of the next tick */
+    time_t spin;            /* current spin window */
+    time_t last;            /* start of the previous tick, 0 before the first */
+    time_t late;            /* lateness of the last tick */
+
+    /* statistics of the achieved period and of the lateness of ticks */
+    unsigned long long n_ticks, n_missed;
+    time_t period_min, period_max;
+    time_t late_max;
+    double period_total, late_total, spin_total;
+};
+
+int ticker_init(struct Ticker *ticker, enum TickerMode mode, time_t period,
+                int cpu);
+int ticker_start(struct Ticker *ticker);
+int ticker_stop(struct Ticker *ticker);
+/* waits for the deadline once the fd is readable, returns missed ticks */
+int ticker_wait(struct Ticker *ticker);
+void ticker_print_stats(const struct Ticker *ticker);
+void ticker_destroy(struct Ticker *ticker);
+
+#endif
\ No newline at end of file
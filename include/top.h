@@ -0,0 +1,51 @@
+#ifndef TOP_H
+#define TOP_H
+
+#include <time.h>
+#include "rates.h"
+
+/* what --top ranks the processes by */
+enum TopSort {
+    TOP_CPU_DELAY,      /* waiting for a CPU, ms per second */
+    TOP_BLKIO_DELAY,    /* waiting for block IO, ms per second */
+    TOP_SWAPIN_DELAY    /* waiting for swap-in, ms per second */
+};
+
+/*
+ * Table of --top. The rates of every process since the previous sweep are
+ * ranked by one delay rate and only the K largest of a tick are
+ * kept, in a min-heap bounded to K entries, so ranking costs log K per
+ * process and nothing is allocated per sweep. The records of a sweep carry
+ * its tick id, the first record of the next tick completes the table.
+ * The TGID aggregates of taskstats carry no page faults, so there is no
+ * fault rate to show or rank by.
+ */
+struct TopTable {
+    int k;
+    enum TopSort sort;
+    int refresh;            /* redraw the table in place on a terminal */
+    struct RateTracker rates;
+    struct TaskRates *heap; /* the smallest key at the root */
+    int n_heap;
+    unsigned int tick;      /* of the records being ranked */
+    int n_tasks;            /* processes with rates in the tick */
+    double total;           /* the key summed over them */
+    unsigned long long n_tables;
+};
+
+int top_sort_parse(const char *name, enum TopSort *sort);
+int top_table_init(struct TopTable *top, int k, enum TopSort sort,
+                   int refresh);
+/* whether the record starts a new tick, the table is then written first */
+int top_table_due(const struct TopTable *top,
+                  const struct TaskStatistics *stats);
+void top_table_add(struct TopTable *top, const struct TaskStatistics *stats);
+void top_table_free(struct TopTable *top);
+
+/* room of the table, K rows and three lines around them */
+#define TOP_LINE_LEN 192
+#define TOP_TABLE_LEN(k) (((k) + 3) * TOP_LINE_LEN)
+/* writes the table of the tick, largest first, this empties the heap */
+char* top_table_format(struct TopTable *top, char *p);
+
+#endif
\ No newline at end of file
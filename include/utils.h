@@ -7,7 +7,16 @@
 #define MICRO_SECOND 1000
 #define MILL_SECOND  1000000
 
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() do {} while (0)
+#endif
+
+/* wall clock time, used to timestamp records */
 time_t get_ns_timestamp();
+/* CLOCK_MONOTONIC time, used for deadlines */
+time_t get_monotonic_timestamp();
 void sleep_until(time_t t_target_ns);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,82 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <time.h>
+#include "taskstats.h"
+
+/*
+ * Downsampling of --window: the samples of a target are folded into fixed
+ * windows aligned to the wall clock, and only a summary per window and
+ * target is written. Memory is constant per target whatever the sampling
+ * rate.
+ */
+
+/* streaming estimate of one quantile, the P-square algorithm */
+struct Quantile {
+    double p;
+    int count;
+    double heights[5];
+    int positions[5];
+    double desired[5];
+};
+
+void quantile_init(struct Quantile *quantile, double p);
+void quantile_add(struct Quantile *quantile, double x);
+double quantile_get(const struct Quantile *quantile);
+
+/* quantiles of the per-interval deltas that are kept */
+#define WINDOW_N_QUANTILES 3
+/* counters and delay totals of the text columns, ac_btime aside */
+#define WINDOW_N_FIELDS 28
+/* then rss, run time and run queue wait with --proc-stats */
+#define WINDOW_MAX_FIELDS (WINDOW_N_FIELDS + 3)
+
+struct FieldWindow {
+    unsigned long long min, max, last;
+    double sum;
+    struct Quantile deltas[WINDOW_N_QUANTILES];
+};
+
+struct TaskWindow {
+    time_t start;           /* 0 before the first sample */
+    int pid;
+    unsigned int generation;    /* of the target, a reuse closes the window */
+    int n_samples;
+    char comm[TS_COMM_LEN];
+    /* previous sample, carried over windows for the deltas */
+    int has_previous;
+    unsigned long long previous[WINDOW_MAX_FIELDS];
+    struct FieldWindow fields[WINDOW_MAX_FIELDS];
+};
+
+struct WindowAggregator {
+    time_t width;
+    int n_fields;           /* WINDOW_N_FIELDS, or all with --proc-stats */
+    struct TaskWindow *windows;
+    int n_windows;
+    unsigned long long n_written;
+};
+
+void window_aggregator_init(struct WindowAggregator *agg, time_t width,
+                            int proc_stats);
+/* window of the target, NULL on allocation failure */
+struct TaskWindow* window_aggregator_get(struct WindowAggregator *agg,
+                                         int target);
+/* whether the sample ends the window, which is then to be written first */
+int task_window_due(const struct WindowAggregator *agg,
+                    const struct TaskWindow *window,
+                    const struct TaskStatistics *stats);
+void task_window_add(struct WindowAggregator *agg, struct TaskWindow *window,
+                     const struct TaskStatistics *stats);
+void window_aggregator_free(struct WindowAggregator *agg);
+
+/* room of one summary line, without the newline */
+#define TASK_WINDOW_STR_LEN (WINDOW_MAX_FIELDS * 7 * 24 + 128)
+char* task_window_format(const struct WindowAggregator *agg,
+                         const struct TaskWindow *window, char *p);
+/* the names of the columns, without the newline */
+#define TASK_WINDOW_COLUMNS_LEN (WINDOW_MAX_FIELDS * 7 * 48 + 64)
+char* task_window_format_columns(const struct WindowAggregator *agg,
+                                 char *p);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdio.h>
+#include "exec.h"
+#include "taskstats.h"
+
+#define MAX_WORKLOADS 16
+
+/*
+ * Commands of --cmd and of "-- custom command", run side by side. They are
+ * spawned together and released with the same first tick, so they share
+ * the tick schedule. The processing thread keeps the last record of each
+ * for the summary at exit, and the high water marks of its memory over all
+ * records: the last one is often of a zombie, which has no memory left, and
+ * the TGID aggregates of --threads carry none, so with --threads they are
+ * taken from the records of the threads.
+ */
+struct Workloads {
+    int n_workloads;
+    struct Command commands[MAX_WORKLOADS];
+    char *names[MAX_WORKLOADS];         /* command line as given */
+    int targets[MAX_WORKLOADS];
+    struct TaskStatistics last[MAX_WORKLOADS];
+    int has_last[MAX_WORKLOADS];
+    unsigned long long hiwater_rss[MAX_WORKLOADS];  /* KiB */
+    unsigned long long hiwater_vm[MAX_WORKLOADS];
+};
+
+void workloads_init(struct Workloads *workloads);
+/*
+ * spawns a command held at its start barrier, its output goes to
+ * redirect_out or to redirect_out.N once there are several commands
+ */
+int workloads_spawn(struct Workloads *workloads, int argc, char *argv[],
+                    const char *redirect_out, int n_planned);
+/* index of the workload of a target, -1 if none */
+int workloads_find(const struct Workloads *workloads, int target);
+void workloads_update(struct Workloads *workloads,
+                      const struct TaskStatistics *stats);
+/* side-by-side comparison of the last records */
+void workloads_print_summary(FILE *file, const struct Workloads *workloads);
+void workloads_destroy(struct Workloads *workloads);
+
+#endif
\ No newline at end of file
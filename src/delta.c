@@ -0,0 +1,316 @@
+#include "delta.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int put_varint(char *buf, uint64_t v) {
+    int n = 0;
+    while (v >= 0x80) {
+        buf[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (char)v;
+    return n;
+}
+
+static int get_varint(const char **pos, const char *end, uint64_t *v) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *pos < end; shift += 7) {
+        unsigned char byte = (unsigned char)*(*pos)++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *v = result;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static void set_field(const struct RecordField *field, void *record,
+                      uint64_t v) {
+    char *p = (char*)record + field->offset;
+    switch (field->size) {
+        case 1: { uint8_t x = v; memcpy(p, &x, 1); break; }
+        case 2: { uint16_t x = v; memcpy(p, &x, 2); break; }
+        case 4: { uint32_t x = v; memcpy(p, &x, 4); break; }
+        case 8: memcpy(p, &v, 8); break;
+        default: break;
+    }
+}
+
+static int find_timestamp_field(const struct RecordField *fields, int n) {
+    for (int i = 0; i < n; i++) {
+        if (!strncmp(fields[i].name, "timestamp", RECORD_FIELD_NAME_LEN)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static struct DeltaState* get_state(struct DeltaState **states, int *n_states,
+                                    int target, size_t record_size) {
+    if (target >= *n_states) {
+        int n = *n_states ? *n_states : 16;
+        while (n <= target) {
+            n *= 2;
+        }
+        struct DeltaState *grown = (struct DeltaState*)realloc(
+            *states, n * sizeof(struct DeltaState));
+        if (!grown) {
+            return NULL;
+        }
+        memset(grown + *n_states, 0, (n - *n_states) * sizeof(*grown));
+        *states = grown;
+        *n_states = n;
+    }
+    struct DeltaState *state = &(*states)[target];
+    if (!state->record && !(state->record = (char*)calloc(1, record_size))) {
+        return NULL;
+    }
+    return state;
+}
+
+static void free_states(struct DeltaState *states, int n_states) {
+    for (int i = 0; i < n_states; i++) {
+        free(states[i].record);
+    }
+    free(states);
+}
+
+int delta_encoder_init(struct DeltaEncoder *enc, FILE *file) {
+    memset(enc, 0, sizeof(*enc));
+    enc->file = file;
+    enc->fields = record_fields;
+    enc->n_fields = record_n_fields;
+    enc->timestamp_field = find_timestamp_field(enc->fields, enc->n_fields);
+    enc->record_size = sizeof(struct TaskStatistics);
+    enc->block = 1;
+    enc->buf = (char*)malloc(DELTA_BLOCK_SIZE);
+    return enc->buf == NULL;
+}
+
+static int flush_block(struct DeltaEncoder *enc) {
+    if (!enc->header.n_frames) {
+        return 0;
+    }
+    enc->header.magic = DELTA_BLOCK_MAGIC;
+    enc->header.size = enc->len;
+    int ret = fwrite(&enc->header, sizeof(enc->header), 1, enc->file) != 1 ||
+              fwrite(enc->buf, 1, enc->len, enc->file) != enc->len;
+    enc->bytes_out += sizeof(enc->header) + enc->len;
+    memset(&enc->header, 0, sizeof(enc->header));
+    enc->len = 0;
+    enc->block++;
+    return ret;
+}
+
+int delta_encoder_write(struct DeltaEncoder *enc,
+                        const struct TaskStatistics *stats) {
+    const char *cur = (const char*)stats;
+    size_t bitmap_size = (enc->n_fields + 7) / 8;
+    size_t worst = 10 + bitmap_size + enc->n_fields * 10 + enc->record_size;
+    if (enc->len + worst > DELTA_BLOCK_SIZE ||
+        (enc->header.n_frames &&
+         stats->timestamp - enc->header.first_timestamp > DELTA_BLOCK_SPAN)) {
+        if (flush_block(enc)) {
+            return 1;
+        }
+    }
+    struct DeltaState *state = get_state(&enc->states, &enc->n_states,
+                                         stats->target, enc->record_size);
+    if (!state) {
+        return 1;
+    }
+
+    char *start = enc->buf + enc->len;
+    char *p = start;
+    int64_t timestamp_delta = 0;
+    int keyframe = state->block != enc->block;
+    if (!keyframe) {
+        p += put_varint(p, ((uint64_t)stats->target << 1) | 1);
+        unsigned char *bitmap = (unsigned char*)p;
+        memset(bitmap, 0, bitmap_size);
+        p += bitmap_size;
+        for (int i = 0; i < enc->n_fields; i++) {
+            const struct RecordField *f = &enc->fields[i];
+            if (f->type == RECORD_FIELD_STR) {
+                if (memcmp(cur + f->offset, state->record + f->offset,
+                           f->size)) {
+                    bitmap[i >> 3] |= 1 << (i & 7);
+                    memcpy(p, cur + f->offset, f->size);
+                    p += f->size;
+                }
+                continue;
+            }
+            uint64_t delta = record_field_uint(f, cur) -
+                             record_field_uint(f, state->record);
+            if (i == enc->timestamp_field) {
+                timestamp_delta = (int64_t)delta;
+                delta -= state->timestamp_delta;
+            }
+            if (delta) {
+                bitmap[i >> 3] |= 1 << (i & 7);
+                p += put_varint(p, zigzag((int64_t)delta));
+            }
+        }
+        /* a frame that grew beyond the raw record is not worth it */
+        keyframe = (size_t)(p - start) > enc->record_size + 5;
+    }
+    if (keyframe) {
+        p = start + put_varint(start, (uint64_t)stats->target << 1);
+        memcpy(p, cur, enc->record_size);
+        p += enc->record_size;
+        timestamp_delta = 0;
+    }
+
+    memcpy(state->record, cur, enc->record_size);
+    state->block = enc->block;
+    state->timestamp_delta = timestamp_delta;
+    if (!enc->header.n_frames) {
+        enc->header.first_timestamp = stats->timestamp;
+    }
+    enc->header.last_timestamp = stats->timestamp;
+    enc->header.n_frames++;
+    enc->len += p - start;
+    enc->bytes_in += enc->record_size;
+    return 0;
+}
+
+int delta_encoder_finish(struct DeltaEncoder *enc) {
+    int ret = flush_block(enc);
+    free_states(enc->states, enc->n_states);
+    enc->states = NULL;
+    enc->n_states = 0;
+    free(enc->buf);
+    enc->buf = NULL;
+    return ret;
+}
+
+int delta_decoder_init(struct DeltaDecoder *dec,
+                       const struct RecordReader *reader) {
+    memset(dec, 0, sizeof(*dec));
+    dec->reader = reader;
+    dec->timestamp_field = find_timestamp_field(reader->fields,
+                                                reader->header->n_fields);
+    dec->record = (char*)malloc(reader->header->record_size);
+    return dec->record == NULL;
+}
+
+/* moves to the block starting at next, returns its header or 0 at the end */
+static int open_block(struct DeltaDecoder *dec, const char *next,
+                      struct DeltaBlockHeader *header) {
+    const char *data_end = dec->reader->records + dec->reader->data_size;
+    if ((size_t)(data_end - next) < sizeof(*header)) {
+        return 0;
+    }
+    memcpy(header, next, sizeof(*header));
+    if (header->magic != DELTA_BLOCK_MAGIC ||
+        header->size > (size_t)(data_end - next) - sizeof(*header)) {
+        return 0;
+    }
+    dec->block = next;
+    dec->pos = next + sizeof(*header);
+    dec->end = dec->pos + header->size;
+    dec->block_no++;
+    return 1;
+}
+
+const void* delta_decoder_next(struct DeltaDecoder *dec) {
+    const struct RecordFileHeader *file_header = dec->reader->header;
+    struct DeltaBlockHeader header;
+    while (dec->pos >= dec->end) {
+        const char *next = dec->block ? dec->end : dec->reader->records;
+        if (!open_block(dec, next, &header)) {
+            return NULL;
+        }
+    }
+
+    uint64_t tag;
+    /* no writer has more targets than a TargetList holds */
+    if (!get_varint(&dec->pos, dec->end, &tag) ||
+        (tag >> 1) >= TARGET_MAX_CHUNKS * TARGET_CHUNK_SIZE) {
+        return NULL;
+    }
+    struct DeltaState *state = get_state(&dec->states, &dec->n_states,
+                                         (int)(tag >> 1),
+                                         file_header->record_size);
+    if (!state) {
+        return NULL;
+    }
+    if (!(tag & 1)) {
+        if ((size_t)(dec->end - dec->pos) < file_header->record_size) {
+            return NULL;
+        }
+        memcpy(state->record, dec->pos, file_header->record_size);
+        dec->pos += file_header->record_size;
+        state->timestamp_delta = 0;
+    } else {
+        size_t bitmap_size = (file_header->n_fields + 7) / 8;
+        if (state->block != dec->block_no ||
+            (size_t)(dec->end - dec->pos) < bitmap_size) {
+            return NULL;
+        }
+        const unsigned char *bitmap = (const unsigned char*)dec->pos;
+        dec->pos += bitmap_size;
+        for (uint32_t i = 0; i < file_header->n_fields; i++) {
+            const struct RecordField *f = &dec->reader->fields[i];
+            int changed = bitmap[i >> 3] & (1 << (i & 7));
+            uint64_t delta = 0;
+            if (changed && f->type == RECORD_FIELD_STR) {
+                if ((size_t)(dec->end - dec->pos) < f->size) {
+                    return NULL;
+                }
+                memcpy(state->record + f->offset, dec->pos, f->size);
+                dec->pos += f->size;
+                continue;
+            }
+            if (changed) {
+                uint64_t v;
+                if (!get_varint(&dec->pos, dec->end, &v)) {
+                    return NULL;
+                }
+                delta = (uint64_t)unzigzag(v);
+            }
+            if ((int)i == dec->timestamp_field) {
+                delta += state->timestamp_delta;
+                state->timestamp_delta = (int64_t)delta;
+            }
+            if (delta) {
+                set_field(f, state->record,
+                          record_field_uint(f, state->record) + delta);
+            }
+        }
+    }
+    state->block = dec->block_no;
+    memcpy(dec->record, state->record, file_header->record_size);
+    return dec->record;
+}
+
+void delta_decoder_seek(struct DeltaDecoder *dec, int64_t timestamp) {
+    struct DeltaBlockHeader header;
+    const char *next = dec->reader->records;
+    while (open_block(dec, next, &header)) {
+        if (header.last_timestamp >= timestamp) {
+            return;
+        }
+        next = dec->end;
+    }
+    /* every block ends before timestamp */
+    dec->block = dec->pos = dec->end =
+        dec->reader->records + dec->reader->data_size;
+}
+
+void delta_decoder_free(struct DeltaDecoder *dec) {
+    free_states(dec->states, dec->n_states);
+    dec->states = NULL;
+    dec->n_states = 0;
+    free(dec->record);
+    dec->record = NULL;
+}
\ No newline at end of file
@@ -0,0 +1,1101 @@
+#include "engine.h"
+#include <errno.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
+#include <netlink/genl/genl.h>
+#include <netlink/genl/ctrl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "utils.h"
+
+#define SOCKET_RCVBUF   (4 << 20)
+#define SOCKET_SNDBUF   (1 << 20)
+#define BATCH_SIZE      (32 << 10)
+#define DRAIN_TIMEOUT   (100 * MILL_SECOND)
+#define max(a, b) (a > b ? a : b)
+#define MAX_EVENTS      16
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open  434
+#endif
+
+/* the workers record the latencies of their queries at the same time */
+static void record_latency(struct QueryEngine* engine, enum Stage stage,
+                           time_t value) {
+    if (engine->n_shards > 1) {
+        histogram_record_shared(&engine->latency.stages[stage], value);
+    } else {
+        histogram_record(&engine->latency.stages[stage], value);
+    }
+}
+
+/* returns 1 if the target was alive, the workers may race for it */
+static int retire_target(struct QueryEngine* engine, struct Target* target) {
+    if (!__atomic_exchange_n(&target->alive, 0, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    if (!target_is_transient(target)) {
+        __atomic_sub_fetch(&engine->n_alive, 1, __ATOMIC_RELAXED);
+    }
+    return 1;
+}
+
+static struct InflightQuery* find_inflight(struct QueryShard* shard,
+                                           unsigned int seq) {
+    struct InflightQuery* q = &shard->inflight[seq & shard->inflight_mask];
+    if (!q->in_use || q->seq != seq) {
+        return NULL;
+    }
+    return q;
+}
+
+static void retire_inflight(struct QueryShard* shard,
+                            struct InflightQuery* q) {
+    q->in_use = 0;
+    shard->n_inflight--;
+}
+
+static int check_sequence(struct nl_msg* msg, void* arg) {
+    struct QueryShard* shard = (struct QueryShard*)arg;
+    if (!find_inflight(shard, nlmsg_hdr(msg)->nlmsg_seq)) {
+        shard->n_stray++;
+        return NL_SKIP;
+    }
+    return NL_OK;
+}
+
+static void handle_error(struct QueryShard* shard, struct nlmsgerr* error) {
+    struct QueryEngine* engine = shard->engine;
+    struct InflightQuery* q = find_inflight(shard, error->msg.nlmsg_seq);
+    shard->n_errors++;
+    if (!q) {
+        return;
+    }
+    struct Target* target = target_list_get(engine->targets, q->target);
+    unsigned int generation = q->generation;
+    retire_inflight(shard, q);
+    if (generation != target->generation) {
+        /* about a task whose index has been reused since */
+        return;
+    }
+    if (target->command_type == TARGET_CGROUP) {
+        /* not a cgroup v1 directory or gone, no use asking again */
+        if (retire_target(engine, target)) {
+            fprintf(stderr, "Unable to query the cgroup %s: %s\n",
+                    target->path, strerror(-error->error));
+        }
+        return;
+    }
+    if (target_is_transient(target) && error->error == -ESRCH) {
+        /* a thread or process has exited, pick up the change next tick */
+        retire_target(engine, target);
+        int* requested = target->scanned ? &engine->procs->requested :
+                         engine->scanner ? &engine->scanner->requested : NULL;
+        if (requested) {
+            __atomic_store_n(requested, 1, __ATOMIC_RELAXED);
+        }
+        return;
+    }
+    fprintf(stderr, "Netlink receive error: %s\n", strerror(-error->error));
+}
+
+static int print_receive_error(struct sockaddr_nl* address,
+                               struct nlmsgerr* error, void* arg) {
+    handle_error((struct QueryShard*)arg, error);
+    return NL_SKIP;
+}
+
+/*
+ * when a task is due again with --max-period: at the next tick while its
+ * CPU time or delays move, twice as late as before while they barely do.
+ * Each target is queried by one shard per sweep, its state needs no lock
+ */
+static void adapt_interval(struct QueryEngine* engine, struct Target* target,
+                           unsigned int tick, const struct taskstats* s) {
+    unsigned long long busy = (s->ac_utime + s->ac_stime) * 1000 +
+                              s->cpu_delay_total + s->blkio_delay_total +
+                              s->swapin_delay_total;
+    unsigned int interval = target->interval;
+    if (!target->has_sample || busy < target->busy) {
+        /* the first sample, or counters going back after a PID reuse */
+        interval = 1;
+    } else if (tick != target->last_tick) {
+        double rate = (double)(busy - target->busy) /
+                      ((tick - target->last_tick) * engine->period);
+        if (rate > ADAPT_BUSY) {
+            interval = 1;
+        } else if (rate < ADAPT_IDLE && interval < engine->max_interval) {
+            interval = 2 * interval < engine->max_interval ?
+                       2 * interval : engine->max_interval;
+        }
+    }
+    target->busy = busy;
+    target->last_tick = tick;
+    target->has_sample = 1;
+    target->interval = interval;
+    __atomic_store_n(&target->next_tick, tick + interval, __ATOMIC_RELAXED);
+}
+
+/* decodes a reply into a queue slot, straight from the receive buffer */
+static void handle_reply(struct QueryShard* shard, struct nlmsghdr* hdr) {
+    struct QueryEngine* engine = shard->engine;
+    time_t t_cur = get_ns_timestamp();
+    struct InflightQuery* q = find_inflight(shard, hdr->nlmsg_seq);
+    if (!q) {
+        return;
+    }
+    record_latency(engine, STAGE_ROUND_TRIP, t_cur - q->t_send);
+    shard->n_received++;
+
+    int target = q->target;
+    unsigned int tick = q->tick;
+    unsigned int generation = q->generation;
+    struct Target* t = target_list_get(engine->targets, target);
+    struct ProcSupplement proc = q->proc;
+    retire_inflight(shard, q);
+    if (generation != t->generation) {
+        shard->n_stray++;
+        return;
+    }
+
+    struct TaskStatistics* stats = concurrent_queue_claim(engine->que);
+    if (!stats) {
+        return;
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats->timestamp = t_cur;
+    stats->target = target;
+    stats->generation = generation;
+    stats->tick = tick;
+    stats->match = t->match;
+    stats->proc = proc;
+    if (t->group >= 0) {
+        stats->tgid = target_list_get(engine->targets, t->group)->pid;
+    }
+    task_stats_parse_reply(hdr, stats);
+    if (engine->max_interval > 1 &&
+        (t->command_type == TASKSTATS_CMD_ATTR_PID ||
+         t->command_type == TASKSTATS_CMD_ATTR_TGID)) {
+        adapt_interval(engine, t, tick, &stats->stats);
+    }
+
+    concurrent_queue_publish(engine->que, stats);
+    record_latency(engine, STAGE_PARSE, get_ns_timestamp() - t_cur);
+}
+
+static int parse_task_stats(struct nl_msg* msg, void* arg) {
+    handle_reply((struct QueryShard*)arg, nlmsg_hdr(msg));
+    return NL_OK;
+}
+
+/* the raw transport's counterpart of the libnl callbacks */
+static void handle_message(struct QueryShard* shard, struct nlmsghdr* hdr) {
+    if (!find_inflight(shard, hdr->nlmsg_seq)) {
+        shard->n_stray++;
+    } else if (hdr->nlmsg_type == NLMSG_ERROR) {
+        handle_error(shard, (struct nlmsgerr*)NLMSG_DATA(hdr));
+    } else if (hdr->nlmsg_type == shard->engine->family_id) {
+        handle_reply(shard, hdr);
+    }
+}
+
+static int flush_task_stats_queries(struct QueryShard* shard) {
+    struct QueryEngine* engine = shard->engine;
+    if (!shard->batch_len) {
+        return 0;
+    }
+    time_t t_send = get_ns_timestamp();
+    for (unsigned int seq = shard->batch_first_seq; seq != shard->next_seq;
+         seq++) {
+        shard->inflight[seq & shard->inflight_mask].t_send = t_send;
+    }
+    int result;
+    if (engine->transport == NETLINK_RAW) {
+        result = raw_netlink_send(&shard->raw, shard->batch,
+                                  shard->batch_len, BATCH_SIZE);
+    } else {
+        result = nl_sendto(shard->netlink_socket, shard->batch,
+                           shard->batch_len);
+    }
+    record_latency(engine, STAGE_SEND, get_ns_timestamp() - t_send);
+    shard->batch_len = 0;
+    if (result < 0) {
+        if (engine->transport == NETLINK_RAW) {
+            fprintf(stderr, "Failed to query taskstats: %s\n",
+                    strerror(-result));
+        } else {
+            nl_perror(result, "Failed to query taskstats");
+        }
+        for (unsigned int seq = shard->batch_first_seq;
+             seq != shard->next_seq; seq++) {
+            struct InflightQuery* q = find_inflight(shard, seq);
+            if (q) {
+                retire_inflight(shard, q);
+                shard->n_sent--;
+            }
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* copies the query from its template, no message is built */
+static void put_raw_query(struct QueryShard* shard, struct Target* target) {
+    if (shard->batch_len + RAW_REQUEST_LEN > shard->batch_cap) {
+        flush_task_stats_queries(shard);
+    }
+    if (shard->batch_len == 0) {
+        shard->batch_first_seq = shard->next_seq;
+    }
+    raw_netlink_put_query(&shard->raw, shard->batch + shard->batch_len,
+                          target->command_type, target->pid,
+                          shard->next_seq);
+    shard->batch_len += RAW_REQUEST_LEN;
+}
+
+static int put_libnl_query(struct QueryShard* shard, struct Target* target) {
+    int family_id = shard->engine->family_id;
+    struct nl_msg* message = nlmsg_alloc();
+    if (!message) {
+        return 1;
+    }
+    if (target->command_type == TARGET_CGROUP) {
+        genlmsg_put(message, NL_AUTO_PID, shard->next_seq, family_id,
+                    0, NLM_F_REQUEST, CGROUPSTATS_CMD_GET, TASKSTATS_VERSION);
+        nla_put_u32(message, CGROUPSTATS_CMD_ATTR_FD, target->pid);
+    } else {
+        genlmsg_put(message, NL_AUTO_PID, shard->next_seq, family_id,
+                    0, NLM_F_REQUEST, TASKSTATS_CMD_GET, TASKSTATS_VERSION);
+        nla_put_u32(message, target->command_type, target->pid);
+    }
+    struct nlmsghdr* hdr = nlmsg_hdr(message);
+    size_t len = NLMSG_ALIGN(hdr->nlmsg_len);
+    if (shard->batch_len + len > shard->batch_cap) {
+        flush_task_stats_queries(shard);
+    }
+    if (shard->batch_len == 0) {
+        shard->batch_first_seq = shard->next_seq;
+    }
+    memcpy(shard->batch + shard->batch_len, hdr, hdr->nlmsg_len);
+    shard->batch_len += len;
+    nlmsg_free(message);
+    return 0;
+}
+
+/* append the query for one target to the batch of the current tick */
+static int send_task_stats_query(struct QueryShard* shard, int idx) {
+    struct Target* target = target_list_get(shard->engine->targets, idx);
+    if (shard->engine->transport == NETLINK_RAW) {
+        put_raw_query(shard, target);
+    } else if (put_libnl_query(shard, target)) {
+        return 1;
+    }
+
+    unsigned int seq = shard->next_seq++;
+    struct InflightQuery* q = &shard->inflight[seq & shard->inflight_mask];
+    if (q->in_use) {
+        /* the reply for this slot never came back, give up on it */
+        retire_inflight(shard, q);
+        shard->n_lost++;
+    }
+    q->seq = seq;
+    q->tick = shard->tick;
+    q->target = idx;
+    q->generation = target->generation;
+    q->in_use = 1;
+    shard->n_inflight++;
+    shard->n_sent++;
+    if (shard->engine->proc_stats) {
+        /* while the kernel answers, no reopening or stdio */
+        proc_files_read(&target->files, &q->proc);
+    }
+    return 0;
+}
+
+static int receive_raw_replies(struct QueryShard* shard) {
+    int n;
+    while ((n = raw_netlink_receive(&shard->raw)) > 0) {
+        for (int i = 0; i < n; i++) {
+            int len;
+            struct nlmsghdr* hdr = raw_netlink_datagram(&shard->raw, i,
+                                                        &len);
+            for (; NLMSG_OK(hdr, len); hdr = NLMSG_NEXT(hdr, len)) {
+                handle_message(shard, hdr);
+            }
+        }
+        if (n < RAW_NETLINK_RECV_BATCH) {
+            break;
+        }
+    }
+    return n < 0;
+}
+
+static int receive_replies(struct QueryShard* shard) {
+    if (shard->engine->transport == NETLINK_RAW) {
+        return receive_raw_replies(shard);
+    }
+    int ret;
+    while ((ret = nl_recvmsgs_report(shard->netlink_socket,
+                                     shard->callbacks)) > 0);
+    if (ret < 0 && ret != -NLE_AGAIN) {
+        nl_perror(ret, "Failed to receive message");
+        return 1;
+    }
+    return 0;
+}
+
+/* resizes the in-flight table, keeping the queries still outstanding */
+static int grow_inflight(struct QueryShard* shard, unsigned int n_slots) {
+    struct InflightQuery* table = (struct InflightQuery*)calloc(
+        n_slots, sizeof(struct InflightQuery));
+    if (!table) {
+        return 1;
+    }
+    if (shard->inflight) {
+        for (unsigned int i = 0; i <= shard->inflight_mask; i++) {
+            if (shard->inflight[i].in_use) {
+                table[shard->inflight[i].seq & (n_slots - 1)] =
+                    shard->inflight[i];
+            }
+        }
+        free(shard->inflight);
+    }
+    shard->inflight = table;
+    shard->inflight_mask = n_slots - 1;
+    return 0;
+}
+
+/*
+ * tasks that are not threads of a group or found by --top report their
+ * exit on a pidfd, kernels without pidfd_open check them with kill() every
+ * tick. Processes of --match get one too for their final sample
+ */
+static void watch_exit(struct QueryEngine* engine, struct Target* target) {
+    if (target->group >= 0 || (target->scanned && !target->match) ||
+        target->pidfd >= 0 ||
+        (target->command_type != TASKSTATS_CMD_ATTR_PID &&
+         target->command_type != TASKSTATS_CMD_ATTR_TGID)) {
+        return;
+    }
+    int fd = syscall(SYS_pidfd_open, target->pid, 0);
+    if (fd < 0) {
+        return;
+    }
+    struct epoll_event event = { .events = EPOLLIN };
+    event.data.fd = fd;
+    if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+        close(fd);
+        return;
+    }
+    target->pidfd = fd;
+}
+
+static void unwatch_exit(struct QueryEngine* engine, struct Target* target) {
+    if (target->pidfd >= 0) {
+        epoll_ctl(engine->epoll_fd, EPOLL_CTL_DEL, target->pidfd, NULL);
+        close(target->pidfd);
+        target->pidfd = -1;
+    }
+}
+
+static struct Command* find_command(struct QueryEngine* engine,
+                                    struct Target* target) {
+    if (target_is_transient(target) ||
+        target->command_type == TARGET_CGROUP) {
+        return NULL;
+    }
+    for (int i = 0; i < engine->n_commands; i++) {
+        if (engine->commands[i].pid == target->pid) {
+            return &engine->commands[i];
+        }
+    }
+    return NULL;
+}
+
+/* the task is a zombie until reaped, so it still answers the last query */
+static void task_exited(struct QueryEngine* engine, int pidfd) {
+    struct QueryShard* shard = &engine->shards[0];
+    for (int i = 0; i < engine->n_live; i++) {
+        int idx = engine->live[i];
+        struct Target* target = target_list_get(engine->targets, idx);
+        if (target->pidfd != pidfd) {
+            continue;
+        }
+        unwatch_exit(engine, target);
+        if (retire_target(engine, target)) {
+            shard->tick = engine->tick;
+            send_task_stats_query(shard, idx);
+            flush_task_stats_queries(shard);
+        }
+        struct Command* command = find_command(engine, target);
+        if (command) {
+            command_reap(command, 0);
+        }
+        return;
+    }
+}
+
+static int add_live_target(struct QueryEngine* engine, int idx) {
+    if (engine->n_live == engine->live_cap) {
+        int cap = engine->live_cap ? engine->live_cap * 2 : 64;
+        int* live = (int*)realloc(engine->live, cap * sizeof(int));
+        if (!live) {
+            return 1;
+        }
+        engine->live = live;
+        engine->live_cap = cap;
+    }
+    engine->live[engine->n_live++] = idx;
+    struct Target* target = target_list_get(engine->targets, idx);
+    watch_exit(engine, target);
+    if (engine->proc_stats &&
+        (target->command_type == TASKSTATS_CMD_ATTR_PID ||
+         target->command_type == TASKSTATS_CMD_ATTR_TGID)) {
+        proc_files_open(&target->files, target->group >= 0 ?
+                        target_list_get(engine->targets,
+                                        target->group)->pid : 0,
+                        target->pid);
+    }
+    /*
+     * room for a few ticks worth of replies from every target, in every
+     * shard as one may end up querying all of them
+     */
+    while (4U * engine->n_live > engine->inflight_slots) {
+        engine->inflight_slots <<= 1;
+    }
+    return 0;
+}
+
+/* the threads and processes the scanners have found go live */
+static void scan_targets(struct QueryEngine* engine) {
+    int first = engine->targets->n_targets;
+    int n_free = engine->targets->n_free;
+    time_t now = get_ns_timestamp();
+    int added = 0;
+    if (engine->scanner) {
+        added += thread_scanner_poll(engine->scanner, now);
+    }
+    if (engine->procs) {
+        added += proc_scanner_poll(engine->procs, now);
+    }
+    if (added > 0) {
+        /* the reused indices were taken from the end of the free list */
+        for (int i = engine->targets->n_free; i < n_free; i++) {
+            add_live_target(engine, engine->targets->free[i]);
+        }
+        for (int i = first; i < engine->targets->n_targets; i++) {
+            add_live_target(engine, i);
+        }
+    }
+}
+
+static void retire_live_target(struct QueryEngine* engine, int idx) {
+    if (engine->n_retired == engine->retired_cap) {
+        int cap = engine->retired_cap ? engine->retired_cap * 2 : 64;
+        struct RetiredTarget* retired = (struct RetiredTarget*)realloc(
+            engine->retired, cap * sizeof(struct RetiredTarget));
+        if (!retired) {
+            /* the index is not reused then */
+            return;
+        }
+        engine->retired = retired;
+        engine->retired_cap = cap;
+    }
+    engine->retired[engine->n_retired].target = idx;
+    engine->retired[engine->n_retired].tick = engine->tick;
+    engine->n_retired++;
+}
+
+/* hands the indices retired RECYCLE_TICKS ago back to the target list */
+static void release_retired(struct QueryEngine* engine) {
+    int n = 0;
+    while (n < engine->n_retired &&
+           engine->tick - engine->retired[n].tick >= RECYCLE_TICKS &&
+           !target_list_release(engine->targets,
+                                engine->retired[n].target)) {
+        n++;
+    }
+    if (n) {
+        engine->n_retired -= n;
+        memmove(engine->retired, engine->retired + n,
+                engine->n_retired * sizeof(struct RetiredTarget));
+    }
+}
+
+/* queries the targets live[lo, hi) of the current sweep */
+static void query_targets(struct QueryShard* shard, int lo, int hi) {
+    struct QueryEngine* engine = shard->engine;
+    /* the tick cannot move on before the chunk is done */
+    shard->tick = __atomic_load_n(&engine->tick, __ATOMIC_RELAXED);
+    if (shard->inflight_mask + 1 < engine->inflight_slots) {
+        grow_inflight(shard, engine->inflight_slots);
+    }
+    for (int i = lo; i < hi; i++) {
+        int idx = engine->live[i];
+        struct Target* target = target_list_get(engine->targets, idx);
+        /*
+         * threads and --top processes are retired by ESRCH replies and the
+         * scanners instead, cgroups by any error reply and tasks with a
+         * pidfd by task_exited. The command stays a zombie until reaped,
+         * kill() would not see it
+         */
+        if (!target_is_transient(target) &&
+            target->command_type != TARGET_CGROUP &&
+            target->pidfd < 0) {
+            time_t ts_b_kill = get_ns_timestamp();
+            struct Command* command = find_command(engine, target);
+            if (command ? command_reap(command, WNOHANG) :
+                kill(target->pid, 0)) { // after being killed, query the last time
+                retire_target(engine, target);
+            }
+            record_latency(engine, STAGE_KILL,
+                           get_ns_timestamp() - ts_b_kill);
+        }
+        /* a task that is not due with --max-period, unless it has exited */
+        if (engine->max_interval > 1 &&
+            __atomic_load_n(&target->alive, __ATOMIC_RELAXED) &&
+            (int)(__atomic_load_n(&target->next_tick, __ATOMIC_RELAXED) -
+                  shard->tick) > 0) {
+            shard->n_skipped++;
+            continue;
+        }
+        send_task_stats_query(shard, idx);
+    }
+    flush_task_stats_queries(shard);
+}
+
+/* takes up to n targets from the front of a share, or from its back */
+static int take_targets(unsigned long long* pending, int n, int back,
+                        int* lo, int* hi) {
+    unsigned long long cur = __atomic_load_n(pending, __ATOMIC_ACQUIRE);
+    while (1) {
+        unsigned int first = (unsigned int)cur;
+        unsigned int end = (unsigned int)(cur >> 32);
+        if (first >= end) {
+            return 0;
+        }
+        unsigned int take = end - first < (unsigned int)n ?
+                            end - first : (unsigned int)n;
+        unsigned long long next = back ?
+            (unsigned long long)(end - take) << 32 | first :
+            (unsigned long long)end << 32 | (first + take);
+        if (__atomic_compare_exchange_n(pending, &cur, next, 1,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *lo = back ? end - take : first;
+            *hi = back ? end : first + take;
+            return 1;
+        }
+    }
+}
+
+static int steal_targets(struct QueryShard* shard, int* lo, int* hi) {
+    struct QueryEngine* engine = shard->engine;
+    int self = shard - engine->shards;
+    for (int i = 1; i < engine->n_shards; i++) {
+        struct QueryShard* victim =
+            &engine->shards[(self + i) % engine->n_shards];
+        if (take_targets(&victim->pending, SWEEP_CHUNK, 1, lo, hi)) {
+            shard->n_stolen += *hi - *lo;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* the share of the shard first, then whatever the others have left */
+static void sweep(struct QueryShard* shard) {
+    int chunk = shard->engine->n_shards > 1 ? SWEEP_CHUNK : INT32_MAX;
+    int lo, hi;
+    while (take_targets(&shard->pending, chunk, 0, &lo, &hi) ||
+           steal_targets(shard, &lo, &hi)) {
+        query_targets(shard, lo, hi);
+        /*
+         * the kernel answers while the queries are sent, so the records
+         * of the chunk are published before the next sweep may start
+         */
+        if (shard->engine->n_shards > 1) {
+            receive_replies(shard);
+        }
+        __atomic_sub_fetch(&shard->engine->n_unsent, hi - lo,
+                           __ATOMIC_RELEASE);
+    }
+}
+
+/* splits the live targets evenly between the shards and wakes the workers */
+static void start_sweep(struct QueryEngine* engine) {
+    int n_shards = engine->n_shards;
+    __atomic_store_n(&engine->tick, engine->tick + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&engine->n_unsent, engine->n_live, __ATOMIC_RELAXED);
+    for (int i = 0; i < n_shards; i++) {
+        unsigned long long first = (long long)engine->n_live * i / n_shards;
+        unsigned long long end =
+            (long long)engine->n_live * (i + 1) / n_shards;
+        __atomic_store_n(&engine->shards[i].pending, end << 32 | first,
+                         __ATOMIC_RELEASE);
+    }
+    uint64_t one = 1;
+    for (int i = 1; i < n_shards; i++) {
+        /* the share of a worker that sleeps on is taken over by the others */
+        if (write(engine->shards[i].event_fd, &one, sizeof(one)) < 0) {
+            perror("Unable to wake up a query worker");
+        }
+    }
+    sweep(&engine->shards[0]);
+}
+
+static int handle_tick(struct QueryEngine* engine) {
+    int passed = ticker_wait(&engine->ticker);
+    if (passed <= 0) {
+        return passed < 0;
+    }
+    if (__atomic_load_n(&engine->n_unsent, __ATOMIC_ACQUIRE) > 0) {
+        /* workers are still sending the previous sweep */
+        engine->n_overruns += passed;
+        return 0;
+    }
+    engine->n_ticks++;
+    engine->n_overruns += passed - 1;
+    record_latency(engine, STAGE_TICK, engine->ticker.late);
+    if (engine->dump_interval && engine->ticker.last >= engine->next_dump) {
+        stage_histograms_print(stderr, &engine->latency);
+        engine->next_dump = engine->ticker.last + engine->dump_interval;
+    }
+
+    scan_targets(engine);
+
+    for (int i = 0; i < engine->n_live; ) {
+        int idx = engine->live[i];
+        struct Target* target = target_list_get(engine->targets, idx);
+        if (!__atomic_load_n(&target->alive, __ATOMIC_RELAXED)) {
+            unwatch_exit(engine, target);
+            proc_files_close(&target->files);
+            if (target_is_transient(target)) {
+                retire_live_target(engine, idx);
+            }
+            engine->live[i] = engine->live[--engine->n_live];
+            continue;
+        }
+        i++;
+    }
+    release_retired(engine);
+    start_sweep(engine);
+    return 0;
+}
+
+/* the libnl transport, messages are dispatched to the callbacks */
+static int connect_libnl(struct QueryShard* shard) {
+    /* generate netlink connection */
+    shard->netlink_socket = nl_socket_alloc();
+    if (!shard->netlink_socket) {
+        fprintf(stderr, "Unable to allocate netlink socket\n");
+        return 1;
+    }
+    int ret = genl_connect(shard->netlink_socket);
+    if (ret < 0) {
+        nl_perror(ret, "Unable to open netlink socket (are you root?)");
+        return 1;
+    }
+    int family_id = genl_ctrl_resolve(shard->netlink_socket,
+                                      TASKSTATS_GENL_NAME);
+    if (family_id < 0) {
+        nl_perror(family_id, "Unable to determine taskstats family id "
+                  "(does your kernel support taskstats?)");
+        return 1;
+    }
+    shard->engine->family_id = family_id;
+    nl_socket_disable_seq_check(shard->netlink_socket);
+    nl_socket_set_buffer_size(shard->netlink_socket, SOCKET_RCVBUF,
+                              SOCKET_SNDBUF);
+    ret = nl_socket_set_nonblocking(shard->netlink_socket);
+    if (ret < 0) {
+        nl_perror(ret, "Unable to make netlink socket non-blocking");
+        return 1;
+    }
+
+    /* register callback */
+    shard->callbacks = nl_cb_alloc(NL_CB_CUSTOM);
+    if (!shard->callbacks) {
+        fprintf(stderr, "Unable to allocate netlink callbacks\n");
+        return 1;
+    }
+    nl_cb_set(shard->callbacks, NL_CB_SEQ_CHECK, NL_CB_CUSTOM,
+              &check_sequence, shard);
+    nl_cb_set(shard->callbacks, NL_CB_VALID, NL_CB_CUSTOM,
+              &parse_task_stats, shard);
+    nl_cb_err(shard->callbacks, NL_CB_CUSTOM, &print_receive_error, shard);
+    shard->netlink_fd = nl_socket_get_fd(shard->netlink_socket);
+    return 0;
+}
+
+/* the socket of a shard and, for a worker, the epoll instance it waits on */
+static int init_shard(struct QueryEngine* engine, struct QueryShard* shard) {
+    shard->engine = engine;
+    if (engine->transport == NETLINK_RAW) {
+        if (raw_netlink_init(&shard->raw, SOCKET_RCVBUF, SOCKET_SNDBUF)) {
+            return 1;
+        }
+        engine->family_id = shard->raw.family_id;
+        shard->netlink_fd = shard->raw.fd;
+    } else if (connect_libnl(shard)) {
+        return 1;
+    }
+
+    shard->batch_cap = engine->transport == NETLINK_RAW ?
+                       RAW_NETLINK_SEND_BATCH * BATCH_SIZE : BATCH_SIZE;
+    shard->batch = (char*)malloc(shard->batch_cap);
+    if (!shard->batch) {
+        fprintf(stderr, "Unable to allocate query buffer\n");
+        return 1;
+    }
+    if (shard == engine->shards) {
+        return 0;
+    }
+    shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    shard->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (shard->epoll_fd < 0 || shard->event_fd < 0) {
+        perror("Unable to create the events of a query worker");
+        return 1;
+    }
+    struct epoll_event event = { .events = EPOLLIN };
+    event.data.fd = shard->event_fd;
+    if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->event_fd, &event)) {
+        perror("Unable to watch eventfd");
+        return 1;
+    }
+    event.data.fd = shard->netlink_fd;
+    if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->netlink_fd,
+                  &event)) {
+        perror("Unable to watch netlink socket");
+        return 1;
+    }
+    return 0;
+}
+
+int query_engine_init(struct QueryEngine *engine, struct ConcurrentQueue *que,
+                      struct TargetList *targets, time_t period,
+                      enum TickerMode tick_mode, int tick_cpu,
+                      enum NetlinkTransport transport, int n_workers) {
+    memset(engine, 0, sizeof(*engine));
+    engine->que = que;
+    engine->targets = targets;
+    engine->period = period;
+    engine->transport = transport;
+    engine->inflight_slots = MIN_INFLIGHT;
+    engine->max_interval = 1;
+    engine->epoll_fd = engine->ticker.fd = engine->signal_fd = -1;
+
+    if (n_workers < 1 || n_workers > MAX_WORKERS) {
+        fprintf(stderr, "Number of workers must be between 1 and %d\n",
+                MAX_WORKERS);
+        return 1;
+    }
+    engine->shards = (struct QueryShard*)aligned_alloc(
+        CACHE_LINE_SIZE, n_workers * sizeof(struct QueryShard));
+    if (!engine->shards) {
+        fprintf(stderr, "Unable to allocate query workers\n");
+        return 1;
+    }
+    memset(engine->shards, 0, n_workers * sizeof(struct QueryShard));
+    for (int i = 0; i < n_workers; i++) {
+        struct QueryShard* shard = &engine->shards[i];
+        shard->raw.fd = shard->netlink_fd = -1;
+        shard->epoll_fd = shard->event_fd = -1;
+    }
+    engine->n_shards = n_workers;
+    for (int i = 0; i < n_workers; i++) {
+        if (init_shard(engine, &engine->shards[i])) {
+            goto error;
+        }
+    }
+
+    /* one epoll instance watches the tick timer and the netlink socket */
+    if (ticker_init(&engine->ticker, tick_mode, period, tick_cpu)) {
+        goto error;
+    }
+    engine->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (engine->epoll_fd < 0) {
+        perror("Unable to create epoll instance");
+        goto error;
+    }
+    struct epoll_event event = { .events = EPOLLIN };
+    event.data.fd = engine->ticker.fd;
+    if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, engine->ticker.fd, &event)) {
+        perror("Unable to watch timerfd");
+        goto error;
+    }
+    event.data.fd = engine->shards[0].netlink_fd;
+    if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, event.data.fd, &event)) {
+        perror("Unable to watch netlink socket");
+        goto error;
+    }
+    return 0;
+
+error:
+    query_engine_destroy(engine);
+    return 1;
+}
+
+/* a worker sweeps its share when woken up and drains its socket */
+static void* run_worker(void* arg) {
+    struct QueryShard* shard = (struct QueryShard*)arg;
+    struct QueryEngine* engine = shard->engine;
+    while (1) {
+        int timeout = -1;
+        time_t t_stop = __atomic_load_n(&engine->t_stop, __ATOMIC_ACQUIRE);
+        if (t_stop) {
+            time_t t_left = t_stop - get_ns_timestamp();
+            if (shard->n_inflight == 0 || t_left <= 0) {
+                break;
+            }
+            timeout = (t_left + MILL_SECOND - 1) / MILL_SECOND;
+        }
+        struct epoll_event events[2];
+        int n = epoll_wait(shard->epoll_fd, events, 2, timeout);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait failed");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == shard->event_fd) {
+                uint64_t count;
+                if (read(shard->event_fd, &count, sizeof(count)) ==
+                        sizeof(count) &&
+                    !__atomic_load_n(&engine->t_stop, __ATOMIC_ACQUIRE)) {
+                    sweep(shard);
+                }
+            } else {
+                receive_replies(shard);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* the workers drain their replies until t_stop, then return */
+static void stop_workers(struct QueryEngine *engine, time_t t_stop) {
+    if (__atomic_load_n(&engine->t_stop, __ATOMIC_RELAXED)) {
+        return;
+    }
+    __atomic_store_n(&engine->t_stop, t_stop, __ATOMIC_RELEASE);
+    uint64_t one = 1;
+    for (int i = 1; i < engine->n_shards; i++) {
+        if (engine->shards[i].started &&
+            write(engine->shards[i].event_fd, &one, sizeof(one)) < 0) {
+            perror("Unable to stop a query worker");
+        }
+    }
+}
+
+static int start_workers(struct QueryEngine *engine) {
+    for (int i = 1; i < engine->n_shards; i++) {
+        struct QueryShard* shard = &engine->shards[i];
+        int ret = pthread_create(&shard->thread, NULL, &run_worker, shard);
+        if (ret) {
+            fprintf(stderr, "Unable to create query worker, %d\n", ret);
+            return 1;
+        }
+        shard->started = 1;
+    }
+    return 0;
+}
+
+/* waits for the workers and adds up the counters of all shards */
+static void join_workers(struct QueryEngine *engine) {
+    stop_workers(engine, 1);
+    for (int i = 0; i < engine->n_shards; i++) {
+        struct QueryShard* shard = &engine->shards[i];
+        if (shard->started) {
+            pthread_join(shard->thread, NULL);
+            shard->started = 0;
+        }
+        engine->n_sent += shard->n_sent;
+        engine->n_received += shard->n_received;
+        engine->n_errors += shard->n_errors;
+        engine->n_lost += shard->n_lost + shard->n_inflight;
+        engine->n_stray += shard->n_stray;
+        engine->n_stolen += shard->n_stolen;
+        engine->n_skipped += shard->n_skipped;
+    }
+}
+
+static time_t stop_ticking(struct QueryEngine *engine) {
+    ticker_stop(&engine->ticker);
+    time_t t_drain_end = get_ns_timestamp() +
+                         max(DRAIN_TIMEOUT, 2 * engine->period);
+    stop_workers(engine, t_drain_end);
+    return t_drain_end;
+}
+
+static int run(struct QueryEngine *engine) {
+    struct QueryShard* shard = &engine->shards[0];
+    int netlink_fd = shard->netlink_fd;
+    time_t t_drain_end = 0;
+
+    engine->n_alive = 0;
+    for (int i = 0; i < engine->targets->n_targets; i++) {
+        struct Target* target = target_list_get(engine->targets, i);
+        if (target->alive) {
+            engine->n_alive += !target_is_transient(target);
+            if (add_live_target(engine, i)) {
+                fprintf(stderr, "Unable to allocate target list\n");
+                return 1;
+            }
+        }
+    }
+    for (int i = 0; i < engine->n_shards; i++) {
+        if (grow_inflight(&engine->shards[i], engine->inflight_slots)) {
+            fprintf(stderr, "Unable to allocate in-flight table\n");
+            return 1;
+        }
+    }
+    /* with --top, the processes of the host are sampled until interrupted */
+    int alive = engine->n_alive > 0 || engine->procs;
+    if (start_workers(engine)) {
+        return 1;
+    }
+
+    if (ticker_start(&engine->ticker)) {
+        perror("Unable to arm timerfd");
+        return 1;
+    }
+    /* the first tick is due now, so the commands are sampled from start */
+    for (int i = 0; i < engine->n_commands; i++) {
+        command_start(&engine->commands[i]);
+    }
+    engine->next_dump = engine->ticker.next + engine->dump_interval;
+    if (engine->signal_fd >= 0) {
+        struct epoll_event event = { .events = EPOLLIN };
+        event.data.fd = engine->signal_fd;
+        if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, engine->signal_fd,
+                      &event)) {
+            perror("Unable to watch signalfd");
+            return 1;
+        }
+    }
+
+    /* monitor the target processes */
+    while (1) {
+        int timeout = -1;
+        if (!alive) {
+            /* targets are gone, wait for the outstanding replies only */
+            time_t t_left = t_drain_end - get_ns_timestamp();
+            if (shard->n_inflight == 0 || t_left <= 0) {
+                break;
+            }
+            timeout = (t_left + MILL_SECOND - 1) / MILL_SECOND;
+        }
+
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(engine->epoll_fd, events, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait failed");
+            return 1;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == netlink_fd) {
+                if (receive_replies(shard)) {
+                    return 1;
+                }
+            } else if (events[i].data.fd == engine->signal_fd) {
+                struct signalfd_siginfo info;
+                if (read(engine->signal_fd, &info, sizeof(info)) !=
+                        sizeof(info)) {
+                    continue;
+                }
+                if (info.ssi_signo == SIGUSR2) {
+                    stage_histograms_print(stderr, &engine->latency);
+                    continue;
+                }
+                /* stop ticking, but keep the replies already asked for */
+                if (alive) {
+                    alive = 0;
+                    t_drain_end = stop_ticking(engine);
+                }
+            } else if (events[i].data.fd == engine->ticker.fd) {
+                if (!alive) {
+                    continue;
+                }
+                if (handle_tick(engine)) {
+                    perror("Unable to read timerfd");
+                    return 1;
+                }
+                if (!engine->procs &&
+                    __atomic_load_n(&engine->n_alive, __ATOMIC_RELAXED) == 0) {
+                    alive = 0;
+                    t_drain_end = stop_ticking(engine);
+                }
+            } else {
+                task_exited(engine, events[i].data.fd);
+                if (alive && !engine->procs &&
+                    __atomic_load_n(&engine->n_alive, __ATOMIC_RELAXED) == 0) {
+                    alive = 0;
+                    t_drain_end = stop_ticking(engine);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int query_engine_run(struct QueryEngine *engine) {
+    int ret = run(engine);
+    join_workers(engine);
+    return ret;
+}
+
+static void destroy_shard(struct QueryShard* shard) {
+    free(shard->inflight);
+    shard->inflight = NULL;
+    free(shard->batch);
+    shard->batch = NULL;
+    if (shard->epoll_fd >= 0) {
+        close(shard->epoll_fd);
+        shard->epoll_fd = -1;
+    }
+    if (shard->event_fd >= 0) {
+        close(shard->event_fd);
+        shard->event_fd = -1;
+    }
+    if (shard->callbacks) {
+        nl_cb_put(shard->callbacks);
+        shard->callbacks = NULL;
+    }
+    if (shard->netlink_socket) {
+        nl_socket_free(shard->netlink_socket);
+        shard->netlink_socket = NULL;
+    }
+    raw_netlink_destroy(&shard->raw);
+}
+
+void query_engine_destroy(struct QueryEngine *engine) {
+    free(engine->live);
+    engine->live = NULL;
+    free(engine->retired);
+    engine->retired = NULL;
+    for (int i = 0; i < engine->n_shards; i++) {
+        destroy_shard(&engine->shards[i]);
+    }
+    free(engine->shards);
+    engine->shards = NULL;
+    engine->n_shards = 0;
+    if (engine->epoll_fd >= 0) {
+        close(engine->epoll_fd);
+        engine->epoll_fd = -1;
+    }
+    ticker_destroy(&engine->ticker);
+}
\ No newline at end of file
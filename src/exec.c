@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "exec.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,10 +7,14 @@
 #include <sys/wait.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 
-int exec_command(int argc, char *argv[], char* redict_out) {
+int command_spawn(struct Command *command, int argc, char *argv[],
+                  char *redirect_out) {
+    memset(command, 0, sizeof(*command));
+    command->pid = command->barrier_fd = -1;
     if (argc < 1) {
-        printf("argc is zero, command must be specified");
+        fprintf(stderr, "argc is zero, command must be specified\n");
         return 1;
     }
 
@@ -26,18 +31,101 @@ int exec_command(int argc, char *argv[], char* redict_out) {
         printf(" %s", exec_argv[i]);
     }
     printf("\n");
+    /* the reports are written to the stdout fd, not through stdio */
+    fflush(stdout);
+
+    int barrier[2];
+    if (pipe2(barrier, O_CLOEXEC)) {
+        perror("Unable to create the start barrier");
+        return 1;
+    }
 
     /* execute command */
     int exec_pid = fork();
+    if (exec_pid < 0) {
+        perror("Unable to fork the command");
+        close(barrier[0]);
+        close(barrier[1]);
+        return 1;
+    }
     if(exec_pid == 0) {  // child process
+        // the monitor blocks SIGINT and SIGTERM, the command must not
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigprocmask(SIG_SETMASK, &signals, NULL);
         // redirect stdout and stderr to custom file
-        if (redict_out) {
-            int fd = open(redict_out, O_WRONLY|O_CREAT);
+        if (redirect_out) {
+            int fd = open(redirect_out, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+            if (fd < 0) {
+                perror("Unable to open the command output");
+                _exit(127);
+            }
             dup2(fd, STDOUT_FILENO);
             dup2(fd, STDERR_FILENO);
             close(fd);
         }
+        // wait for the sampling to start, EOF means the monitor gave up
+        char go;
+        close(barrier[1]);
+        if (read(barrier[0], &go, 1) != 1) {
+            _exit(127);
+        }
         execvp(exec_argv[0], exec_argv);
+        fprintf(stderr, "Unable to run %s: %s\n", exec_argv[0],
+                strerror(errno));
+        _exit(127);
+    }
+    close(barrier[0]);
+    command->pid = exec_pid;
+    command->barrier_fd = barrier[1];
+    return 0;
+}
+
+void command_start(struct Command *command) {
+    if (command->barrier_fd >= 0) {
+        char go = 1;
+        if (write(command->barrier_fd, &go, 1) != 1) {
+            perror("Unable to start the command");
+        }
+        close(command->barrier_fd);
+        command->barrier_fd = -1;
+    }
+}
+
+int command_reap(struct Command *command, int options) {
+    if (command->reaped) {
+        return 1;
+    }
+    int ret;
+    do {
+        ret = waitpid(command->pid, &command->status, options);
+    } while (ret < 0 && errno == EINTR);
+    if (ret == command->pid) {
+        command->reaped = 1;
+    } else if (ret < 0 && errno == ECHILD) {
+        command->status = -1;
+        command->reaped = 1;
+    }
+    return command->reaped;
+}
+
+void command_print_status(const struct Command *command) {
+    if (!command->reaped) {
+        fprintf(stderr, "command %d still running\n", command->pid);
+    } else if (command->status == -1) {
+        fprintf(stderr, "command exit status unknown\n");
+    } else if (WIFEXITED(command->status)) {
+        fprintf(stderr, "command exited with code %d\n",
+                WEXITSTATUS(command->status));
+    } else if (WIFSIGNALED(command->status)) {
+        fprintf(stderr, "command killed by signal %d\n",
+                WTERMSIG(command->status));
+    }
+}
+
+void command_destroy(struct Command *command) {
+    if (command->barrier_fd >= 0) {
+        close(command->barrier_fd);
+        command->barrier_fd = -1;
     }
-    return exec_pid;
 }
\ No newline at end of file
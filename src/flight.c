@@ -0,0 +1,210 @@
+#include "flight.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int trigger_parse(struct Trigger *trigger, const char *text) {
+    memset(trigger, 0, sizeof(*trigger));
+    trigger->text = text;
+    const char *name = text;
+    const char *op = strchr(text, '>');
+    if (!op) {
+        goto error;
+    }
+    size_t len = op - text;
+    if (!strncmp(text, "rise(", 5) && len > 6 && op[-1] == ')') {
+        trigger->rise = 1;
+        name += 5;
+        len -= 6;
+    }
+    for (int i = 0; i < record_n_fields; i++) {
+        const struct RecordField *field = &record_fields[i];
+        if (field->type != RECORD_FIELD_STR && strlen(field->name) == len &&
+            !strncmp(field->name, name, len)) {
+            trigger->field = field;
+            break;
+        }
+    }
+    if (!trigger->field) {
+        fprintf(stderr, "Unknown field in the trigger %s\n", text);
+        return 1;
+    }
+
+    char *unit;
+    double threshold = strtod(op + 1, &unit);
+    if (unit == op + 1 || threshold < 0) {
+        goto error;
+    }
+    if (!strcmp(unit, "us")) {
+        threshold *= 1e3;
+    } else if (!strcmp(unit, "ms")) {
+        threshold *= 1e6;
+    } else if (!strcmp(unit, "s")) {
+        threshold *= 1e9;
+    } else if (*unit && strcmp(unit, "ns")) {
+        goto error;
+    }
+    trigger->threshold = threshold;
+    return 0;
+
+error:
+    fprintf(stderr, "Unable to parse the trigger %s, expected FIELD>N or "
+            "rise(FIELD)>N\n", text);
+    return 1;
+}
+
+static int fires(const struct Trigger *trigger,
+                 const struct TaskStatistics *stats,
+                 const struct TaskStatistics *last) {
+    unsigned long long value = record_field_uint(trigger->field, stats);
+    if (!trigger->rise) {
+        return value > trigger->threshold;
+    }
+    if (!last) {
+        return 0;
+    }
+    unsigned long long before = record_field_uint(trigger->field, last);
+    return value > before && value - before > trigger->threshold;
+}
+
+int flight_recorder_init(struct FlightRecorder *fr, time_t pre, time_t post) {
+    memset(fr, 0, sizeof(*fr));
+    fr->pre = pre;
+    fr->post = post;
+    fr->cap = FLIGHT_INITIAL_RECORDS;
+    fr->ring = (struct TaskStatistics*)malloc(
+        fr->cap * sizeof(struct TaskStatistics));
+    if (!fr->ring) {
+        fprintf(stderr, "Unable to allocate the flight recorder\n");
+        return 1;
+    }
+    return 0;
+}
+
+int flight_recorder_add_trigger(struct FlightRecorder *fr, const char *text) {
+    if (fr->n_triggers == FLIGHT_MAX_TRIGGERS) {
+        fprintf(stderr, "Too many triggers, at most %d\n",
+                FLIGHT_MAX_TRIGGERS);
+        return 1;
+    }
+    if (trigger_parse(&fr->triggers[fr->n_triggers], text)) {
+        return 1;
+    }
+    fr->n_triggers++;
+    return 0;
+}
+
+static struct TaskStatistics* get_last(struct FlightRecorder *fr,
+                                       int target) {
+    if (target >= fr->n_last) {
+        int n = fr->n_last ? fr->n_last : 16;
+        while (n <= target) {
+            n *= 2;
+        }
+        struct TaskStatistics *grown = (struct TaskStatistics*)realloc(
+            fr->last, n * sizeof(struct TaskStatistics));
+        if (!grown) {
+            return NULL;
+        }
+        memset(grown + fr->n_last, 0, (n - fr->n_last) * sizeof(*grown));
+        fr->last = grown;
+        fr->n_last = n;
+    }
+    return &fr->last[target];
+}
+
+/* doubles the ring up to FLIGHT_MAX_RECORDS, keeping the order */
+static int grow(struct FlightRecorder *fr) {
+    if (fr->cap >= FLIGHT_MAX_RECORDS) {
+        return 1;
+    }
+    size_t cap = fr->cap * 2;
+    struct TaskStatistics *ring = (struct TaskStatistics*)malloc(
+        cap * sizeof(struct TaskStatistics));
+    if (!ring) {
+        return 1;
+    }
+    size_t first = fr->cap - fr->head < fr->len ? fr->cap - fr->head : fr->len;
+    memcpy(ring, fr->ring + fr->head, first * sizeof(*ring));
+    memcpy(ring + first, fr->ring, (fr->len - first) * sizeof(*ring));
+    free(fr->ring);
+    fr->ring = ring;
+    fr->cap = cap;
+    fr->head = 0;
+    return 0;
+}
+
+static void hold(struct FlightRecorder *fr,
+                 const struct TaskStatistics *stats) {
+    /* what is older than the pre-trigger window is not needed anymore */
+    while (fr->len && fr->ring[fr->head].timestamp < stats->timestamp -
+                                                     fr->pre) {
+        fr->head = (fr->head + 1) % fr->cap;
+        fr->len--;
+    }
+    if (fr->len == fr->cap && grow(fr)) {
+        fr->head = (fr->head + 1) % fr->cap;
+        fr->len--;
+        fr->n_overwritten++;
+    }
+    fr->ring[(fr->head + fr->len) % fr->cap] = *stats;
+    fr->len++;
+}
+
+enum FlightAction flight_recorder_push(struct FlightRecorder *fr,
+                                       const struct TaskStatistics *stats,
+                                       const struct Trigger **fired) {
+    struct TaskStatistics *last = get_last(fr, stats->target);
+    const struct TaskStatistics *previous =
+        last && last->timestamp && last->generation == stats->generation ?
+        last : NULL;
+    *fired = NULL;
+    for (int i = 0; i < fr->n_triggers; i++) {
+        if (fires(&fr->triggers[i], stats, previous)) {
+            fr->triggers[i].n_fired++;
+            if (!*fired) {
+                *fired = &fr->triggers[i];
+            }
+        }
+    }
+    if (last) {
+        *last = *stats;
+    }
+
+    if (fr->recording_until && stats->timestamp > fr->recording_until) {
+        fr->recording_until = 0;
+    }
+    if (*fired) {
+        /* a trigger within the window makes it longer */
+        enum FlightAction action = fr->recording_until ? FLIGHT_PASS :
+                                   FLIGHT_DUMP;
+        if (action == FLIGHT_DUMP) {
+            fr->n_dumps++;
+        }
+        fr->recording_until = stats->timestamp + fr->post;
+        return action;
+    }
+    if (fr->recording_until) {
+        return FLIGHT_PASS;
+    }
+    hold(fr, stats);
+    return FLIGHT_HOLD;
+}
+
+const struct TaskStatistics* flight_recorder_pop(struct FlightRecorder *fr) {
+    if (!fr->len) {
+        return NULL;
+    }
+    const struct TaskStatistics *stats = &fr->ring[fr->head];
+    fr->head = (fr->head + 1) % fr->cap;
+    fr->len--;
+    return stats;
+}
+
+void flight_recorder_free(struct FlightRecorder *fr) {
+    free(fr->ring);
+    free(fr->last);
+    fr->ring = fr->last = NULL;
+    fr->cap = fr->len = 0;
+    fr->n_last = 0;
+}
\ No newline at end of file
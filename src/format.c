@@ -0,0 +1,175 @@
+#include "format.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static int count_digits(unsigned long long value) {
+    int n = 1;
+    for (;;) {
+        if (value < 10) {
+            return n;
+        }
+        if (value < 100) {
+            return n + 1;
+        }
+        if (value < 1000) {
+            return n + 2;
+        }
+        if (value < 10000) {
+            return n + 3;
+        }
+        value /= 10000;
+        n += 4;
+    }
+}
+
+/* the n digits of value, two at a time from the last one */
+static char *put_digits(char *p, unsigned long long value, int n) {
+    char *q = p + n;
+    while (value >= 100) {
+        const char *pair = &digit_pairs[(value % 100) * 2];
+        value /= 100;
+        *--q = pair[1];
+        *--q = pair[0];
+    }
+    if (value >= 10) {
+        *--q = digit_pairs[value * 2 + 1];
+        *--q = digit_pairs[value * 2];
+    } else {
+        *--q = '0' + value;
+    }
+    return p + n;
+}
+
+char *format_u64(char *p, unsigned long long value) {
+    return put_digits(p, value, count_digits(value));
+}
+
+char *format_int(char *p, int value) {
+    if (value < 0) {
+        *p++ = '-';
+        return format_u64(p, -(unsigned long long)value);
+    }
+    return format_u64(p, value);
+}
+
+char *format_hex(char *p, unsigned int value) {
+    static const char digits[] = "0123456789abcdef";
+    int n = 1;
+    while (n < 8 && value >> (4 * n)) {
+        n++;
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        *p++ = digits[(value >> (4 * i)) & 0xf];
+    }
+    return p;
+}
+
+static char *pad(char *p, int n) {
+    if (n > 0) {
+        memset(p, ' ', n);
+        p += n;
+    }
+    return p;
+}
+
+char *format_u64_right(char *p, unsigned long long value, int width) {
+    int n = count_digits(value);
+    return put_digits(pad(p, width - n), value, n);
+}
+
+char *format_fixed3(char *p, double value, int width) {
+    double scaled = value * 1000;
+    unsigned long long whole = scaled;
+    double rest = scaled - whole;
+    /*
+     * printf rounds the exact binary value, so values that scale to about
+     * half a thousandth and those out of the fast range go through it
+     */
+    if (!(value >= 0 && value < 1e8) || (rest > 0.4999 && rest < 0.5001)) {
+        return p + sprintf(p, "%*.3f", width, value);
+    }
+    whole += rest > 0.5;
+    unsigned long long integral = whole / 1000;
+    unsigned int fraction = whole % 1000;
+    int n = count_digits(integral);
+    p = put_digits(pad(p, width - n - 4), integral, n);
+    *p++ = '.';
+    *p++ = '0' + fraction / 100;
+    *p++ = digit_pairs[fraction % 100 * 2];
+    *p++ = digit_pairs[fraction % 100 * 2 + 1];
+    return p;
+}
+
+int output_buffer_init(struct OutputBuffer *out, int fd, size_t cap) {
+    memset(out, 0, sizeof(*out));
+    out->fd = fd;
+    out->cap = cap;
+    out->data = (char*)malloc(cap);
+    if (!out->data) {
+        fprintf(stderr, "Unable to allocate the output buffer\n");
+        return 1;
+    }
+    return 0;
+}
+
+char *output_buffer_reserve(struct OutputBuffer *out, size_t n) {
+    if (out->cap - out->len < n) {
+        output_buffer_flush(out);
+    }
+    if (out->cap < n) {
+        char *data = (char*)realloc(out->data, n);
+        if (!data) {
+            return NULL;
+        }
+        out->data = data;
+        out->cap = n;
+    }
+    return out->data + out->len;
+}
+
+void output_buffer_commit(struct OutputBuffer *out, const char *end) {
+    out->len = end - out->data;
+}
+
+int output_buffer_flush(struct OutputBuffer *out) {
+    size_t done = 0;
+    while (done < out->len) {
+        ssize_t ret = write(out->fd, out->data + done, out->len - done);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Unable to write the output");
+            out->len = 0;
+            return 1;
+        }
+        done += ret;
+    }
+    if (done) {
+        out->n_flushes++;
+        out->bytes_out += done;
+    }
+    out->len = 0;
+    return 0;
+}
+
+void output_buffer_free(struct OutputBuffer *out) {
+    free(out->data);
+    out->data = NULL;
+    out->len = out->cap = 0;
+}
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include "histogram.h"
+#include "utils.h"
+
+#define increment(p) __atomic_store_n(p, *(p) + 1, __ATOMIC_RELAXED)
+#define load(p)       __atomic_load_n(p, __ATOMIC_RELAXED)
+
+static const char *stage_names[N_STAGES] = {
+    "tick lateness",
+    "kill check",
+    "send",
+    "round trip",
+    "parse",
+    "queue wait",
+    "format",
+    "write"
+};
+
+const char* stage_name(enum Stage stage) {
+    return stage_names[stage];
+}
+
+static int bucket_index(unsigned long long value) {
+    if (value < HISTOGRAM_SUB_COUNT) {
+        return value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent >= HISTOGRAM_MAX_BITS) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    int shift = exponent - HISTOGRAM_SUB_BITS;
+    return (shift + 1) * HISTOGRAM_SUB_COUNT +
+           (int)(value >> shift) - HISTOGRAM_SUB_COUNT;
+}
+
+/* largest value that falls into the bucket */
+static unsigned long long bucket_upper(int idx) {
+    if (idx < HISTOGRAM_SUB_COUNT) {
+        return idx;
+    }
+    int shift = idx / HISTOGRAM_SUB_COUNT - 1;
+    unsigned long long sub = idx % HISTOGRAM_SUB_COUNT + HISTOGRAM_SUB_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+void histogram_record(struct Histogram *histogram, time_t value) {
+    unsigned long long v = value > 0 ? value : 0;
+    increment(&histogram->counts[bucket_index(v)]);
+    increment(&histogram->n);
+    __atomic_store_n(&histogram->total, histogram->total + v,
+                     __ATOMIC_RELAXED);
+    if (v > histogram->max) {
+        __atomic_store_n(&histogram->max, v, __ATOMIC_RELAXED);
+    }
+}
+
+/* same with atomic updates, for writers that run at the same time */
+void histogram_record_shared(struct Histogram *histogram, time_t value) {
+    unsigned long long v = value > 0 ? value : 0;
+    __atomic_fetch_add(&histogram->counts[bucket_index(v)], 1,
+                       __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->n, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->total, v, __ATOMIC_RELAXED);
+    unsigned long long max = load(&histogram->max);
+    while (v > max &&
+           !__atomic_compare_exchange_n(&histogram->max, &max, v, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+unsigned long long histogram_percentile(const struct Histogram *histogram,
+                                        double percentile) {
+    unsigned long long n = load(&histogram->n);
+    unsigned long long max = load(&histogram->max);
+    unsigned long long rank = n * percentile / 100;
+    unsigned long long seen = 0;
+    if (rank >= n) {
+        return max;
+    }
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += load(&histogram->counts[i]);
+        if (seen > rank) {
+            unsigned long long upper = bucket_upper(i);
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+void stage_histograms_print(FILE *file, const struct StageHistograms *h) {
+    fprintf(file, "%-14s%12s%10s%10s%10s%10s%10s  (us)\n", "stage", "count",
+            "avg", "p50", "p99", "p99.9", "max");
+    for (int i = 0; i < N_STAGES; i++) {
+        const struct Histogram *histogram = &h->stages[i];
+        unsigned long long n = load(&histogram->n);
+        if (!n) {
+            continue;
+        }
+        fprintf(file, "%-14s%12llu%10.1f%10.1f%10.1f%10.1f%10.1f\n",
+                stage_names[i], n,
+                load(&histogram->total) * 1. / n / MICRO_SECOND,
+                histogram_percentile(histogram, 50) * 1. / MICRO_SECOND,
+                histogram_percentile(histogram, 99) * 1. / MICRO_SECOND,
+                histogram_percentile(histogram, 99.9) * 1. / MICRO_SECOND,
+                load(&histogram->max) * 1. / MICRO_SECOND);
+    }
+    fflush(file);
+}
\ No newline at end of file
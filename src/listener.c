@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include "listener.h"
+#include <errno.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
+#include <netlink/genl/genl.h>
+#include <netlink/genl/ctrl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "utils.h"
+
+#define LISTENER_RCVBUF     (16 << 20)
+#define LISTENER_POLL_MS    100
+
+static int parse_exit_event(struct nl_msg* msg, void* arg) {
+    time_t t_cur = get_ns_timestamp();
+    struct ListenerGroup* group = (struct ListenerGroup*)arg;
+    struct nlmsghdr* hdr = nlmsg_hdr(msg);
+    struct genlmsghdr* gnlh = (struct genlmsghdr*)nlmsg_data(hdr);
+    struct nlattr* attr = genlmsg_attrdata(gnlh, 0);
+    int remaining = genlmsg_attrlen(gnlh, 0);
+
+    /* the last thread of a group also carries the group's totals */
+    nla_for_each_attr(attr, attr, remaining, remaining) {
+        if (attr->nla_type != TASKSTATS_TYPE_AGGR_PID &&
+            attr->nla_type != TASKSTATS_TYPE_AGGR_TGID) {
+            continue;
+        }
+        group->n_events++;
+        struct TaskStatistics* stats =
+            concurrent_queue_claim(group->listener->que);
+        if (!stats) {
+            continue;
+        }
+        memset(stats, 0, sizeof(*stats));
+        stats->timestamp = t_cur;
+        stats->target = group->listener->target;
+        task_stats_parse_aggregate(attr, stats);
+        concurrent_queue_publish(group->listener->que, stats);
+    }
+    return NL_OK;
+}
+
+/* events are not replies to anything we sent */
+static int accept_sequence(struct nl_msg* msg, void* arg) {
+    return NL_OK;
+}
+
+static int print_listener_error(struct sockaddr_nl* address,
+                                struct nlmsgerr* error, void* arg) {
+    fprintf(stderr, "Netlink receive error: %s\n", strerror(-error->error));
+    return NL_SKIP;
+}
+
+/* adds CPUs of a list such as "0-3,8" to cpus, returns their number or -1 */
+static int parse_cpu_list(const char* cpulist, int* cpus, int max_cpus) {
+    int n_cpus = 0;
+    const char* p = cpulist;
+    while (*p) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) {
+                return -1;
+            }
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (n_cpus == max_cpus) {
+                return -1;
+            }
+            cpus[n_cpus++] = cpu;
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end) {
+            return -1;
+        }
+        p = end;
+    }
+    return n_cpus;
+}
+
+/* formats the CPUs back as a list, collapsing consecutive ones to ranges */
+static int format_cpu_list(const int* cpus, int n_cpus, char* buf,
+                           size_t len) {
+    size_t pos = 0;
+    for (int i = 0; i < n_cpus; ) {
+        int j = i;
+        while (j + 1 < n_cpus && cpus[j + 1] == cpus[j] + 1) {
+            j++;
+        }
+        int n = j > i ?
+                snprintf(buf + pos, len - pos, "%s%d-%d", pos ? "," : "",
+                         cpus[i], cpus[j]) :
+                snprintf(buf + pos, len - pos, "%s%d", pos ? "," : "",
+                         cpus[i]);
+        if (n < 0 || (size_t)n >= len - pos) {
+            return 1;
+        }
+        pos += n;
+        i = j + 1;
+    }
+    return 0;
+}
+
+static int send_cpumask(struct ListenerGroup* group, int attr_type) {
+    struct nl_msg* msg = nlmsg_alloc();
+    if (!msg) {
+        return -NLE_NOMEM;
+    }
+    genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, group->listener->family_id,
+                0, NLM_F_REQUEST, TASKSTATS_CMD_GET, TASKSTATS_VERSION);
+    nla_put_string(msg, attr_type, group->cpumask);
+    int ret = nl_send_auto(group->netlink_socket, msg);
+    nlmsg_free(msg);
+    return ret;
+}
+
+static int open_group(struct ListenerGroup* group) {
+    group->netlink_socket = nl_socket_alloc();
+    if (!group->netlink_socket) {
+        fprintf(stderr, "Unable to allocate netlink socket\n");
+        return 1;
+    }
+    int ret = genl_connect(group->netlink_socket);
+    if (ret < 0) {
+        nl_perror(ret, "Unable to open netlink socket (are you root?)");
+        return 1;
+    }
+    nl_socket_set_buffer_size(group->netlink_socket, LISTENER_RCVBUF, 0);
+
+    /* wake up now and then to notice when the listener is stopped */
+    struct timeval timeout = { 0, LISTENER_POLL_MS * 1000 };
+    setsockopt(nl_socket_get_fd(group->netlink_socket), SOL_SOCKET,
+               SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    nl_socket_disable_seq_check(group->netlink_socket);
+    ret = send_cpumask(group, TASKSTATS_CMD_ATTR_REGISTER_CPUMASK);
+    if (ret >= 0) {
+        ret = nl_wait_for_ack(group->netlink_socket);
+    }
+    if (ret < 0) {
+        fprintf(stderr, "Unable to register for exit events on CPUs %s: %s\n",
+                group->cpumask, nl_geterror(ret));
+        return 1;
+    }
+
+    group->callbacks = nl_cb_alloc(NL_CB_CUSTOM);
+    if (!group->callbacks) {
+        fprintf(stderr, "Unable to allocate netlink callbacks\n");
+        return 1;
+    }
+    nl_cb_set(group->callbacks, NL_CB_SEQ_CHECK, NL_CB_CUSTOM,
+              &accept_sequence, group);
+    nl_cb_set(group->callbacks, NL_CB_VALID, NL_CB_CUSTOM,
+              &parse_exit_event, group);
+    nl_cb_err(group->callbacks, NL_CB_CUSTOM, &print_listener_error, group);
+    return 0;
+}
+
+static void* read_exit_events(void* arg) {
+    struct ListenerGroup* group = (struct ListenerGroup*)arg;
+
+    /* read the events where they are produced */
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < group->n_cpus; i++) {
+        CPU_SET(group->cpus[i], &set);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    while (!__atomic_load_n(&group->listener->stop, __ATOMIC_ACQUIRE)) {
+        int ret = nl_recvmsgs(group->netlink_socket, group->callbacks);
+        if (ret == -NLE_NOMEM) {
+            /* the socket overflowed, the kernel has dropped events */
+            group->n_overflows++;
+        }
+    }
+    return NULL;
+}
+
+int exit_listener_init(struct ExitListener *listener,
+                       struct ConcurrentQueue *que, int target,
+                       const char *cpulist, int group_size) {
+    memset(listener, 0, sizeof(*listener));
+    listener->que = que;
+    listener->target = target;
+
+    int max_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (max_cpus < 1) {
+        max_cpus = 1;
+    }
+    int *cpus = (int*)malloc(max_cpus * sizeof(int));
+    if (!cpus) {
+        fprintf(stderr, "Unable to allocate CPU list\n");
+        return 1;
+    }
+    int n_cpus = max_cpus;
+    if (cpulist) {
+        n_cpus = parse_cpu_list(cpulist, cpus, max_cpus);
+    } else {
+        for (int i = 0; i < n_cpus; i++) {
+            cpus[i] = i;
+        }
+    }
+    if (n_cpus <= 0) {
+        fprintf(stderr, "Invalid CPU list %s\n", cpulist);
+        free(cpus);
+        return 1;
+    }
+    if (group_size <= 0) {
+        group_size = DEFAULT_CPU_GROUP;
+    }
+
+    struct nl_sock *sock = nl_socket_alloc();
+    if (!sock || genl_connect(sock) < 0) {
+        fprintf(stderr, "Unable to open netlink socket (are you root?)\n");
+        nl_socket_free(sock);
+        free(cpus);
+        return 1;
+    }
+    listener->family_id = genl_ctrl_resolve(sock, TASKSTATS_GENL_NAME);
+    nl_socket_free(sock);
+    if (listener->family_id < 0) {
+        nl_perror(listener->family_id, "Unable to determine taskstats family "
+                  "id (does your kernel support taskstats?)");
+        free(cpus);
+        return 1;
+    }
+
+    int n_groups = (n_cpus + group_size - 1) / group_size;
+    listener->groups = (struct ListenerGroup*)calloc(
+        n_groups, sizeof(struct ListenerGroup));
+    if (!listener->groups) {
+        fprintf(stderr, "Unable to allocate listener groups\n");
+        free(cpus);
+        return 1;
+    }
+    for (int i = 0; i < n_groups; i++) {
+        struct ListenerGroup *group = &listener->groups[i];
+        group->listener = listener;
+        group->cpus = cpus + i * group_size;
+        group->n_cpus = i < n_groups - 1 ? group_size :
+                        n_cpus - i * group_size;
+        listener->n_groups++;
+        if (format_cpu_list(group->cpus, group->n_cpus, group->cpumask,
+                            sizeof(group->cpumask)) || open_group(group)) {
+            goto error;
+        }
+    }
+    return 0;
+
+error:
+    exit_listener_destroy(listener);
+    return 1;
+}
+
+int exit_listener_start(struct ExitListener *listener) {
+    for (int i = 0; i < listener->n_groups; i++) {
+        struct ListenerGroup *group = &listener->groups[i];
+        int ret = pthread_create(&group->thread, NULL, &read_exit_events,
+                                 group);
+        if (ret) {
+            fprintf(stderr, "Unable to create thread, %d\n", ret);
+            return 1;
+        }
+        group->started = 1;
+    }
+    return 0;
+}
+
+void exit_listener_stop(struct ExitListener *listener) {
+    __atomic_store_n(&listener->stop, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < listener->n_groups; i++) {
+        struct ListenerGroup *group = &listener->groups[i];
+        if (group->started) {
+            pthread_join(group->thread, NULL);
+            group->started = 0;
+        }
+    }
+}
+
+void exit_listener_destroy(struct ExitListener *listener) {
+    exit_listener_stop(listener);
+    for (int i = 0; i < listener->n_groups; i++) {
+        struct ListenerGroup *group = &listener->groups[i];
+        if (group->callbacks) {
+            nl_cb_put(group->callbacks);
+        }
+        if (group->netlink_socket) {
+            /* closing the socket would do as well, but only eventually */
+            send_cpumask(group, TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK);
+            nl_socket_free(group->netlink_socket);
+        }
+    }
+    if (listener->groups) {
+        free(listener->groups[0].cpus);
+    }
+    free(listener->groups);
+    listener->groups = NULL;
+    listener->n_groups = 0;
+}
\ No newline at end of file
@@ -6,160 +6,390 @@
  */
 #include <errno.h>
 #include <getopt.h>
-#include <netlink/msg.h>
-#include <netlink/attr.h>
-#include <netlink/socket.h> 
-#include <netlink/handlers.h>
-#include <netlink/genl/genl.h>
-#include <netlink/genl/ctrl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/cdefs.h>
+#include <sys/resource.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/signalfd.h>
 #include <signal.h>
 #include <pthread.h>
 
 #include "exec.h"
+#include "flight.h"
+#include "format.h"
 #include "utils.h"
 #include "queue.h"
+#include "delta.h"
+#include "rates.h"
+#include "engine.h"
+#include "listener.h"
+#include "metrics.h"
+#include "procs.h"
+#include "record.h"
+#include "shm.h"
+#include "target.h"
 #include "taskstats.h"
+#include "threads.h"
+#include "top.h"
+#include "window.h"
+#include "workload.h"
 
-#define N_QUERY_THREAD 10
+#define POP_BATCH 64
+/* timestamp, pid and the columns of one text line */
+#define TEXT_LINE_LEN \
+    (2 * FORMAT_U64_LEN + TASK_STATS_STR_LEN + PROC_SUPPLEMENT_STR_LEN)
 
-int print_receive_error(struct sockaddr_nl* address,
-                        struct nlmsgerr* error, void* arg) {
-    fprintf(stderr, "Netlink receive error: %s\n", strerror(-error->error));
-    return NL_STOP;
-}
+enum OutputFormat {
+    OUTPUT_TEXT,
+    OUTPUT_BINARY,
+    OUTPUT_DELTA,
+    OUTPUT_RATES,
+    OUTPUT_WINDOW,
+    OUTPUT_TOP,
+    OUTPUT_NONE         /* --shm or --metrics only */
+};
 
-void parse_aggregate_task_stats(struct nlattr* attr, int attr_size,
-                                struct TaskStatistics* stats) {
-    nla_for_each_attr(attr, attr, attr_size, attr_size) {
-        switch (attr->nla_type) {
-            case TASKSTATS_TYPE_PID:
-                stats->pid = nla_get_u32(attr);
-                break;
-            case TASKSTATS_TYPE_TGID:
-                stats->tgid = nla_get_u32(attr);
-                break;
-            case TASKSTATS_TYPE_STATS:
-                nla_memcpy(&stats->stats, attr, sizeof(stats->stats));
-                break;
-            default:
-                break;
+struct ProcessThreadArgs {
+    struct ConcurrentQueue *que;
+    struct TargetList *targets;
+    FILE *file;
+    enum OutputFormat format;
+    struct DeltaEncoder *encoder;
+    struct RateTracker *rates;
+    struct WindowAggregator *windows;
+    struct TopTable *top;
+    struct FlightRecorder *recorder;    /* NULL to write every record */
+    struct ShmExport *shm;              /* NULL without --shm */
+    struct MetricsServer *metrics;      /* NULL without --metrics */
+    struct Workloads *workloads;        /* NULL unless several commands */
+    const char **matches;               /* the --match patterns */
+    int human_readable;
+    int proc_stats;
+    struct StageHistograms *latency;
+};
+
+/* one line of the text output, the columns follow task_stats2str */
+static void write_text(struct ProcessThreadArgs *args,
+                       struct OutputBuffer *out,
+                       const struct TaskStatistics *stats,
+                       const struct Target *target) {
+    time_t t_format = get_ns_timestamp();
+    size_t len = TEXT_LINE_LEN;
+    if (target->command_type == TARGET_CGROUP) {
+        len += strlen(target->path);
+    } else if (target->match) {
+        len += strlen(args->matches[target->match - 1]);
+    }
+    char *p = output_buffer_reserve(out, len);
+    if (!p) {
+        return;
+    }
+    /* time of the sample, records held by the flight recorder keep theirs */
+    p = format_u64(p, stats->timestamp);
+    *p++ = '\t';
+    if (target->command_type == TARGET_CGROUP) {
+        /* task state counts instead of the taskstats columns */
+        p = format_str(p, target->path);
+        *p++ = '\t';
+        p = cgroup_stats_format(stats, p);
+    } else {
+        if (target->command_type == TASKSTATS_CMD_ATTR_REGISTER_CPUMASK) {
+            /* exit event, the task is only known from the record */
+            p = format_int(p, stats->pid ? stats->pid : stats->tgid);
+            *p++ = '\t';
+        } else if (target->match) {
+            /* the pattern that attached the process, then its pid */
+            p = format_str(p, args->matches[target->match - 1]);
+            *p++ = '\t';
+            p = format_int(p, target->pid);
+            *p++ = '\t';
+        } else if (args->targets->n_targets > 1) {
+            p = format_int(p, target->pid);
+            *p++ = '\t';
+        }
+        p = task_stats_format(stats, p);
+        if (args->proc_stats) {
+            p = proc_supplement_format(&stats->proc, p);
         }
     }
+    *p++ = '\n';
+    output_buffer_commit(out, p);
+    histogram_record(&args->latency->stages[STAGE_FORMAT],
+                     get_ns_timestamp() - t_format);
 }
 
-int parse_task_stats(struct nl_msg* msg, void* arg) {
-    time_t t_cur = get_ns_timestamp();
-    struct TaskStatistics* stats = (struct TaskStatistics*)malloc(
-        sizeof(struct TaskStatistics));
-    stats->timestamp = t_cur;
-
-    struct genlmsghdr* gnlh = (struct genlmsghdr*)nlmsg_data(nlmsg_hdr(msg));
-    struct nlattr* attr = genlmsg_attrdata(gnlh, 0);
-    int remaining = genlmsg_attrlen(gnlh, 0);
-    nla_for_each_attr(attr, attr, remaining, remaining) {
-        switch (attr->nla_type) {
-            case TASKSTATS_TYPE_AGGR_PID:
-            case TASKSTATS_TYPE_AGGR_TGID:
-                parse_aggregate_task_stats(nla_data(attr), nla_len(attr),
-                                           stats);
-                break;
-            default:
-                break;
-        }
+/* the human readable report of a record */
+static void write_report(struct ProcessThreadArgs *args,
+                         struct OutputBuffer *out,
+                         const struct TaskStatistics *stats,
+                         const struct Target *target) {
+    time_t t_format = get_ns_timestamp();
+    const char *match = target->match ? args->matches[target->match - 1] :
+                        NULL;
+    char *p = output_buffer_reserve(out, TASK_STATS_REPORT_LEN +
+                                    (match ? strlen(match) + 16 : 0));
+    if (!p) {
+        return;
     }
-
-    struct ConcurrentQueue* que = (struct ConcurrentQueue*)arg;
-    concurrent_queue_push(que, stats);
-    return NL_STOP;
+    if (match) {
+        p = format_str(format_str(format_str(p, "\nMatched by: "), match),
+                       "\n");
+    }
+    if (target->command_type == TARGET_CGROUP) {
+        p = cgroup_stats_format_report(stats, p);
+    } else {
+        p = task_stats_format_report(stats, args->human_readable, p);
+    }
+    output_buffer_commit(out, p);
+    histogram_record(&args->latency->stages[STAGE_FORMAT],
+                     get_ns_timestamp() - t_format);
 }
 
-int send_task_stats_query(struct nl_sock* netlink_socket, int family_id,
-                     int command_type, int parameter) {
-    struct nl_msg* message = nlmsg_alloc();
-    genlmsg_put(message, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST,
-		        TASKSTATS_CMD_GET, TASKSTATS_VERSION);
-    nla_put_u32(message, command_type, parameter);
-    int result = nl_send(netlink_socket, message);
-    nlmsg_free(message);
-    return result < 0;
+/* one line of --rates once a task has been sampled twice */
+static void write_rates(struct ProcessThreadArgs *args,
+                        struct OutputBuffer *out,
+                        const struct TaskStatistics *stats,
+                        const struct Target *target) {
+    if (target->command_type != TASKSTATS_CMD_ATTR_PID &&
+        target->command_type != TASKSTATS_CMD_ATTR_TGID) {
+        /* cgroup counts are no counters, exit events have no successor */
+        return;
+    }
+    time_t t_format = get_ns_timestamp();
+    struct TaskRates rates;
+    if (rate_tracker_update(args->rates, stats, &rates) <= 0) {
+        return;
+    }
+    char *p = output_buffer_reserve(out, TASK_RATES_STR_LEN);
+    if (!p) {
+        return;
+    }
+    p = task_rates_format(&rates, p);
+    if (args->proc_stats) {
+        p = task_rates_format_proc(&rates, p);
+    }
+    *p++ = '\n';
+    output_buffer_commit(out, p);
+    histogram_record(&args->latency->stages[STAGE_FORMAT],
+                     get_ns_timestamp() - t_format);
 }
 
-struct ProcessThreadArgs {
-    struct ConcurrentQueue *que;
-    FILE *file;
-    int human_readable;
-};
+/* folds the record into its window, writes the windows that end */
+static void write_window(struct ProcessThreadArgs *args,
+                         struct OutputBuffer *out,
+                         const struct TaskStatistics *stats,
+                         const struct Target *target) {
+    if (target->command_type != TASKSTATS_CMD_ATTR_PID &&
+        target->command_type != TASKSTATS_CMD_ATTR_TGID) {
+        return;
+    }
+    time_t t_format = get_ns_timestamp();
+    struct TaskWindow *window =
+        window_aggregator_get(args->windows, stats->target);
+    if (!window) {
+        return;
+    }
+    if (task_window_due(args->windows, window, stats)) {
+        char *p = output_buffer_reserve(out, TASK_WINDOW_STR_LEN);
+        if (p) {
+            p = task_window_format(args->windows, window, p);
+            *p++ = '\n';
+            output_buffer_commit(out, p);
+            args->windows->n_written++;
+        }
+    }
+    task_window_add(args->windows, window, stats);
+    histogram_record(&args->latency->stages[STAGE_FORMAT],
+                     get_ns_timestamp() - t_format);
+}
 
-void * process_task_stats(void *arg) {
-    struct ProcessThreadArgs *args = (struct ProcessThreadArgs*)arg;
-    struct TaskStatistics *stats;
-    while ((stats = concurrent_queue_pop(args->que)) != NULL) {
-        if (args->file == NULL) {
-            print_task_stats(stats, args->human_readable);
-        } else {
-            char buf[200];
-            task_stats2str(stats, buf, 200);
-            fprintf(args->file, "%llu\t%s\n", get_ns_timestamp(), buf);
+/* the windows still open at the end of the run */
+static void write_open_windows(struct ProcessThreadArgs *args,
+                               struct OutputBuffer *out) {
+    for (int i = 0; i < args->windows->n_windows; i++) {
+        const struct TaskWindow *window = &args->windows->windows[i];
+        if (!window->n_samples) {
+            continue;
         }
-        free(stats);
+        char *p = output_buffer_reserve(out, TASK_WINDOW_STR_LEN);
+        if (!p) {
+            return;
+        }
+        p = task_window_format(args->windows, window, p);
+        *p++ = '\n';
+        output_buffer_commit(out, p);
+        args->windows->n_written++;
     }
-    pthread_exit(NULL);
 }
 
-struct QueryThreadArgs {
-    struct nl_sock* netlink_socket;
-    int family_id;
-    int command_type;
-    int pid;
-    struct nl_cb* callbacks;
-};
+/* ranks the record, writes the table once a tick is complete */
+static void write_top(struct ProcessThreadArgs *args,
+                      struct OutputBuffer *out,
+                      const struct TaskStatistics *stats,
+                      const struct Target *target) {
+    if (target->command_type != TASKSTATS_CMD_ATTR_PID &&
+        target->command_type != TASKSTATS_CMD_ATTR_TGID) {
+        return;
+    }
+    time_t t_format = get_ns_timestamp();
+    if (top_table_due(args->top, stats)) {
+        char *p = output_buffer_reserve(out, TOP_TABLE_LEN(args->top->k));
+        if (p) {
+            output_buffer_commit(out, top_table_format(args->top, p));
+        }
+    }
+    top_table_add(args->top, stats);
+    histogram_record(&args->latency->stages[STAGE_FORMAT],
+                     get_ns_timestamp() - t_format);
+}
 
-void signal_handler(int sig) {
-    printf("Caught signal %d\n", sig);
+/* writes the record in the output format */
+static void write_record(struct ProcessThreadArgs *args,
+                         struct OutputBuffer *out,
+                         const struct TaskStatistics *stats,
+                         const struct Target *target) {
+    struct StageHistograms *latency = args->latency;
+    time_t t_start = get_ns_timestamp();
+    if (args->format == OUTPUT_NONE) {
+        return;
+    } else if (args->format == OUTPUT_RATES) {
+        write_rates(args, out, stats, target);
+    } else if (args->format == OUTPUT_WINDOW) {
+        write_window(args, out, stats, target);
+    } else if (args->format == OUTPUT_TOP) {
+        write_top(args, out, stats, target);
+    } else if (args->file == NULL) {
+        write_report(args, out, stats, target);
+    } else if (args->format == OUTPUT_BINARY) {
+        record_write(args->file, stats);
+        histogram_record(&latency->stages[STAGE_WRITE],
+                         get_ns_timestamp() - t_start);
+    } else if (args->format == OUTPUT_DELTA) {
+        /* blocks are written out from inside the encoder */
+        delta_encoder_write(args->encoder, stats);
+        histogram_record(&latency->stages[STAGE_FORMAT],
+                         get_ns_timestamp() - t_start);
+    } else {
+        write_text(args, out, stats, target);
+    }
 }
-void * query_task_stats(void *arg) {
-    printf("++ query thread Hello\n");
-    signal(SIGUSR1, signal_handler);
-    printf("-- query thread Hello\n");
-    struct QueryThreadArgs *args = (struct QueryThreadArgs*)arg;
-
-    // sigset_t set;
-    // sigemptyset(&set);                                                             
-    // if(sigaddset(&set, SIGUSR1) == -1) {                                           
-    //     perror("Sigaddset error");                                                  
-    //     pthread_exit((void *)1);
-    // }
 
-    while (1) {
-        printf("~ before pause\n");
-        pause();
-        printf("@ after pause\n");
-        // int sig;
-        // int ret = sigwait(&set, &sig);
-        // if(ret || sig != SIGUSR1) {                                                 
-        //     perror("Sigwait error");                                                    
-        //     pthread_exit((void *)2);                                                    
-        // }
-
-        int ret = send_task_stats_query(args->netlink_socket, args->family_id, 
-                                        args->command_type, args->pid);
-        if (ret) {
-            perror("Failed to query taskstats");
-            continue;
+/* lets the flight recorder decide whether the record is written yet */
+static void record_flight(struct ProcessThreadArgs *args,
+                          struct OutputBuffer *out,
+                          const struct TaskStatistics *stats,
+                          const struct Target *target) {
+    const struct Trigger *fired;
+    enum FlightAction action =
+        flight_recorder_push(args->recorder, stats, &fired);
+    if (action == FLIGHT_DUMP) {
+        fprintf(stderr, "flight recorder: %s fired for pid %d, writing "
+                "%zu earlier records\n", fired->text,
+                stats->pid ? stats->pid : stats->tgid, args->recorder->len);
+        const struct TaskStatistics *held;
+        while ((held = flight_recorder_pop(args->recorder))) {
+            write_record(args, out, held,
+                         target_list_get(args->targets, held->target));
         }
+    }
+    if (action != FLIGHT_HOLD) {
+        write_record(args, out, stats, target);
+    }
+}
 
-        ret = nl_recvmsgs(args->netlink_socket, args->callbacks);
-        if (ret) {
-            perror("Failed to receive message\n");
-            continue;
+void * process_task_stats(void *arg) {
+    struct ProcessThreadArgs *args = (struct ProcessThreadArgs*)arg;
+    struct StageHistograms *latency = args->latency;
+    struct TaskStatistics *batch = (struct TaskStatistics*)malloc(
+        POP_BATCH * sizeof(struct TaskStatistics));
+    /* text goes around stdio, one write() per popped batch */
+    struct OutputBuffer out;
+    int text = args->format == OUTPUT_TEXT || args->format == OUTPUT_RATES ||
+               args->format == OUTPUT_WINDOW || args->format == OUTPUT_TOP;
+    if (text && output_buffer_init(&out, args->file ? fileno(args->file) :
+                                   STDOUT_FILENO, OUTPUT_BUFFER_SIZE)) {
+        free(batch);
+        pthread_exit(NULL);
+    }
+    if (args->format == OUTPUT_RATES) {
+        char *p = output_buffer_reserve(&out, strlen(task_rates_columns) +
+                                        strlen(task_rates_proc_columns) + 1);
+        p = format_str(p, task_rates_columns);
+        if (args->proc_stats) {
+            p = format_str(p, task_rates_proc_columns);
+        }
+        *p++ = '\n';
+        output_buffer_commit(&out, p);
+    } else if (args->format == OUTPUT_WINDOW) {
+        char *p = output_buffer_reserve(&out, TASK_WINDOW_COLUMNS_LEN);
+        p = task_window_format_columns(args->windows, p);
+        *p++ = '\n';
+        output_buffer_commit(&out, p);
+    }
+    int n;
+    while ((n = concurrent_queue_pop_batch(args->que, batch, POP_BATCH)) > 0) {
+        time_t t_pop = get_ns_timestamp();
+        for (int i = 0; i < n; i++) {
+            const struct TaskStatistics *stats = &batch[i];
+            const struct Target *target =
+                target_list_get(args->targets, stats->target);
+            histogram_record(&latency->stages[STAGE_QUEUE],
+                             t_pop - stats->timestamp);
+            if (args->shm) {
+                shm_export_publish(args->shm, stats, target->command_type,
+                                   target->pid);
+            }
+            if (args->workloads) {
+                workloads_update(args->workloads, stats);
+            }
+            if (args->metrics) {
+                metrics_server_update(args->metrics, stats,
+                                      target->command_type, target->pid,
+                                      target->path);
+            }
+            if (args->recorder) {
+                record_flight(args, &out, stats, target);
+            } else {
+                write_record(args, &out, stats, target);
+            }
+        }
+        if (text) {
+            time_t t_write = get_ns_timestamp();
+            output_buffer_flush(&out);
+            histogram_record(&latency->stages[STAGE_WRITE],
+                             get_ns_timestamp() - t_write);
+        }
+        if (args->metrics) {
+            metrics_server_publish(args->metrics, 0);
+        }
+    }
+    if (args->metrics) {
+        metrics_server_publish(args->metrics, 1);
+    }
+    if (args->format == OUTPUT_DELTA) {
+        delta_encoder_finish(args->encoder);
+    }
+    if (args->format == OUTPUT_WINDOW) {
+        write_open_windows(args, &out);
+        output_buffer_flush(&out);
+    }
+    if (args->format == OUTPUT_TOP && args->top->n_tasks) {
+        /* the last sweep is complete once the queue is closed */
+        char *p = output_buffer_reserve(&out, TOP_TABLE_LEN(args->top->k));
+        if (p) {
+            output_buffer_commit(&out, top_table_format(args->top, p));
+            output_buffer_flush(&out);
         }
     }
+    if (text) {
+        output_buffer_free(&out);
+    }
+    free(batch);
+    pthread_exit(NULL);
 }
 
 void print_usage() {
@@ -169,31 +399,146 @@ void print_usage() {
          "\n"
          "Options:\n"
          "  --help           Print this usage\n"
-         "  --pid PID        Print stats for the process id PID, ignore when "
-         "custom command is not empty\n"
-         "  --tgid TGID      Print stats for the thread group id TGID\n"
-         "  --period MS      Set the query period in millsecond, default 1000ms\n"
+         "  --pid PID        Print stats for the process id PID, may be "
+         "repeated\n"
+         "  --tgid TGID      Print stats for the thread group id TGID, may be "
+         "repeated\n"
+         "  --tick MODE      How ticks are timed: sleep, hybrid (sleep, then "
+         "spin for the last microseconds) or fifo (hybrid with SCHED_FIFO "
+         "priority), default sleep\n"
+         "  --tick-cpu N     CPU the sampler is pinned to in fifo mode\n"
+         "  --netlink MODE   How taskstats are queried: libnl, or raw for "
+         "prebuilt queries and batched sendmmsg/recvmmsg on a plain socket, "
+         "default libnl\n"
+         "  --workers N      Query taskstats from N threads, each with a "
+         "netlink socket of its own and an even share of the targets of "
+         "every tick. Workers done with theirs take over the rest of the "
+         "others' shares, default 1\n"
+         "  --hist-interval S  Also print the per stage latency histograms "
+         "every S seconds, they are printed at exit and on SIGUSR2\n"
+         "  --cgroup PATH    Print the task state counts of the cgroup v1 "
+         "directory PATH, may be repeated\n"
+         "  --targets FILE   Read targets from FILE, one \"pid N\", "
+         "\"tgid N\" or \"cgroup PATH\" per line\n"
+         "  --period MS      Set the query period in millsecond, default 1000ms, "
+         "fractions such as 0.05 are allowed\n"
          "  --raw            Print raw numbers instead of human readable units\n"
          "  --out FILE       Write the record to the FILE, order of the columns "
-         "is the same as in the URL below\n"
-         "  --cmd-out FILE   Redict custom command stdout and stderr to the FILE\n"
+         "is the same as in the URL below, preceded by the target id when "
+         "there are several targets\n"
+         "  --out-format F   Format of the --out FILE: text, binary or delta, "
+         "default text. Binary and delta captures can be read with "
+         "mn-convert\n"
+         "  --rates          Write rates between consecutive samples of "
+         "each PID and TGID instead of the counters: CPU %%, bytes and "
+         "syscalls per second, delay ms per second. The first line names "
+         "the columns\n"
+         "  --window S       Write one summary per S seconds and PID or TGID "
+         "instead of every sample: min, max, mean and last of each counter "
+         "and the p50, p90 and p99 of its changes between samples. The "
+         "first line names the columns\n"
+         "  --flight-recorder S  Keep the records of the last S seconds in "
+         "memory and write them out only when a --trigger fires, followed "
+         "by the records of the --post-trigger seconds after it\n"
+         "  --trigger EXPR   Condition on a record that fires the flight "
+         "recorder, FIELD>N or rise(FIELD)>N for a rise since the previous "
+         "record of the target. FIELD is a field of the binary format, N "
+         "may end in ns, us, ms or s for fields in nanoseconds, e.g. "
+         "rise(cpu_delay_total)>5ms. May be repeated\n"
+         "  --post-trigger S Seconds written after a trigger, default the "
+         "--flight-recorder seconds\n"
+         "  --shm NAME       Publish the latest records of every target in "
+         "the POSIX shared memory /NAME for other processes, see shm.h. "
+         "Without --out nothing else is written\n"
+         "  --metrics ADDR   Serve the latest counters, rates and pipeline "
+         "latencies in the Prometheus text format on the Unix socket ADDR, "
+         "or on TCP for HOST:PORT such as :9100. Without --out nothing else "
+         "is written\n"
+         "  --cmd CMD        Also run the shell command CMD, may be repeated. "
+         "All commands start together on the same ticks and are compared "
+         "side by side at exit\n"
+         "  --cmd-out FILE   Redict custom command stdout and stderr to the FILE, "
+         "FILE.N for the N-th of several commands\n"
+         "  --queue-size N   Number of records buffered between the sampler "
+         "and the writer, default 1024\n"
+         "  --queue-full P   What to do when the buffer is full: block, "
+         "drop-oldest or drop-newest, default block\n"
+         "  --threads        Also sample every thread of each TGID and of the "
+         "custom command separately\n"
+         "  --thread-scan MS How often new threads and --top or --match "
+         "processes are looked for, default 1000ms\n"
+         "  --exit-events    Record the stats of every task exiting on the "
+         "monitored CPUs, until the targets are gone or until interrupted "
+         "when there are none\n"
+         "  --cpus LIST      CPUs monitored by --exit-events, e.g. 0-3,8, "
+         "default all\n"
+         "  --cpu-group N    CPUs served by one exit event socket and "
+         "thread, default 8\n"
+         "  --top K          Sample every process of the host and show the K "
+         "with the highest --sort rate since the previous tick, refreshed "
+         "every tick, until interrupted\n"
+         "  --sort KEY       Rank of --top: cpu_delay, blkio_delay or "
+         "swapin_delay in ms per second, default cpu_delay\n"
+         "  --match REGEX    Sample every process whose name or command "
+         "line matches the extended regular expression REGEX, attaching to "
+         "new ones as they start and taking a final sample when they exit, "
+         "until interrupted. Text lines start with the REGEX and the PID, "
+         "records carry the number of the REGEX from 1. May be repeated\n"
+         "  --proc-stats     Add what taskstats lacks to every sample of a "
+         "PID or TGID from its /proc files: current RSS, time on a CPU and "
+         "waiting on a run queue, and the CPU it last ran on. The files "
+         "stay open and are re-read with each query. Text lines get the "
+         "four extra columns at the end\n"
+         "  --max-period MS  Sample each PID and TGID between every --period "
+         "and every MS: the period of a task doubles while its CPU time and "
+         "delays barely change and drops back to --period as soon as they "
+         "move\n"
          "\n"
-         "Either PID or TGID or CUSTOM COMMAND must be specified. For more "
-         "documentation about the reported fields, see\n"
+         "At least one PID, TGID, CGROUP, a CUSTOM COMMAND, --top, --match "
+         "or --exit-events must be specified. For more documentation about the reported "
+         "fields, see\n"
          "https://www.kernel.org/doc/Documentation/accounting/"
          "taskstats-struct.txt\n");
 }
 
 int main(int argc, char** argv) {
     /* parse command line parameters */
-    int command_type = 0;
-    int pid = 0;
+    struct TargetList targets;
+    target_list_init(&targets);
     int human_readable = 1;
     FILE *out_file = NULL;
+    enum OutputFormat out_format = OUTPUT_TEXT;
     int custom_cmd_len = 0;
     char **custom_cmd_arg = NULL;
     char *custom_cmd_out = NULL;
-    int period = 1000 * MILL_SECOND;
+    time_t period = 1000 * MILL_SECOND;
+    unsigned long queue_size = DEFAULT_QUEUE_SIZE;
+    enum QueueFullPolicy queue_policy = QUEUE_FULL_BLOCK;
+    int per_thread = 0;
+    time_t thread_scan = DEFAULT_THREAD_SCAN;
+    int exit_events = 0;
+    const char *exit_cpus = NULL;
+    int cpu_group = DEFAULT_CPU_GROUP;
+    enum TickerMode tick_mode = TICKER_SLEEP;
+    enum NetlinkTransport transport = NETLINK_LIBNL;
+    int tick_cpu = -1;
+    int n_workers = 1;
+    time_t dump_interval = 0;
+    int rates = 0;
+    time_t window = 0;
+    time_t pre_trigger = 0, post_trigger = -1;
+    const char *triggers[FLIGHT_MAX_TRIGGERS];
+    int n_triggers = 0;
+    const char *shm_name = NULL;
+    const char *metrics_address = NULL;
+    char *cmds[MAX_WORKLOADS];
+    int n_cmds = 0;
+    int top_k = 0;
+    enum TopSort top_sort = TOP_CPU_DELAY;
+    const char *matches[PROC_MAX_MATCHES];
+    int n_matches = 0;
+    int proc_stats = 0;
+    time_t max_period = 0;
 
     const struct option long_options[] = {
         {"help", no_argument, 0, 0},
@@ -203,6 +548,34 @@ int main(int argc, char** argv) {
         {"out", required_argument, 0, 0},
         {"cmd-out", required_argument, 0, 0},
         {"period", required_argument, 0, 0},
+        {"targets", required_argument, 0, 0},
+        {"queue-size", required_argument, 0, 0},
+        {"queue-full", required_argument, 0, 0},
+        {"out-format", required_argument, 0, 0},
+        {"threads", no_argument, 0, 0},
+        {"thread-scan", required_argument, 0, 0},
+        {"exit-events", no_argument, 0, 0},
+        {"cpus", required_argument, 0, 0},
+        {"cpu-group", required_argument, 0, 0},
+        {"cgroup", required_argument, 0, 0},
+        {"tick", required_argument, 0, 0},
+        {"tick-cpu", required_argument, 0, 0},
+        {"hist-interval", required_argument, 0, 0},
+        {"rates", no_argument, 0, 0},
+        {"window", required_argument, 0, 0},
+        {"flight-recorder", required_argument, 0, 0},
+        {"trigger", required_argument, 0, 0},
+        {"post-trigger", required_argument, 0, 0},
+        {"shm", required_argument, 0, 0},
+        {"metrics", required_argument, 0, 0},
+        {"cmd", required_argument, 0, 0},
+        {"netlink", required_argument, 0, 0},
+        {"workers", required_argument, 0, 0},
+        {"top", required_argument, 0, 0},
+        {"sort", required_argument, 0, 0},
+        {"match", required_argument, 0, 0},
+        {"proc-stats", no_argument, 0, 0},
+        {"max-period", required_argument, 0, 0},
         {0, 0, 0, 0}
     };
 
@@ -218,12 +591,16 @@ int main(int argc, char** argv) {
                 print_usage();
                 return EXIT_SUCCESS;
             case 1:
-                command_type = TASKSTATS_CMD_ATTR_PID;
-                pid = atoi(optarg);
+                if (target_list_add(&targets, TASKSTATS_CMD_ATTR_PID,
+                                    atoi(optarg)) < 0) {
+                    return EXIT_FAILURE;
+                }
                 break;
             case 2:
-                command_type = TASKSTATS_CMD_ATTR_TGID;
-                pid = atoi(optarg);
+                if (target_list_add(&targets, TASKSTATS_CMD_ATTR_TGID,
+                                    atoi(optarg)) < 0) {
+                    return EXIT_FAILURE;
+                }
                 break;
             case 3:
                 human_readable = 0;
@@ -234,11 +611,162 @@ int main(int argc, char** argv) {
                     fprintf(stderr, "Unable open the out file\n");   
                     return EXIT_FAILURE;      
                 }
+                break;
             case 5:
                 custom_cmd_out = optarg;
                 break;
             case 6:
-                period = atoi(optarg) * MILL_SECOND;
+                period = atof(optarg) * MILL_SECOND;
+                break;
+            case 7:
+                if (target_list_load(&targets, optarg)) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 8:
+                queue_size = strtoul(optarg, NULL, 10);
+                break;
+            case 9:
+                if (!strcmp(optarg, "block")) {
+                    queue_policy = QUEUE_FULL_BLOCK;
+                } else if (!strcmp(optarg, "drop-oldest")) {
+                    queue_policy = QUEUE_FULL_DROP_OLDEST;
+                } else if (!strcmp(optarg, "drop-newest")) {
+                    queue_policy = QUEUE_FULL_DROP_NEWEST;
+                } else {
+                    fprintf(stderr, "Unknown queue policy %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 10:
+                if (!strcmp(optarg, "text")) {
+                    out_format = OUTPUT_TEXT;
+                } else if (!strcmp(optarg, "binary")) {
+                    out_format = OUTPUT_BINARY;
+                } else if (!strcmp(optarg, "delta")) {
+                    out_format = OUTPUT_DELTA;
+                } else {
+                    fprintf(stderr, "Unknown output format %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 11:
+                per_thread = 1;
+                break;
+            case 12:
+                thread_scan = atof(optarg) * MILL_SECOND;
+                break;
+            case 13:
+                exit_events = 1;
+                break;
+            case 14:
+                exit_events = 1;
+                exit_cpus = optarg;
+                break;
+            case 15:
+                cpu_group = atoi(optarg);
+                break;
+            case 16:
+                if (target_list_add_cgroup(&targets, optarg) < 0) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 17:
+                if (!strcmp(optarg, "sleep")) {
+                    tick_mode = TICKER_SLEEP;
+                } else if (!strcmp(optarg, "hybrid")) {
+                    tick_mode = TICKER_HYBRID;
+                } else if (!strcmp(optarg, "fifo")) {
+                    tick_mode = TICKER_FIFO;
+                } else {
+                    fprintf(stderr, "Unknown tick mode %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 18:
+                tick_cpu = atoi(optarg);
+                break;
+            case 19:
+                dump_interval = atof(optarg) * 1000 * MILL_SECOND;
+                break;
+            case 20:
+                rates = 1;
+                break;
+            case 21:
+                window = atof(optarg) * 1000 * MILL_SECOND;
+                if (window <= 0) {
+                    fprintf(stderr, "Window must be positive\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 22:
+                pre_trigger = atof(optarg) * 1000 * MILL_SECOND;
+                break;
+            case 23:
+                if (n_triggers == FLIGHT_MAX_TRIGGERS) {
+                    fprintf(stderr, "Too many triggers, at most %d\n",
+                            FLIGHT_MAX_TRIGGERS);
+                    return EXIT_FAILURE;
+                }
+                triggers[n_triggers++] = optarg;
+                break;
+            case 24:
+                post_trigger = atof(optarg) * 1000 * MILL_SECOND;
+                break;
+            case 25:
+                shm_name = optarg;
+                break;
+            case 26:
+                metrics_address = optarg;
+                break;
+            case 27:
+                if (n_cmds == MAX_WORKLOADS) {
+                    fprintf(stderr, "At most %d commands can be run\n",
+                            MAX_WORKLOADS);
+                    return EXIT_FAILURE;
+                }
+                cmds[n_cmds++] = optarg;
+                break;
+            case 28:
+                if (!strcmp(optarg, "libnl")) {
+                    transport = NETLINK_LIBNL;
+                } else if (!strcmp(optarg, "raw")) {
+                    transport = NETLINK_RAW;
+                } else {
+                    fprintf(stderr, "Unknown netlink mode %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 29:
+                n_workers = atoi(optarg);
+                break;
+            case 30:
+                top_k = atoi(optarg);
+                if (top_k <= 0) {
+                    fprintf(stderr, "--top needs a positive number of "
+                            "processes\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 31:
+                if (top_sort_parse(optarg, &top_sort)) {
+                    fprintf(stderr, "Unknown sort key %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 32:
+                if (n_matches == PROC_MAX_MATCHES) {
+                    fprintf(stderr, "Too many patterns, at most %d\n",
+                            PROC_MAX_MATCHES);
+                    return EXIT_FAILURE;
+                }
+                matches[n_matches++] = optarg;
+                break;
+            case 33:
+                proc_stats = 1;
+                break;
+            case 34:
+                max_period = atof(optarg) * MILL_SECOND;
                 break;
             default:
                 break;
@@ -246,145 +774,369 @@ int main(int argc, char** argv) {
     }
     custom_cmd_len = argc - optind;
     custom_cmd_arg = argv + optind;
-    if (custom_cmd_len) {
-        command_type = TASKSTATS_CMD_ATTR_PID;
-    }
-    if (!pid && !custom_cmd_len) {
-        fprintf(stderr, "Either PID or TGID or CUSTOM COMMAND must be specified\n");
+    int n_workloads = n_cmds + (custom_cmd_len > 0);
+    if (!targets.n_targets && !n_workloads && !top_k && !n_matches &&
+        !exit_events) {
+        fprintf(stderr, "At least one PID, TGID, CGROUP, a CUSTOM COMMAND, "
+                "--top, --match or --exit-events must be specified\n");
         return EXIT_FAILURE;
     }
+    /* without targets to poll, run until interrupted */
+    int wait_signal = exit_events && !targets.n_targets && !n_workloads &&
+                      !top_k && !n_matches;
+    int exit_target = -1;
+    if (exit_events) {
+        /* all exit events are recorded under this one pseudo target */
+        exit_target = target_list_add(&targets,
+                                      TASKSTATS_CMD_ATTR_REGISTER_CPUMASK, 0);
+        if (exit_target < 0) {
+            return EXIT_FAILURE;
+        }
+        target_list_get(&targets, exit_target)->alive = 0;
+    }
 
-    /* generate netlink connection */
-    struct nl_sock* netlink_socket = nl_socket_alloc();
-    if (!netlink_socket) {
-        fprintf(stderr, "Unable to allocate netlink socket\n");
-        goto error;
+    if (!out_file) {
+        out_format = OUTPUT_TEXT;
     }
-    int ret = genl_connect(netlink_socket);
-    if (ret < 0) {
-        nl_perror(ret, "Unable to open netlink socket (are you root?)");
-        goto error;
+    if (rates) {
+        if (out_format != OUTPUT_TEXT) {
+            fprintf(stderr, "--rates is written as text only\n");
+            return EXIT_FAILURE;
+        }
+        out_format = OUTPUT_RATES;
     }
-    int family_id = genl_ctrl_resolve(netlink_socket, TASKSTATS_GENL_NAME);
-    if (family_id < 0) {
-        nl_perror(family_id, "Unable to determine taskstats family id "
-                  "(does your kernel support taskstats?)");
-        goto error;
+    if (window) {
+        if (out_format != OUTPUT_TEXT) {
+            fprintf(stderr, "--window is written as text only, without "
+                    "--rates\n");
+            return EXIT_FAILURE;
+        }
+        out_format = OUTPUT_WINDOW;
+    }
+    if (top_k) {
+        if (out_format != OUTPUT_TEXT) {
+            fprintf(stderr, "--top is written as text only, without --rates "
+                    "or --window\n");
+            return EXIT_FAILURE;
+        }
+        out_format = OUTPUT_TOP;
+    }
+    if ((shm_name || metrics_address) && !out_file &&
+        out_format == OUTPUT_TEXT) {
+        /* the export replaces the report on stdout */
+        out_format = OUTPUT_NONE;
+    }
+    if (period <= 0) {
+        fprintf(stderr, "Period must be positive\n");
+        return EXIT_FAILURE;
+    }
+    if (max_period && max_period < period) {
+        fprintf(stderr, "--max-period must not be shorter than --period\n");
+        return EXIT_FAILURE;
+    }
+    if ((pre_trigger > 0) != (n_triggers > 0)) {
+        fprintf(stderr, "--flight-recorder needs at least one --trigger and "
+                "the other way round\n");
+        return EXIT_FAILURE;
+    }
+    struct ShmExport shm;
+    if (shm_name && shm_export_init(&shm, shm_name, period)) {
+        return EXIT_FAILURE;
+    }
+    struct FlightRecorder recorder;
+    if (pre_trigger > 0) {
+        if (flight_recorder_init(&recorder, pre_trigger, post_trigger < 0 ?
+                                 pre_trigger : post_trigger)) {
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < n_triggers; i++) {
+            if (flight_recorder_add_trigger(&recorder, triggers[i])) {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    if (thread_scan <= 0) {
+        thread_scan = period;
+    }
+    if (proc_stats) {
+        /* two files per task stay open, up to the hard limit */
+        struct rlimit limit;
+        if (!getrlimit(RLIMIT_NOFILE, &limit) &&
+            limit.rlim_cur < limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
     }
 
     /* used for communicating between master thread and taskstats thread */
     struct ConcurrentQueue que;
-    concurrent_queue_init(&que);
+    if (concurrent_queue_init(&que, queue_size, queue_policy)) {
+        fprintf(stderr, "Unable to allocate queue\n");
+        return EXIT_FAILURE;
+    }
+
+    /* netlink connection, tick timer and event loop */
+    struct QueryEngine engine;
+    if (query_engine_init(&engine, &que, &targets, period, tick_mode,
+                          tick_cpu, transport, n_workers)) {
+        return EXIT_FAILURE;
+    }
     
+    struct DeltaEncoder encoder;
+    if (out_format == OUTPUT_DELTA && delta_encoder_init(&encoder, out_file)) {
+        fprintf(stderr, "Unable to allocate delta encoder\n");
+        goto error;
+    }
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR2);
+    /*
+     * SIGINT and SIGTERM end the run cleanly instead of killing it, SIGUSR2
+     * prints the latency histograms. Blocked before any thread starts, so
+     * that all of them inherit the mask
+     */
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    engine.signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+
+    struct MetricsServer metrics;
+    if (metrics_address) {
+        if (metrics_server_init(&metrics, metrics_address, &targets,
+                                &engine.latency, &que) ||
+            metrics_server_start(&metrics)) {
+            metrics_server_destroy(&metrics);
+            goto error;
+        }
+    }
+
+    struct ExitListener listener;
+    if (exit_events && exit_listener_init(&listener, &que, exit_target,
+                                          exit_cpus, cpu_group)) {
+        goto error;
+    }
+    engine.dump_interval = dump_interval;
+    engine.proc_stats = proc_stats;
+    if (max_period) {
+        engine.max_interval = max_period / period;
+    }
+
+    struct RateTracker rate_tracker;
+    rate_tracker_init(&rate_tracker);
+    struct WindowAggregator windows;
+    window_aggregator_init(&windows, window, proc_stats);
+    struct TopTable top;
+    struct ProcScanner procs;
+    if (top_k) {
+        if (top_table_init(&top, top_k, top_sort,
+                           !out_file && isatty(STDOUT_FILENO))) {
+            fprintf(stderr, "Unable to allocate the top table\n");
+            goto error;
+        }
+    }
+    if (top_k || n_matches) {
+        if (proc_scanner_init(&procs, &targets, thread_scan)) {
+            goto error;
+        }
+        engine.procs = &procs;
+        for (int i = 0; i < n_matches; i++) {
+            if (proc_scanner_add_match(&procs, matches[i])) {
+                goto error;
+            }
+        }
+    }
+
+    /* run custom commands, they wait for the engine to start ticking */
+    struct Workloads workloads;
+    workloads_init(&workloads);
+    for (int i = 0; i < n_workloads; i++) {
+        /* the --cmd commands first, then the one after "--" */
+        int ret;
+        if (i < n_cmds) {
+            char *shell_argv[] = { "sh", "-c", cmds[i] };
+            ret = workloads_spawn(&workloads, 3, shell_argv, custom_cmd_out,
+                                  n_workloads);
+        } else {
+            ret = workloads_spawn(&workloads, custom_cmd_len, custom_cmd_arg,
+                                  custom_cmd_out, n_workloads);
+        }
+        if (ret) {
+            goto error;
+        }
+        workloads.targets[i] = target_list_add(
+            &targets, per_thread ? TASKSTATS_CMD_ATTR_TGID :
+            TASKSTATS_CMD_ATTR_PID, workloads.commands[i].pid);
+        if (workloads.targets[i] < 0) {
+            fprintf(stderr, "Unable to monitor the command %s\n",
+                    workloads.names[i]);
+            goto error;
+        }
+    }
+    engine.commands = workloads.commands;
+    engine.n_commands = workloads.n_workloads;
+
     /* create thread for processing task stats */
     struct ProcessThreadArgs process_args = {
         .que = &que,
+        .targets = &targets,
         .file = out_file,
-        .human_readable = human_readable
+        .format = out_format,
+        .encoder = &encoder,
+        .rates = &rate_tracker,
+        .windows = &windows,
+        .top = top_k ? &top : NULL,
+        .recorder = pre_trigger > 0 ? &recorder : NULL,
+        .shm = shm_name ? &shm : NULL,
+        .metrics = metrics_address ? &metrics : NULL,
+        .workloads = n_workloads > 1 ? &workloads : NULL,
+        .matches = matches,
+        .human_readable = human_readable,
+        .proc_stats = proc_stats,
+        .latency = &engine.latency
     };
     pthread_t process_task_stats_thread;
-    ret = pthread_create(&process_task_stats_thread, NULL, &process_task_stats, 
-                         (void *)(&process_args));
+    int ret = pthread_create(&process_task_stats_thread, NULL,
+                             &process_task_stats, (void *)(&process_args));
     if (ret) {
         fprintf(stderr, "Unable to create thread, %d\n", ret);
         goto error;
     }
 
-    /* register callback */
-    struct nl_cb* callbacks = nl_cb_get(nl_cb_alloc(NL_CB_CUSTOM));
-    nl_cb_set(callbacks, NL_CB_MSG_IN, NL_CB_CUSTOM, &parse_task_stats, &que);
-    nl_cb_err(callbacks, NL_CB_CUSTOM, &print_receive_error, &family_id);
-    
-    /* create thread for send task stats query */
-    struct QueryThreadArgs query_args = {
-        .netlink_socket = netlink_socket,
-        .family_id = family_id,
-        .command_type = command_type,
-        .pid = pid,
-        .callbacks = callbacks
-    };
-    pthread_t query_task_stats_threads[N_QUERY_THREAD];
-    for (int i = 0; i < N_QUERY_THREAD; i++) {
-        ret = pthread_create(&query_task_stats_threads[i], NULL, &query_task_stats, 
-                             (void *)(&query_args));
-        if (ret) {
-            fprintf(stderr, "Unable to create thread, %d\n", ret);
+    struct ThreadScanner scanner;
+    if (per_thread) {
+        if (thread_scanner_init(&scanner, &targets, thread_scan)) {
             goto error;
         }
+        engine.scanner = &scanner;
     }
-    
-    sleep(1);
-
-    /* run custom command */
-    if (custom_cmd_len) {
-        signal(SIGCHLD, SIG_IGN); // avoid <defunct> child process 
-        pid = exec_command(custom_cmd_len, custom_cmd_arg, custom_cmd_out);
+    if (out_file &&
+        (out_format == OUTPUT_BINARY || out_format == OUTPUT_DELTA) &&
+        record_write_header(out_file, &targets,
+                            out_format == OUTPUT_DELTA ?
+                            RECORD_ENCODING_DELTA : RECORD_ENCODING_RAW)) {
+        fprintf(stderr, "Unable to write the out file header\n");
+        goto error;
     }
 
-    
+    if (exit_events && exit_listener_start(&listener)) {
+        goto error;
+    }
 
     /* monitor the target process */
-    unsigned long long kill_total, send_total, recv_total;
-    unsigned long long kill_max, send_max, recv_max;
-    unsigned cnt = 0;
-    kill_total = send_total = recv_total = 0;
-    kill_max = send_max = recv_max = 0;
-    int query_thread_idx = 0;
-    time_t t_next_iter = get_ns_timestamp();
-    do {
-        time_t ts_b_kill = get_ns_timestamp();
-        int killed = kill(pid, 0); // after being killed, query the last time
-        time_t ts_a_kill = get_ns_timestamp();
-
-        // printf("** kill\n");
-        ret = pthread_kill(query_task_stats_threads[query_thread_idx], SIGUSR1);
-        if (ret) {
-            fprintf(stderr, "Kill query thread failed, %d\n", ret);
-            goto error;
-        }
-        query_thread_idx = (query_thread_idx+1) % N_QUERY_THREAD;
-
-        
-        // ret = send_task_stats_query(netlink_socket, family_id, command_type, pid);
-        // if (ret) {
-        //     nl_perror(ret, "Failed to query taskstats");
-        //     goto error;
-        // }
-        time_t ts_a_send = get_ns_timestamp();
-        // ret = nl_recvmsgs(netlink_socket, callbacks);
-        // if (ret) {
-        //     nl_perror(ret, "Failed to receive message");
-        //     goto error;
-        // }
-        // time_t ts_a_recv = get_ns_timestamp();
-        if (killed) {
-            break;
-        }
-        kill_total += ts_a_kill - ts_b_kill;
-        send_total += ts_a_send - ts_a_kill;
-        // recv_total += ts_a_recv - ts_a_send;
-#define max(a, b) (a > b ? a : b)
-        kill_max = max(kill_max, ts_a_kill - ts_b_kill);
-        send_max = max(send_max, ts_a_send - ts_a_kill);
-        // recv_max = max(recv_max, ts_a_recv - ts_a_send);
-        cnt ++;
-        t_next_iter += period;
-        sleep_until(t_next_iter);
-    } while (1);
-    concurrent_queue_push(&que, NULL);
-    
-    printf("%lf %lf %lf\n", kill_total*1./cnt, send_total*1./cnt, recv_total*1./cnt);
-    printf("%llu %llu %llu\n", kill_max, send_max, recv_max);
+    if (wait_signal) {
+        struct timespec timeout = {
+            dump_interval / 1000000000, dump_interval % 1000000000
+        };
+        int signal_number;
+        do {
+            signal_number = sigtimedwait(&signals, NULL,
+                                         dump_interval ? &timeout : NULL);
+            if (signal_number == SIGUSR2 ||
+                (signal_number < 0 && errno == EAGAIN)) {
+                stage_histograms_print(stderr, &engine.latency);
+            }
+        } while (signal_number != SIGINT && signal_number != SIGTERM);
+        ret = 0;
+    } else {
+        ret = query_engine_run(&engine);
+    }
+    if (exit_events) {
+        exit_listener_stop(&listener);
+    }
+    concurrent_queue_close(&que);
+    pthread_join(process_task_stats_thread, NULL);
+    if (out_file) {
+        fclose(out_file);
+    }
 
-    pthread_join(query_task_stats_threads[0], NULL);
+    stage_histograms_print(stderr, &engine.latency);
+    if (out_format == OUTPUT_DELTA && encoder.bytes_out) {
+        fprintf(stderr, "delta encoding: %llu bytes of records in %llu "
+                "bytes, %.1fx\n", encoder.bytes_in, encoder.bytes_out,
+                encoder.bytes_in * 1. / encoder.bytes_out);
+    }
+    ticker_print_stats(&engine.ticker);
+    if (n_workloads > 1) {
+        workloads_print_summary(stderr, &workloads);
+    } else if (n_workloads) {
+        command_print_status(&workloads.commands[0]);
+    }
+    workloads_destroy(&workloads);
+    if (engine.n_overruns || engine.n_lost || engine.n_stray ||
+        que.n_dropped) {
+        fprintf(stderr, "%llu missed ticks, %llu lost replies, "
+                "%llu stray replies, %llu dropped records\n",
+                engine.n_overruns, engine.n_lost, engine.n_stray,
+                que.n_dropped);
+    }
+    if (top_k) {
+        fprintf(stderr, "top: %llu tables, %llu processes found, %llu of "
+                "them gone\n", top.n_tables, procs.n_added, procs.n_gone);
+        top_table_free(&top);
+    } else if (n_matches) {
+        fprintf(stderr, "match: %llu processes attached, %llu of them "
+                "gone\n", procs.n_added, procs.n_gone);
+    }
+    if (top_k || n_matches) {
+        proc_scanner_free(&procs);
+    }
+    if (engine.max_interval > 1) {
+        fprintf(stderr, "adaptive periods: %llu samples skipped, %llu "
+                "taken\n", engine.n_skipped, engine.n_sent);
+    }
+    if (n_workers > 1) {
+        fprintf(stderr, "%d query workers, %llu queries taken over from "
+                "busy ones\n", n_workers, engine.n_stolen);
+    }
+    if (pre_trigger > 0) {
+        fprintf(stderr, "flight recorder: %llu dumps", recorder.n_dumps);
+        for (int i = 0; i < recorder.n_triggers; i++) {
+            fprintf(stderr, ", %s fired %llu times",
+                    recorder.triggers[i].text, recorder.triggers[i].n_fired);
+        }
+        fprintf(stderr, ", %llu records overwritten\n",
+                recorder.n_overwritten);
+        flight_recorder_free(&recorder);
+    }
+    if (shm_name) {
+        fprintf(stderr, "shared memory: %llu records published, %llu of "
+                "targets beyond %d slots skipped\n", shm.n_published,
+                shm.n_skipped, SHM_SLOTS);
+        shm_export_destroy(&shm);
+    }
+    if (metrics_address) {
+        fprintf(stderr, "metrics: %llu scrapes served\n", metrics.n_scrapes);
+        metrics_server_destroy(&metrics);
+    }
+    if (rate_tracker.n_resets) {
+        fprintf(stderr, "%llu tasks restarted their rates after a PID "
+                "reuse\n", rate_tracker.n_resets);
+    }
 
-    nl_cb_put(callbacks);
-    nl_socket_free(netlink_socket);
-    return EXIT_SUCCESS;
+    if (exit_events) {
+        unsigned long long n_events = 0, n_overflows = 0;
+        for (int i = 0; i < listener.n_groups; i++) {
+            n_events += listener.groups[i].n_events;
+            n_overflows += listener.groups[i].n_overflows;
+        }
+        fprintf(stderr, "%llu exit events on %d sockets, %llu overflows\n",
+                n_events, listener.n_groups, n_overflows);
+        exit_listener_destroy(&listener);
+    }
+    close(engine.signal_fd);
+    query_engine_destroy(&engine);
+    if (per_thread) {
+        thread_scanner_free(&scanner);
+    }
+    rate_tracker_free(&rate_tracker);
+    window_aggregator_free(&windows);
+    concurrent_queue_destroy(&que);
+    target_list_free(&targets);
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
 
 error:
-    if (netlink_socket) {
-        nl_socket_free(netlink_socket);
-    }
+    query_engine_destroy(&engine);
+    concurrent_queue_destroy(&que);
     return EXIT_FAILURE;
 }
\ No newline at end of file
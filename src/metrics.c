@@ -0,0 +1,768 @@
+#define _GNU_SOURCE
+#include "metrics.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <linux/taskstats.h>
+#include "format.h"
+#include "target.h"
+#include "utils.h"
+
+enum MetricUnit {
+    UNIT_ONE,
+    UNIT_USEC,      /* exported in seconds */
+    UNIT_NSEC,      /* exported in seconds */
+    UNIT_KB         /* exported in bytes */
+};
+
+struct TaskMetric {
+    const char *name;
+    const char *type;
+    const char *help;
+    size_t offset;
+    enum MetricUnit unit;
+};
+
+#define TASK(name, type, field, unit, help) \
+    { name, type, help, offsetof(struct taskstats, field), unit }
+
+static const struct TaskMetric task_metrics[] = {
+    TASK("mn_task_elapsed_seconds", "gauge", ac_etime, UNIT_USEC,
+         "Time since the task started"),
+    TASK("mn_task_user_cpu_seconds_total", "counter", ac_utime, UNIT_USEC,
+         "User CPU time"),
+    TASK("mn_task_system_cpu_seconds_total", "counter", ac_stime, UNIT_USEC,
+         "System CPU time"),
+    TASK("mn_task_minor_faults_total", "counter", ac_minflt, UNIT_ONE,
+         "Minor page faults"),
+    TASK("mn_task_major_faults_total", "counter", ac_majflt, UNIT_ONE,
+         "Major page faults"),
+    TASK("mn_task_cpu_delays_total", "counter", cpu_count, UNIT_ONE,
+         "Waits for a CPU while runnable"),
+    TASK("mn_task_cpu_delay_seconds_total", "counter", cpu_delay_total,
+         UNIT_NSEC, "Time waiting for a CPU while runnable"),
+    TASK("mn_task_blkio_delays_total", "counter", blkio_count, UNIT_ONE,
+         "Waits for synchronous block IO"),
+    TASK("mn_task_blkio_delay_seconds_total", "counter", blkio_delay_total,
+         UNIT_NSEC, "Time waiting for synchronous block IO"),
+    TASK("mn_task_swapin_delays_total", "counter", swapin_count, UNIT_ONE,
+         "Waits for swapping in"),
+    TASK("mn_task_swapin_delay_seconds_total", "counter", swapin_delay_total,
+         UNIT_NSEC, "Time waiting for swapping in"),
+    TASK("mn_task_freepages_delays_total", "counter", freepages_count,
+         UNIT_ONE, "Waits for memory reclaim"),
+    TASK("mn_task_freepages_delay_seconds_total", "counter",
+         freepages_delay_total, UNIT_NSEC, "Time waiting for memory reclaim"),
+    TASK("mn_task_cpu_run_real_seconds_total", "counter",
+         cpu_run_real_total, UNIT_NSEC, "Wall clock CPU running time"),
+    TASK("mn_task_read_bytes_total", "counter", read_char, UNIT_ONE,
+         "Bytes read"),
+    TASK("mn_task_write_bytes_total", "counter", write_char, UNIT_ONE,
+         "Bytes written"),
+    TASK("mn_task_read_syscalls_total", "counter", read_syscalls, UNIT_ONE,
+         "Read system calls"),
+    TASK("mn_task_write_syscalls_total", "counter", write_syscalls,
+         UNIT_ONE, "Write system calls"),
+    TASK("mn_task_voluntary_switches_total", "counter", nvcsw, UNIT_ONE,
+         "Voluntary context switches"),
+    TASK("mn_task_involuntary_switches_total", "counter", nivcsw, UNIT_ONE,
+         "Involuntary context switches"),
+    TASK("mn_task_rss_high_water_bytes", "gauge", hiwater_rss, UNIT_KB,
+         "High water mark of the resident set"),
+    TASK("mn_task_vm_high_water_bytes", "gauge", hiwater_vm, UNIT_KB,
+         "High water mark of the virtual memory")
+};
+
+#define RATE(name, field, help) \
+    { name, "gauge", help, offsetof(struct TaskRates, field), UNIT_ONE }
+
+static const struct TaskMetric rate_metrics[] = {
+    RATE("mn_task_cpu_percent", cpu,
+         "CPU time between the last two samples, percent of one CPU"),
+    RATE("mn_task_read_bytes_per_second", read_bytes,
+         "Bytes read per second between the last two samples"),
+    RATE("mn_task_write_bytes_per_second", write_bytes,
+         "Bytes written per second between the last two samples"),
+    RATE("mn_task_cpu_delay_ms_per_second", cpu_delay,
+         "CPU delay per second between the last two samples"),
+    RATE("mn_task_blkio_delay_ms_per_second", blkio_delay,
+         "Block IO delay per second between the last two samples"),
+    RATE("mn_task_swapin_delay_ms_per_second", swapin_delay,
+         "Swapin delay per second between the last two samples")
+};
+
+#define PROC(name, type, field, file, unit, help) \
+    { { name, type, help, offsetof(struct ProcSupplement, field), unit }, \
+      file }
+
+/* from the /proc files of --proc-stats, for the tasks they were read of */
+static const struct {
+    struct TaskMetric metric;
+    enum ProcFile file;
+} proc_metrics[] = {
+    PROC("mn_task_rss_bytes", "gauge", rss, PROC_FILE_STAT, UNIT_ONE,
+         "Resident set"),
+    PROC("mn_task_run_seconds_total", "counter", run_time,
+         PROC_FILE_SCHEDSTAT, UNIT_NSEC, "Time on a CPU"),
+    PROC("mn_task_run_queue_wait_seconds_total", "counter", wait_time,
+         PROC_FILE_SCHEDSTAT, UNIT_NSEC, "Time runnable on a run queue")
+};
+
+static const struct {
+    const char *state;
+    size_t offset;
+} cgroup_states[] = {
+    { "running", offsetof(struct cgroupstats, nr_running) },
+    { "sleeping", offsetof(struct cgroupstats, nr_sleeping) },
+    { "uninterruptible", offsetof(struct cgroupstats, nr_uninterruptible) },
+    { "stopped", offsetof(struct cgroupstats, nr_stopped) },
+    { "io_wait", offsetof(struct cgroupstats, nr_io_wait) }
+};
+
+#define N_ITEMS(a) (sizeof(a) / sizeof((a)[0]))
+
+/* growing response text */
+struct Text {
+    char *data;
+    size_t len, cap;
+};
+
+static char* reserve(struct Text *text, size_t n) {
+    if (text->cap - text->len < n) {
+        size_t cap = text->cap ? text->cap : 64 << 10;
+        while (cap - text->len < n) {
+            cap *= 2;
+        }
+        char *data = (char*)realloc(text->data, cap);
+        if (!data) {
+            return NULL;
+        }
+        text->data = data;
+        text->cap = cap;
+    }
+    return text->data + text->len;
+}
+
+static void commit(struct Text *text, const char *end) {
+    text->len = end - text->data;
+}
+
+/* value in ns as seconds, exact to the nanosecond */
+static char* format_seconds(char *p, unsigned long long ns) {
+    p = format_u64(p, ns / 1000000000);
+    *p++ = '.';
+    char digits[FORMAT_U64_LEN];
+    int n = format_u64(digits, ns % 1000000000 + 1000000000) - digits;
+    memcpy(p, digits + 1, n - 1);
+    return p + n - 1;
+}
+
+static char* format_label(char *p, const char *name, const char *value) {
+    p = format_str(p, name);
+    *p++ = '=';
+    *p++ = '"';
+    for (; *value; value++) {
+        if (*value == '"' || *value == '\\') {
+            *p++ = '\\';
+            *p++ = *value;
+        } else if (*value == '\n') {
+            *p++ = '\\';
+            *p++ = 'n';
+        } else {
+            *p++ = *value;
+        }
+    }
+    *p++ = '"';
+    return p;
+}
+
+/*
+ * the target index keeps the series of a reused PID apart from those of
+ * the task that had it before
+ */
+static char* format_task_labels(char *p, const struct MetricsEntry *entry) {
+    p = format_str(p, "{target=\"");
+    p = format_int(p, entry->stats.target);
+    p = format_str(p, entry->command_type == TASKSTATS_CMD_ATTR_TGID ?
+                   "\",type=\"tgid\",pid=\"" : "\",type=\"pid\",pid=\"");
+    p = format_int(p, entry->pid);
+    p = format_str(p, "\",");
+    p = format_label(p, "comm", entry->stats.stats.ac_comm);
+    *p++ = '}';
+    *p++ = ' ';
+    return p;
+}
+
+static char* format_family(char *p, const struct TaskMetric *metric) {
+    p = format_str(p, "# HELP ");
+    p = format_str(p, metric->name);
+    *p++ = ' ';
+    p = format_str(p, metric->help);
+    p = format_str(p, "\n# TYPE ");
+    p = format_str(p, metric->name);
+    *p++ = ' ';
+    p = format_str(p, metric->type);
+    *p++ = '\n';
+    return p;
+}
+
+static int is_task(const struct MetricsEntry *entry) {
+    return entry->command_type == TASKSTATS_CMD_ATTR_PID ||
+           entry->command_type == TASKSTATS_CMD_ATTR_TGID;
+}
+
+/* bound of one sample line, labels included */
+#define LINE_LEN (256 + 2 * TS_COMM_LEN)
+
+static int render(struct MetricsServer *server, struct Text *text) {
+    const struct MetricsSnapshot *snapshot = &server->copy;
+    char *p;
+    for (size_t i = 0; i < N_ITEMS(task_metrics); i++) {
+        const struct TaskMetric *metric = &task_metrics[i];
+        if (!(p = reserve(text, 512))) {
+            return 1;
+        }
+        commit(text, format_family(p, metric));
+        for (int j = 0; j < snapshot->n_entries; j++) {
+            const struct MetricsEntry *entry = &snapshot->entries[j];
+            if (!is_task(entry) || !(p = reserve(text, LINE_LEN))) {
+                continue;
+            }
+            unsigned long long value;
+            memcpy(&value, (const char*)&entry->stats.stats + metric->offset,
+                   sizeof(value));
+            p = format_str(p, metric->name);
+            p = format_task_labels(p, entry);
+            if (metric->unit == UNIT_USEC) {
+                p = format_seconds(p, value * 1000);
+            } else if (metric->unit == UNIT_NSEC) {
+                p = format_seconds(p, value);
+            } else {
+                p = format_u64(p, metric->unit == UNIT_KB ? value * 1024 :
+                               value);
+            }
+            *p++ = '\n';
+            commit(text, p);
+        }
+    }
+    for (size_t i = 0; i < N_ITEMS(rate_metrics); i++) {
+        const struct TaskMetric *metric = &rate_metrics[i];
+        if (!(p = reserve(text, 512))) {
+            return 1;
+        }
+        commit(text, format_family(p, metric));
+        for (int j = 0; j < snapshot->n_entries; j++) {
+            const struct MetricsEntry *entry = &snapshot->entries[j];
+            if (!is_task(entry) || !entry->has_rates ||
+                !(p = reserve(text, LINE_LEN))) {
+                continue;
+            }
+            double value;
+            memcpy(&value, (const char*)&entry->rates + metric->offset,
+                   sizeof(value));
+            p = format_str(p, metric->name);
+            p = format_task_labels(p, entry);
+            p = format_fixed3(p, value, 0);
+            *p++ = '\n';
+            commit(text, p);
+        }
+    }
+    for (size_t i = 0; i < N_ITEMS(proc_metrics); i++) {
+        const struct TaskMetric *metric = &proc_metrics[i].metric;
+        int n_samples = 0;
+        for (int j = 0; j < snapshot->n_entries; j++) {
+            const struct MetricsEntry *entry = &snapshot->entries[j];
+            if (!is_task(entry) ||
+                !(entry->stats.proc.valid & 1 << proc_metrics[i].file)) {
+                continue;
+            }
+            /* no family without --proc-stats */
+            if (!n_samples++) {
+                if (!(p = reserve(text, 512))) {
+                    return 1;
+                }
+                commit(text, format_family(p, metric));
+            }
+            if (!(p = reserve(text, LINE_LEN))) {
+                continue;
+            }
+            unsigned long long value;
+            memcpy(&value, (const char*)&entry->stats.proc + metric->offset,
+                   sizeof(value));
+            p = format_str(p, metric->name);
+            p = format_task_labels(p, entry);
+            if (metric->unit == UNIT_NSEC) {
+                p = format_seconds(p, value);
+            } else {
+                p = format_u64(p, value);
+            }
+            *p++ = '\n';
+            commit(text, p);
+        }
+    }
+
+    if (!(p = reserve(text, 256))) {
+        return 1;
+    }
+    commit(text, format_str(p, "# HELP mn_cgroup_tasks Tasks of the cgroup "
+                            "by state\n# TYPE mn_cgroup_tasks gauge\n"));
+    for (int j = 0; j < snapshot->n_entries; j++) {
+        const struct MetricsEntry *entry = &snapshot->entries[j];
+        if (entry->command_type != TARGET_CGROUP) {
+            continue;
+        }
+        for (size_t i = 0; i < N_ITEMS(cgroup_states); i++) {
+            if (!(p = reserve(text, LINE_LEN + 2 * strlen(entry->path)))) {
+                return 1;
+            }
+            unsigned long long value;
+            memcpy(&value, (const char*)&entry->stats.cgroup +
+                   cgroup_states[i].offset, sizeof(value));
+            p = format_str(p, "mn_cgroup_tasks{");
+            p = format_label(p, "path", entry->path);
+            p = format_str(p, ",state=\"");
+            p = format_str(p, cgroup_states[i].state);
+            p = format_str(p, "\"} ");
+            p = format_u64(p, value);
+            *p++ = '\n';
+            commit(text, p);
+        }
+    }
+
+    /* the pipeline of mn itself */
+    static const double quantiles[] = { 0.5, 0.99, 0.999 };
+    static const char *quantile_names[] = { "0.5", "0.99", "0.999" };
+    if (!(p = reserve(text, N_STAGES * 4 * LINE_LEN + 1024))) {
+        return 1;
+    }
+    p = format_str(p, "# HELP mn_stage_latency_seconds Latency of the "
+                   "stages of the sampling pipeline\n"
+                   "# TYPE mn_stage_latency_seconds summary\n");
+    for (int i = 0; i < N_STAGES; i++) {
+        const struct Histogram *histogram = &server->latency->stages[i];
+        unsigned long long n = __atomic_load_n(&histogram->n,
+                                               __ATOMIC_RELAXED);
+        for (size_t j = 0; j < N_ITEMS(quantiles); j++) {
+            p = format_str(p, "mn_stage_latency_seconds{");
+            p = format_label(p, "stage", stage_name(i));
+            p = format_str(p, ",quantile=\"");
+            p = format_str(p, quantile_names[j]);
+            p = format_str(p, "\"} ");
+            p = format_seconds(p, n ? histogram_percentile(
+                histogram, quantiles[j] * 100) : 0);
+            *p++ = '\n';
+        }
+        p = format_str(p, "mn_stage_latency_seconds_sum{");
+        p = format_label(p, "stage", stage_name(i));
+        p = format_str(p, "} ");
+        p = format_seconds(p, __atomic_load_n(&histogram->total,
+                                              __ATOMIC_RELAXED));
+        p = format_str(p, "\nmn_stage_latency_seconds_count{");
+        p = format_label(p, "stage", stage_name(i));
+        p = format_str(p, "} ");
+        p = format_u64(p, n);
+        *p++ = '\n';
+    }
+    p = format_str(p, "# HELP mn_records_total Records processed\n"
+                   "# TYPE mn_records_total counter\nmn_records_total ");
+    p = format_u64(p, snapshot->n_records);
+    p = format_str(p, "\n# HELP mn_dropped_records_total Records dropped "
+                   "by a full queue\n# TYPE mn_dropped_records_total "
+                   "counter\nmn_dropped_records_total ");
+    p = format_u64(p, __atomic_load_n(&server->que->n_dropped,
+                                      __ATOMIC_RELAXED));
+    p = format_str(p, "\n# HELP mn_scrapes_total Scrapes served\n"
+                   "# TYPE mn_scrapes_total counter\nmn_scrapes_total ");
+    p = format_u64(p, server->n_scrapes);
+    *p++ = '\n';
+    commit(text, p);
+    return 0;
+}
+
+static int copy_snapshot(struct MetricsSnapshot *to,
+                         const struct MetricsSnapshot *from) {
+    if (to->cap < from->n_entries) {
+        struct MetricsEntry *entries = (struct MetricsEntry*)realloc(
+            to->entries, from->cap * sizeof(struct MetricsEntry));
+        if (!entries) {
+            return 1;
+        }
+        to->entries = entries;
+        to->cap = from->cap;
+    }
+    memcpy(to->entries, from->entries,
+           from->n_entries * sizeof(struct MetricsEntry));
+    to->n_entries = from->n_entries;
+    to->n_records = from->n_records;
+    return 0;
+}
+
+/* the response to a request, formatted from a copy of the front snapshot */
+static int respond(struct MetricsServer *server,
+                   struct MetricsClient *client) {
+    pthread_mutex_lock(&server->lock);
+    int ret = copy_snapshot(&server->copy, server->front);
+    pthread_mutex_unlock(&server->lock);
+    if (ret) {
+        return 1;
+    }
+    server->n_scrapes++;
+
+    struct Text text = { NULL, 0, 0 };
+    /* room for the headers, written in front of the body at the end */
+    const size_t head_room = 256;
+    char *p = reserve(&text, head_room);
+    if (!p) {
+        return 1;
+    }
+    commit(&text, p + head_room);
+    if (render(server, &text)) {
+        free(text.data);
+        return 1;
+    }
+    char head[256];
+    p = format_str(head, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; "
+                   "version=0.0.4\r\nContent-Length: ");
+    p = format_u64(p, text.len - head_room);
+    p = format_str(p, "\r\nConnection: close\r\n\r\n");
+    size_t head_len = p - head;
+    memcpy(text.data + head_room - head_len, head, head_len);
+    client->response = text.data;
+    client->sent = head_room - head_len;
+    client->response_len = text.len;
+    return 0;
+}
+
+static void close_client(struct MetricsServer *server,
+                         struct MetricsClient *client) {
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    free(client->response);
+    memset(client, 0, sizeof(*client));
+    client->fd = -1;
+}
+
+static void accept_clients(struct MetricsServer *server) {
+    for (;;) {
+        int fd = accept4(server->listen_fd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        struct MetricsClient *client = NULL;
+        for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+            if (server->clients[i].fd < 0) {
+                client = &server->clients[i];
+                break;
+            }
+        }
+        if (!client) {
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        struct epoll_event event = {
+            .events = EPOLLIN,
+            .data.ptr = client
+        };
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+            close_client(server, client);
+        }
+    }
+}
+
+static void serve_client(struct MetricsServer *server,
+                         struct MetricsClient *client) {
+    if (!client->response) {
+        /* the request is read up to its empty line and otherwise ignored */
+        ssize_t n = read(client->fd, client->request + client->request_len,
+                         METRICS_REQUEST_LEN - 1 - client->request_len);
+        if (n < 0 && errno == EAGAIN) {
+            return;
+        }
+        if (n > 0) {
+            client->request_len += n;
+            client->request[client->request_len] = '\0';
+            if (!strstr(client->request, "\r\n\r\n") &&
+                !strstr(client->request, "\n\n") &&
+                client->request_len < METRICS_REQUEST_LEN - 1) {
+                return;
+            }
+        }
+        if (n < 0 || respond(server, client)) {
+            close_client(server, client);
+            return;
+        }
+        struct epoll_event event = {
+            .events = EPOLLOUT,
+            .data.ptr = client
+        };
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+    }
+    while (client->sent < client->response_len) {
+        ssize_t n = write(client->fd, client->response + client->sent,
+                          client->response_len - client->sent);
+        if (n < 0) {
+            if (errno == EAGAIN) {
+                return;
+            }
+            break;
+        }
+        client->sent += n;
+    }
+    close_client(server, client);
+}
+
+static void* run_server(void *arg) {
+    struct MetricsServer *server = (struct MetricsServer*)arg;
+    struct epoll_event events[16];
+    for (;;) {
+        int n = epoll_wait(server->epoll_fd, events, 16, -1);
+        if (n < 0 && errno != EINTR) {
+            perror("Unable to wait for metrics clients");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == &server->stop_fd) {
+                return NULL;
+            } else if (events[i].data.ptr == &server->listen_fd) {
+                accept_clients(server);
+            } else {
+                serve_client(server,
+                             (struct MetricsClient*)events[i].data.ptr);
+            }
+        }
+    }
+    return NULL;
+}
+
+static int listen_unix(struct MetricsServer *server, const char *path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Metrics socket path too long: %s\n", path);
+        return 1;
+    }
+    strcpy(address.sun_path, path);
+    /* a socket left behind by an earlier run */
+    struct stat st;
+    if (!stat(path, &st) && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+                               SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0 ||
+        bind(server->listen_fd, (struct sockaddr*)&address,
+             sizeof(address))) {
+        fprintf(stderr, "Unable to bind the metrics socket %s: %s\n", path,
+                strerror(errno));
+        return 1;
+    }
+    server->path = strdup(path);
+    return 0;
+}
+
+static int listen_tcp(struct MetricsServer *server, const char *address) {
+    const char *colon = strrchr(address, ':');
+    char host[64] = "127.0.0.1";
+    size_t host_len = colon - address;
+    if (host_len) {
+        if (host_len >= sizeof(host)) {
+            goto error;
+        }
+        memcpy(host, address, host_len);
+        host[host_len] = '\0';
+    }
+    struct sockaddr_in in;
+    memset(&in, 0, sizeof(in));
+    in.sin_family = AF_INET;
+    in.sin_port = htons(atoi(colon + 1));
+    if (inet_pton(AF_INET, host, &in.sin_addr) != 1 || !in.sin_port) {
+        goto error;
+    }
+    server->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK |
+                               SOCK_CLOEXEC, 0);
+    int one = 1;
+    if (server->listen_fd < 0 ||
+        setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one,
+                   sizeof(one)) ||
+        bind(server->listen_fd, (struct sockaddr*)&in, sizeof(in))) {
+        fprintf(stderr, "Unable to bind the metrics port %s: %s\n", address,
+                strerror(errno));
+        return 1;
+    }
+    return 0;
+
+error:
+    fprintf(stderr, "Unable to parse the metrics address %s, expected "
+            "HOST:PORT\n", address);
+    return 1;
+}
+
+int metrics_server_init(struct MetricsServer *server, const char *address,
+                        const struct TargetList *targets,
+                        const struct StageHistograms *latency,
+                        const struct ConcurrentQueue *que) {
+    memset(server, 0, sizeof(*server));
+    server->listen_fd = server->epoll_fd = server->stop_fd = -1;
+    server->targets = targets;
+    server->latency = latency;
+    server->que = que;
+    server->front = &server->buffers[0];
+    server->back = &server->buffers[1];
+    for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+        server->clients[i].fd = -1;
+    }
+    pthread_mutex_init(&server->lock, NULL);
+    rate_tracker_init(&server->rates);
+
+    int ret = strchr(address, '/') || !strchr(address, ':') ?
+              listen_unix(server, address) : listen_tcp(server, address);
+    if (ret) {
+        return 1;
+    }
+    if (listen(server->listen_fd, METRICS_MAX_CLIENTS)) {
+        perror("Unable to listen for metrics clients");
+        return 1;
+    }
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server->epoll_fd < 0 || server->stop_fd < 0) {
+        perror("Unable to set up the metrics server");
+        return 1;
+    }
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.ptr = &server->listen_fd
+    };
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &event);
+    event.data.ptr = &server->stop_fd;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->stop_fd, &event);
+    return 0;
+}
+
+int metrics_server_start(struct MetricsServer *server) {
+    int ret = pthread_create(&server->thread, NULL, &run_server, server);
+    if (ret) {
+        fprintf(stderr, "Unable to start the metrics server: %s\n",
+                strerror(ret));
+        return 1;
+    }
+    server->started = 1;
+    return 0;
+}
+
+void metrics_server_update(struct MetricsServer *server,
+                           const struct TaskStatistics *stats,
+                           int command_type, int pid, const char *path) {
+    struct MetricsSnapshot *back = server->back;
+    if (stats->target >= back->cap) {
+        int cap = back->cap ? back->cap : 16;
+        while (cap <= stats->target) {
+            cap *= 2;
+        }
+        struct MetricsEntry *entries = (struct MetricsEntry*)realloc(
+            back->entries, cap * sizeof(struct MetricsEntry));
+        if (!entries) {
+            return;
+        }
+        back->entries = entries;
+        back->cap = cap;
+    }
+    if (stats->target >= back->n_entries) {
+        memset(back->entries + back->n_entries, 0,
+               (stats->target + 1 - back->n_entries) *
+               sizeof(struct MetricsEntry));
+        back->n_entries = stats->target + 1;
+    }
+    struct MetricsEntry *entry = &back->entries[stats->target];
+    entry->command_type = command_type;
+    entry->pid = pid;
+    entry->path = path;
+    entry->stats = *stats;
+    if (command_type == TASKSTATS_CMD_ATTR_PID ||
+        command_type == TASKSTATS_CMD_ATTR_TGID) {
+        int ret = rate_tracker_update(&server->rates, stats, &entry->rates);
+        if (ret >= 0) {
+            entry->has_rates = ret;
+        }
+    }
+    back->n_records++;
+}
+
+void metrics_server_publish(struct MetricsServer *server, int force) {
+    time_t now = get_monotonic_timestamp();
+    if (!force && now < server->next_publish) {
+        return;
+    }
+    server->next_publish = now + METRICS_PUBLISH_INTERVAL;
+    /*
+     * the last values of exited tasks and removed cgroups are not kept, nor
+     * those of a task whose target index has gone to another one
+     */
+    struct MetricsSnapshot *back = server->back;
+    for (int i = 0; i < back->n_entries; i++) {
+        if (back->entries[i].command_type &&
+            !target_is_current(target_list_get(server->targets, i),
+                               back->entries[i].stats.generation)) {
+            back->entries[i].command_type = 0;
+        }
+    }
+    pthread_mutex_lock(&server->lock);
+    struct MetricsSnapshot *front = server->back;
+    server->back = server->front;
+    server->front = front;
+    pthread_mutex_unlock(&server->lock);
+    /* scrapes only read the front snapshot, so it can be read here too */
+    copy_snapshot(server->back, server->front);
+}
+
+void metrics_server_stop(struct MetricsServer *server) {
+    if (server->started) {
+        uint64_t one = 1;
+        if (write(server->stop_fd, &one, sizeof(one)) == sizeof(one)) {
+            pthread_join(server->thread, NULL);
+        }
+        server->started = 0;
+    }
+}
+
+void metrics_server_destroy(struct MetricsServer *server) {
+    metrics_server_stop(server);
+    for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+        if (server->clients[i].fd >= 0) {
+            close(server->clients[i].fd);
+            free(server->clients[i].response);
+        }
+    }
+    if (server->listen_fd >= 0) {
+        close(server->listen_fd);
+    }
+    if (server->epoll_fd >= 0) {
+        close(server->epoll_fd);
+    }
+    if (server->stop_fd >= 0) {
+        close(server->stop_fd);
+    }
+    if (server->path) {
+        unlink(server->path);
+        free(server->path);
+    }
+    for (int i = 0; i < 2; i++) {
+        free(server->buffers[i].entries);
+    }
+    free(server->copy.entries);
+    rate_tracker_free(&server->rates);
+    pthread_mutex_destroy(&server->lock);
+}
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "procfiles.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "format.h"
+
+/* longer than any of the files, stat being the longest */
+#define PROC_FILE_LEN 1024
+
+static const char *file_names[N_PROC_FILES] = { "stat", "schedstat" };
+
+void proc_files_init(struct ProcFiles *files) {
+    for (int i = 0; i < N_PROC_FILES; i++) {
+        files->fds[i] = -1;
+    }
+}
+
+int proc_files_open(struct ProcFiles *files, int tgid, int pid) {
+    int n_open = 0;
+    for (int i = 0; i < N_PROC_FILES; i++) {
+        char path[64];
+        if (tgid) {
+            snprintf(path, sizeof(path), "/proc/%d/task/%d/%s", tgid, pid,
+                     file_names[i]);
+        } else {
+            snprintf(path, sizeof(path), "/proc/%d/%s", pid, file_names[i]);
+        }
+        files->fds[i] = open(path, O_RDONLY | O_CLOEXEC);
+        n_open += files->fds[i] >= 0;
+    }
+    return n_open;
+}
+
+static const char *parse_u64(const char *p, unsigned long long *value) {
+    unsigned long long v = 0;
+    while (*p >= '0' && *p <= '9') {
+        v = v * 10 + (*p++ - '0');
+    }
+    *value = v;
+    return p;
+}
+
+/* start of the n-th space separated field after p */
+static const char *skip_fields(const char *p, int n) {
+    while (n-- > 0 && p) {
+        p = strchr(p + 1, ' ');
+    }
+    return p ? p + 1 : NULL;
+}
+
+static int read_file(int fd, char *buf) {
+    ssize_t n = pread(fd, buf, PROC_FILE_LEN - 1, 0);
+    if (n <= 0) {
+        return 1;
+    }
+    buf[n] = '\0';
+    return 0;
+}
+
+/* rss is field 24 of stat and the CPU field 39, after the comm in parens */
+static int parse_stat(const char *buf, struct ProcSupplement *supplement) {
+    static unsigned long long page_size;
+    if (!page_size) {
+        page_size = sysconf(_SC_PAGESIZE);
+    }
+    unsigned long long pages, cpu;
+    const char *p = strrchr(buf, ')');
+    if (!p || !(p = skip_fields(p, 22))) {
+        return 1;
+    }
+    parse_u64(p, &pages);
+    if (!(p = skip_fields(p - 1, 15))) {
+        return 1;
+    }
+    parse_u64(p, &cpu);
+    supplement->rss = pages * page_size;
+    supplement->cpu = cpu;
+    return 0;
+}
+
+/* "<ns on the CPU> <ns waiting on a run queue> <timeslices>" */
+static int parse_schedstat(const char *buf,
+                           struct ProcSupplement *supplement) {
+    const char *p = parse_u64(buf, &supplement->run_time);
+    if (*p != ' ') {
+        return 1;
+    }
+    parse_u64(p + 1, &supplement->wait_time);
+    return 0;
+}
+
+void proc_files_read(const struct ProcFiles *files,
+                     struct ProcSupplement *supplement) {
+    static int (*const parsers[N_PROC_FILES])(const char*,
+                                              struct ProcSupplement*) = {
+        parse_stat, parse_schedstat
+    };
+    char buf[PROC_FILE_LEN];
+    memset(supplement, 0, sizeof(*supplement));
+    for (int i = 0; i < N_PROC_FILES; i++) {
+        if (files->fds[i] >= 0 && !read_file(files->fds[i], buf) &&
+            !parsers[i](buf, supplement)) {
+            supplement->valid |= 1 << i;
+        }
+    }
+}
+
+void proc_files_close(struct ProcFiles *files) {
+    for (int i = 0; i < N_PROC_FILES; i++) {
+        if (files->fds[i] >= 0) {
+            close(files->fds[i]);
+            files->fds[i] = -1;
+        }
+    }
+}
+
+char *proc_supplement_format(const struct ProcSupplement *supplement,
+                             char *p) {
+    const unsigned long long values[] = {
+        supplement->rss, supplement->run_time, supplement->wait_time
+    };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        p = format_u64(p, values[i]);
+        *p++ = '\t';
+    }
+    p = format_int(p, supplement->cpu);
+    *p++ = '\t';
+    return p;
+}
\ No newline at end of file
@@ -0,0 +1,259 @@
+#include "procs.h"
+#include <fcntl.h>
+#include <linux/taskstats.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* room for the part of a command line that is matched */
+#define CMDLINE_LEN 4096
+
+static int compare_pid(const void *a, const void *b) {
+    return ((const struct ProcEntry*)a)->pid -
+           ((const struct ProcEntry*)b)->pid;
+}
+
+static int grow(struct ProcEntry **entries, int *cap) {
+    int n = *cap ? *cap * 2 : 1024;
+    struct ProcEntry *grown = (struct ProcEntry*)realloc(
+        *entries, n * sizeof(struct ProcEntry));
+    if (!grown) {
+        return 1;
+    }
+    *entries = grown;
+    *cap = n;
+    return 0;
+}
+
+/* the pids of /proc into the spare list, sorted */
+static int read_pids(struct ProcScanner *scanner) {
+    int n_found = 0, sorted = 1;
+    struct dirent *entry;
+    rewinddir(scanner->proc_dir);
+    while ((entry = readdir(scanner->proc_dir)) != NULL) {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') {
+            continue;
+        }
+        if (n_found == scanner->spare_cap &&
+            grow(&scanner->spare, &scanner->spare_cap)) {
+            break;
+        }
+        struct ProcEntry *found = &scanner->spare[n_found];
+        memset(found, 0, sizeof(*found));
+        found->pid = atoi(entry->d_name);
+        found->target = -1;
+        sorted &= !n_found || found[-1].pid < found->pid;
+        n_found++;
+    }
+    /* the kernel lists them in order, sorting is the exception */
+    if (!sorted) {
+        qsort(scanner->spare, n_found, sizeof(struct ProcEntry), compare_pid);
+    }
+    return n_found;
+}
+
+/* content of /proc/<pid>/<name>, '\0' terminated, the length or -1 */
+static int read_proc_file(int pid, const char *name, char *buf, size_t len) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, len - 1);
+    close(fd);
+    if (n < 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+/* field 22 of /proc/<pid>/stat, after the comm which may hold spaces */
+static unsigned long long read_start(int pid) {
+    char stat[1024];
+    if (read_proc_file(pid, "stat", stat, sizeof(stat)) < 0) {
+        return 0;
+    }
+    char *p = strrchr(stat, ')');
+    for (int field = 2; p && field < 22; field++) {
+        p = strchr(p + 1, ' ');
+    }
+    return p ? strtoull(p + 1, NULL, 10) : 0;
+}
+
+/* 1 + index of the first pattern the comm or command line matches, or 0 */
+static int match_proc(struct ProcScanner *scanner, int pid) {
+    char comm[64], cmdline[CMDLINE_LEN];
+    int n_comm = read_proc_file(pid, "comm", comm, sizeof(comm));
+    int n_cmdline = read_proc_file(pid, "cmdline", cmdline, sizeof(cmdline));
+    if (n_comm > 0 && comm[n_comm - 1] == '\n') {
+        comm[n_comm - 1] = '\0';
+    }
+    /* the arguments are separated by '\0' */
+    for (int i = 0; i < n_cmdline - 1; i++) {
+        if (cmdline[i] == '\0') {
+            cmdline[i] = ' ';
+        }
+    }
+    for (int i = 0; i < scanner->n_patterns; i++) {
+        if ((n_comm > 0 &&
+             !regexec(&scanner->patterns[i], comm, 0, NULL, 0)) ||
+            (n_cmdline > 0 &&
+             !regexec(&scanner->patterns[i], cmdline, 0, NULL, 0))) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/* makes a target of a process seen for the first few times if it matches */
+static int check_proc(struct ProcScanner *scanner, struct ProcEntry *entry) {
+    int match = 0;
+    entry->start = read_start(entry->pid);
+    if (scanner->n_patterns) {
+        entry->n_checks++;
+        match = entry->pid == getpid() ? 0 : match_proc(scanner, entry->pid);
+        if (!match) {
+            return 0;
+        }
+    }
+    int idx = target_list_add(scanner->targets, TASKSTATS_CMD_ATTR_TGID,
+                              entry->pid);
+    if (idx < 0) {
+        return 0;
+    }
+    struct Target *target = target_list_get(scanner->targets, idx);
+    target->scanned = 1;
+    target->match = match;
+    entry->target = idx;
+    entry->generation = target->generation;
+    scanner->n_added++;
+    return 1;
+}
+
+/* what the previous scan knew about a process still in /proc */
+static int merge_proc(struct ProcScanner *scanner, struct ProcEntry *old,
+                      struct ProcEntry *cur) {
+    if (old->target < 0) {
+        if (read_start(cur->pid) != old->start) {
+            /* the PID was reused, the new process is checked afresh */
+            return check_proc(scanner, cur);
+        }
+        *cur = *old;
+        return cur->n_checks < PROC_MATCH_CHECKS ?
+               check_proc(scanner, cur) : 0;
+    }
+    /*
+     * a retired target with the same start time is a zombie its parent has
+     * not reaped yet, with another one the PID was reused
+     */
+    if (target_is_current(target_list_get(scanner->targets, old->target),
+                          old->generation) ||
+        read_start(cur->pid) == old->start) {
+        *cur = *old;
+        return 0;
+    }
+    return check_proc(scanner, cur);
+}
+
+/* merges the current content of /proc into the sorted list */
+static int scan(struct ProcScanner *scanner) {
+    int n_found = read_pids(scanner);
+    struct ProcEntry *found = scanner->spare;
+    int added = 0;
+    int i = 0, j = 0;
+    while (i < scanner->n_entries || j < n_found) {
+        struct ProcEntry *old = i < scanner->n_entries ?
+                                &scanner->entries[i] : NULL;
+        struct ProcEntry *cur = j < n_found ? &found[j] : NULL;
+        if (old && (!cur || old->pid < cur->pid)) {
+            /* the process has exited since the previous scan */
+            if (old->target >= 0) {
+                struct Target *target = target_list_get(scanner->targets,
+                                                        old->target);
+                /* unless its index went to another process meanwhile */
+                if (target->generation == old->generation) {
+                    __atomic_store_n(&target->alive, 0, __ATOMIC_RELAXED);
+                }
+                scanner->n_gone++;
+            }
+            i++;
+            continue;
+        }
+        if (old && old->pid == cur->pid) {
+            added += merge_proc(scanner, old, cur);
+            i++;
+        } else {
+            added += check_proc(scanner, cur);
+        }
+        j++;
+    }
+
+    /* the list of this scan is the one to merge with next time */
+    scanner->spare = scanner->entries;
+    scanner->entries = found;
+    int cap = scanner->spare_cap;
+    scanner->spare_cap = scanner->entries_cap;
+    scanner->entries_cap = cap;
+    scanner->n_entries = n_found;
+    return added;
+}
+
+int proc_scanner_init(struct ProcScanner *scanner, struct TargetList *targets,
+                      time_t interval) {
+    memset(scanner, 0, sizeof(*scanner));
+    scanner->targets = targets;
+    scanner->interval = interval;
+    scanner->requested = 1;
+    scanner->proc_dir = opendir("/proc");
+    if (!scanner->proc_dir) {
+        perror("Unable to list /proc");
+        return 1;
+    }
+    return 0;
+}
+
+int proc_scanner_add_match(struct ProcScanner *scanner, const char *pattern) {
+    if (scanner->n_patterns == PROC_MAX_MATCHES) {
+        fprintf(stderr, "Too many patterns, at most %d\n", PROC_MAX_MATCHES);
+        return 1;
+    }
+    regex_t *regex = &scanner->patterns[scanner->n_patterns];
+    int ret = regcomp(regex, pattern, REG_EXTENDED | REG_NOSUB);
+    if (ret) {
+        char error[128];
+        regerror(ret, regex, error, sizeof(error));
+        fprintf(stderr, "Unable to compile the pattern %s: %s\n", pattern,
+                error);
+        return 1;
+    }
+    scanner->n_patterns++;
+    return 0;
+}
+
+int proc_scanner_poll(struct ProcScanner *scanner, time_t now) {
+    if (!scanner->requested && now < scanner->next_scan) {
+        return 0;
+    }
+    int added = scan(scanner);
+    scanner->requested = 0;
+    scanner->next_scan = now + scanner->interval;
+    return added;
+}
+
+void proc_scanner_free(struct ProcScanner *scanner) {
+    if (scanner->proc_dir) {
+        closedir(scanner->proc_dir);
+        scanner->proc_dir = NULL;
+    }
+    for (int i = 0; i < scanner->n_patterns; i++) {
+        regfree(&scanner->patterns[i]);
+    }
+    scanner->n_patterns = 0;
+    free(scanner->entries);
+    free(scanner->spare);
+    scanner->entries = scanner->spare = NULL;
+    scanner->n_entries = scanner->entries_cap = scanner->spare_cap = 0;
+}
\ No newline at end of file
@@ -1,35 +1,174 @@
 #include "queue.h"
+#include <limits.h>
+#include <linux/futex.h>
+#include <stddef.h>
 #include <stdlib.h>
-#define SIZE 1000
-#define NEXT_IDX(i) ((i+1)%SIZE)
-
-void concurrent_queue_init(struct ConcurrentQueue * const q) {
-    q->taskstats = (struct TaskStatistics**)malloc(
-        SIZE * sizeof(struct TaskStatistics*));
-    q->front = 0;
-    q->tail = 0;
-}
-
-void concurrent_queue_push(struct ConcurrentQueue * const q, 
-                           struct TaskStatistics* taskstat) {
-    pthread_mutex_lock(&q->lock);
-    if (NEXT_IDX(q->tail) == q->front) {
-        pthread_cond_wait(&q->space_cond, &q->lock);
-    }
-    q->taskstats[q->tail] = taskstat;
-    q->tail = NEXT_IDX(q->tail);
-    pthread_cond_broadcast(&q->data_cond);
-    pthread_mutex_unlock(&q->lock);
-}
-
-struct TaskStatistics* concurrent_queue_pop(struct ConcurrentQueue * const q) {
-    pthread_mutex_lock(&q->lock);
-    if (q->front == q->tail) {
-        pthread_cond_wait(&q->data_cond, &q->lock);
-    }
-    struct TaskStatistics* taskstat = q->taskstats[q->front];
-    q->front = NEXT_IDX(q->front);
-    pthread_cond_broadcast(&q->space_cond);
-    pthread_mutex_unlock(&q->lock);
-    return taskstat;
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "utils.h"
+
+#define load_acquire(p)      __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define load_relaxed(p)      __atomic_load_n(p, __ATOMIC_RELAXED)
+#define store_release(p, v)  __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define cas(p, expected, desired) \
+    __atomic_compare_exchange_n(p, expected, desired, 0, \
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)
+
+static void futex_wait(int *addr, int val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(int *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* wake whoever sleeps on flag, the caller has just made progress visible */
+static void wake_waiters(int *flag) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (load_relaxed(flag)) {
+        __atomic_store_n(flag, 0, __ATOMIC_RELAXED);
+        futex_wake(flag);
+    }
+}
+
+int concurrent_queue_init(struct ConcurrentQueue * const q,
+                          unsigned long capacity,
+                          enum QueueFullPolicy policy) {
+    memset(q, 0, sizeof(*q));
+    q->capacity = 2;
+    while (q->capacity < capacity) {
+        q->capacity <<= 1;
+    }
+    q->mask = q->capacity - 1;
+    q->policy = policy;
+    q->slots = (struct QueueSlot*)aligned_alloc(
+        CACHE_LINE_SIZE, q->capacity * sizeof(struct QueueSlot));
+    if (!q->slots) {
+        return 1;
+    }
+    for (unsigned long i = 0; i < q->capacity; i++) {
+        q->slots[i].seq = i;
+    }
+    return 0;
+}
+
+void concurrent_queue_destroy(struct ConcurrentQueue * const q) {
+    free(q->slots);
+    q->slots = NULL;
+}
+
+/* throw away the record at the head, fails if it is not ready yet */
+static int discard_oldest(struct ConcurrentQueue * const q) {
+    unsigned long pos = load_relaxed(&q->head);
+    struct QueueSlot *slot = &q->slots[pos & q->mask];
+    if (load_acquire(&slot->seq) != pos + 1 || !cas(&q->head, &pos, pos + 1)) {
+        return 0;
+    }
+    store_release(&slot->seq, pos + q->capacity);
+    __atomic_add_fetch(&q->n_dropped, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+static void wait_for_space(struct ConcurrentQueue * const q,
+                           struct QueueSlot *slot, unsigned long pos) {
+    __atomic_store_n(&q->producer_waiting, 1, __ATOMIC_SEQ_CST);
+    /* the consumer may have freed the slot before it saw the flag */
+    if ((long)(__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) - pos) < 0) {
+        futex_wait(&q->producer_waiting, 1);
+    }
+}
+
+struct TaskStatistics* concurrent_queue_claim(struct ConcurrentQueue * const q) {
+    unsigned long pos = load_relaxed(&q->tail);
+    while (1) {
+        struct QueueSlot *slot = &q->slots[pos & q->mask];
+        long diff = (long)(load_acquire(&slot->seq) - pos);
+        if (diff == 0) {
+            if (cas(&q->tail, &pos, pos + 1)) {
+                slot->pos = pos;
+                return &slot->stats;
+            }
+            continue;
+        }
+        if (diff < 0) {
+            switch (q->policy) {
+                case QUEUE_FULL_DROP_NEWEST:
+                    __atomic_add_fetch(&q->n_dropped, 1, __ATOMIC_RELAXED);
+                    return NULL;
+                case QUEUE_FULL_DROP_OLDEST:
+                    /* if the consumer is copying the oldest slot, spin */
+                    if (!discard_oldest(q)) {
+                        cpu_relax();
+                    }
+                    break;
+                case QUEUE_FULL_BLOCK:
+                default:
+                    wait_for_space(q, slot, pos);
+                    break;
+            }
+        }
+        pos = load_relaxed(&q->tail);
+    }
+}
+
+void concurrent_queue_publish(struct ConcurrentQueue * const q,
+                              struct TaskStatistics* taskstat) {
+    struct QueueSlot *slot = (struct QueueSlot*)(
+        (char*)taskstat - offsetof(struct QueueSlot, stats));
+    store_release(&slot->seq, slot->pos + 1);
+    wake_waiters(&q->consumer_waiting);
+}
+
+void concurrent_queue_push(struct ConcurrentQueue * const q,
+                           const struct TaskStatistics* taskstat) {
+    struct TaskStatistics* slot = concurrent_queue_claim(q);
+    if (slot) {
+        memcpy(slot, taskstat, sizeof(*slot));
+        concurrent_queue_publish(q, slot);
+    }
+}
+
+static int queue_ready(struct ConcurrentQueue * const q) {
+    unsigned long pos = __atomic_load_n(&q->head, __ATOMIC_SEQ_CST);
+    struct QueueSlot *slot = &q->slots[pos & q->mask];
+    return (long)(__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) - pos) > 0;
+}
+
+int concurrent_queue_pop_batch(struct ConcurrentQueue * const q,
+                               struct TaskStatistics* out, int max) {
+    while (1) {
+        int closed = load_acquire(&q->closed);
+        int n = 0;
+        while (n < max) {
+            unsigned long pos = load_relaxed(&q->head);
+            struct QueueSlot *slot = &q->slots[pos & q->mask];
+            long diff = (long)(load_acquire(&slot->seq) - (pos + 1));
+            if (diff < 0) {
+                break;
+            }
+            if (diff == 0 && cas(&q->head, &pos, pos + 1)) {
+                memcpy(&out[n++], &slot->stats, sizeof(slot->stats));
+                store_release(&slot->seq, pos + q->capacity);
+            }
+        }
+        if (n) {
+            wake_waiters(&q->producer_waiting);
+            return n;
+        }
+        if (closed) {
+            return 0;
+        }
+
+        __atomic_store_n(&q->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+        if (!queue_ready(q) && !__atomic_load_n(&q->closed, __ATOMIC_SEQ_CST)) {
+            futex_wait(&q->consumer_waiting, 1);
+        }
+    }
+}
+
+void concurrent_queue_close(struct ConcurrentQueue * const q) {
+    __atomic_store_n(&q->closed, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&q->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+    futex_wake(&q->consumer_waiting);
 }
\ No newline at end of file
@@ -0,0 +1,158 @@
+#include "rates.h"
+#include <stdlib.h>
+#include <string.h>
+#include "format.h"
+
+const char task_rates_columns[] =
+    "timestamp\tpid\tcomm\tinterval_ms\tcpu_pct\tuser_pct\tsystem_pct\t"
+    "read_bytes_s\twrite_bytes_s\tread_syscalls_s\twrite_syscalls_s\t"
+    "cpu_delay_ms_s\tblkio_delay_ms_s\tswapin_delay_ms_s\t"
+    "freepages_delay_ms_s\tminflt_s\tmajflt_s\tnvcsw_s\tnivcsw_s";
+const char task_rates_proc_columns[] =
+    "\trss_mb\trun_queue_wait_ms_s\tlast_cpu";
+
+static struct RateState* get_state(struct RateTracker *tracker, int target) {
+    if (target >= tracker->n_states) {
+        int n = tracker->n_states ? tracker->n_states : 16;
+        while (n <= target) {
+            n *= 2;
+        }
+        struct RateState *grown = (struct RateState*)realloc(
+            tracker->states, n * sizeof(struct RateState));
+        if (!grown) {
+            return NULL;
+        }
+        memset(grown + tracker->n_states, 0,
+               (n - tracker->n_states) * sizeof(*grown));
+        tracker->states = grown;
+        tracker->n_states = n;
+    }
+    return &tracker->states[target];
+}
+
+/* a counter that went back, e.g. for a TGID losing a thread, has rate 0 */
+static unsigned long long increase(unsigned long long now,
+                                   unsigned long long before) {
+    return now > before ? now - before : 0;
+}
+
+void rate_tracker_init(struct RateTracker *tracker) {
+    memset(tracker, 0, sizeof(*tracker));
+}
+
+int rate_tracker_update(struct RateTracker *tracker,
+                        const struct TaskStatistics *stats,
+                        struct TaskRates *rates) {
+    struct RateState *state = get_state(tracker, stats->target);
+    if (!state) {
+        return -1;
+    }
+    const struct taskstats *s = &stats->stats;
+    const struct taskstats *p = &state->stats;
+    int pid = stats->pid ? stats->pid : stats->tgid;
+    int ready = state->timestamp && stats->timestamp > state->timestamp;
+    /*
+     * a reused target index shows as another generation, a reused PID as a
+     * different begin time, or within the same second as an elapsed time
+     * going back. TGID aggregates have neither, their elapsed time sums the
+     * live threads and drops when one exits, so only another PID behind the
+     * target restarts them
+     */
+    if (ready && (stats->generation != state->generation ||
+                  pid != state->pid ||
+                  (stats->pid && (s->ac_btime != p->ac_btime ||
+                                  s->ac_etime < p->ac_etime)))) {
+        tracker->n_resets++;
+        ready = 0;
+    }
+    if (ready) {
+        time_t interval = stats->timestamp - state->timestamp;
+        double per_second = 1e9 / interval;
+        /* times are in usec, delays in ns */
+        double percent = 1e5 / interval;
+        double ms_per_second = 1e3 / interval;
+        unsigned long long user = increase(s->ac_utime, p->ac_utime);
+        unsigned long long system = increase(s->ac_stime, p->ac_stime);
+
+        rates->target = stats->target;
+        rates->pid = pid;
+        rates->timestamp = stats->timestamp;
+        rates->interval = interval;
+        memcpy(rates->comm, s->ac_comm, sizeof(rates->comm));
+        rates->comm[sizeof(rates->comm) - 1] = '\0';
+        rates->user = user * percent;
+        rates->system = system * percent;
+        rates->cpu = (user + system) * percent;
+        rates->read_bytes = increase(s->read_char, p->read_char) * per_second;
+        rates->write_bytes =
+            increase(s->write_char, p->write_char) * per_second;
+        rates->read_syscalls =
+            increase(s->read_syscalls, p->read_syscalls) * per_second;
+        rates->write_syscalls =
+            increase(s->write_syscalls, p->write_syscalls) * per_second;
+        rates->cpu_delay = increase(s->cpu_delay_total, p->cpu_delay_total) *
+                           ms_per_second;
+        rates->blkio_delay =
+            increase(s->blkio_delay_total, p->blkio_delay_total) *
+            ms_per_second;
+        rates->swapin_delay =
+            increase(s->swapin_delay_total, p->swapin_delay_total) *
+            ms_per_second;
+        rates->freepages_delay =
+            increase(s->freepages_delay_total, p->freepages_delay_total) *
+            ms_per_second;
+        rates->minflt = increase(s->ac_minflt, p->ac_minflt) * per_second;
+        rates->majflt = increase(s->ac_majflt, p->ac_majflt) * per_second;
+        rates->nvcsw = increase(s->nvcsw, p->nvcsw) * per_second;
+        rates->nivcsw = increase(s->nivcsw, p->nivcsw) * per_second;
+        rates->rss = stats->proc.rss / 1048576.;
+        rates->run_queue_wait =
+            increase(stats->proc.wait_time, state->proc.wait_time) *
+            ms_per_second;
+        rates->last_cpu = stats->proc.cpu;
+    }
+    state->timestamp = stats->timestamp;
+    state->pid = pid;
+    state->generation = stats->generation;
+    state->stats = *s;
+    state->proc = stats->proc;
+    return ready;
+}
+
+void rate_tracker_free(struct RateTracker *tracker) {
+    free(tracker->states);
+    tracker->states = NULL;
+    tracker->n_states = 0;
+}
+
+char* task_rates_format(const struct TaskRates *rates, char *p) {
+    const double values[] = {
+        rates->interval / 1e6,
+        rates->cpu, rates->user, rates->system,
+        rates->read_bytes, rates->write_bytes,
+        rates->read_syscalls, rates->write_syscalls,
+        rates->cpu_delay, rates->blkio_delay, rates->swapin_delay,
+        rates->freepages_delay,
+        rates->minflt, rates->majflt,
+        rates->nvcsw, rates->nivcsw
+    };
+    p = format_u64(p, rates->timestamp);
+    *p++ = '\t';
+    p = format_int(p, rates->pid);
+    *p++ = '\t';
+    p = format_str(p, rates->comm);
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        *p++ = '\t';
+        p = format_fixed3(p, values[i], 0);
+    }
+    return p;
+}
+
+char* task_rates_format_proc(const struct TaskRates *rates, char *p) {
+    *p++ = '\t';
+    p = format_fixed3(p, rates->rss, 0);
+    *p++ = '\t';
+    p = format_fixed3(p, rates->run_queue_wait, 0);
+    *p++ = '\t';
+    return format_int(p, rates->last_cpu);
+}
\ No newline at end of file
@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+#include "rawnl.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <linux/taskstats.h>
+#include "target.h"
+
+static void init_template(struct RawRequest *request, int family_id,
+                          int cmd, int attr_type) {
+    memset(request, 0, sizeof(*request));
+    request->header.nlmsg_len = sizeof(*request);
+    request->header.nlmsg_type = family_id;
+    request->header.nlmsg_flags = NLM_F_REQUEST;
+    request->genl.cmd = cmd;
+    request->genl.version = TASKSTATS_VERSION;
+    request->attr.nla_len = NLA_HDRLEN + sizeof(__u32);
+    request->attr.nla_type = attr_type;
+}
+
+static int template_index(int command_type) {
+    switch (command_type) {
+        case TASKSTATS_CMD_ATTR_PID:
+            return 0;
+        case TASKSTATS_CMD_ATTR_TGID:
+            return 1;
+        default:
+            return 2;
+    }
+}
+
+/* CTRL_CMD_GETFAMILY on the still blocking socket */
+static int resolve_family(int fd, const char *name) {
+    struct {
+        struct nlmsghdr header;
+        struct genlmsghdr genl;
+        struct nlattr attr;
+        char name[GENL_NAMSIZ];
+    } request;
+    memset(&request, 0, sizeof(request));
+    size_t name_len = strlen(name) + 1;
+    request.header.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN + NLA_HDRLEN +
+                                            name_len);
+    request.header.nlmsg_type = GENL_ID_CTRL;
+    request.header.nlmsg_flags = NLM_F_REQUEST;
+    request.header.nlmsg_seq = 1;
+    request.genl.cmd = CTRL_CMD_GETFAMILY;
+    request.genl.version = 1;
+    request.attr.nla_len = NLA_HDRLEN + name_len;
+    request.attr.nla_type = CTRL_ATTR_FAMILY_NAME;
+    memcpy(request.name, name, name_len);
+    if (send(fd, &request, request.header.nlmsg_len, 0) < 0) {
+        return -errno;
+    }
+
+    char reply[RAW_NETLINK_RECV_SIZE];
+    int len = recv(fd, reply, sizeof(reply), 0);
+    if (len < 0) {
+        return -errno;
+    }
+    struct nlmsghdr *hdr = (struct nlmsghdr*)reply;
+    for (; NLMSG_OK(hdr, len); hdr = NLMSG_NEXT(hdr, len)) {
+        if (hdr->nlmsg_type == NLMSG_ERROR) {
+            return ((struct nlmsgerr*)NLMSG_DATA(hdr))->error;
+        }
+        struct nlattr *attr = (struct nlattr*)((char*)NLMSG_DATA(hdr) +
+                                               GENL_HDRLEN);
+        int remaining = hdr->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+        while (remaining >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN &&
+               attr->nla_len <= remaining) {
+            if ((attr->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_FAMILY_ID) {
+                return *(__u16*)((char*)attr + NLA_HDRLEN);
+            }
+            remaining -= NLA_ALIGN(attr->nla_len);
+            attr = (struct nlattr*)((char*)attr + NLA_ALIGN(attr->nla_len));
+        }
+    }
+    return -ENOENT;
+}
+
+int raw_netlink_init(struct RawNetlink *raw, int rcvbuf, int sndbuf) {
+    memset(raw, 0, sizeof(*raw));
+    raw->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if (raw->fd < 0) {
+        perror("Unable to open netlink socket (are you root?)");
+        return 1;
+    }
+    struct sockaddr_nl address;
+    memset(&address, 0, sizeof(address));
+    address.nl_family = AF_NETLINK;
+    if (bind(raw->fd, (struct sockaddr*)&address, sizeof(address))) {
+        perror("Unable to bind netlink socket");
+        goto error;
+    }
+    setsockopt(raw->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    setsockopt(raw->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    raw->family_id = resolve_family(raw->fd, TASKSTATS_GENL_NAME);
+    if (raw->family_id < 0) {
+        fprintf(stderr, "Unable to determine taskstats family id (does your "
+                "kernel support taskstats?): %s\n", strerror(-raw->family_id));
+        goto error;
+    }
+    if (fcntl(raw->fd, F_SETFL, fcntl(raw->fd, F_GETFL) | O_NONBLOCK)) {
+        perror("Unable to make netlink socket non-blocking");
+        goto error;
+    }
+    init_template(&raw->templates[0], raw->family_id, TASKSTATS_CMD_GET,
+                  TASKSTATS_CMD_ATTR_PID);
+    init_template(&raw->templates[1], raw->family_id, TASKSTATS_CMD_GET,
+                  TASKSTATS_CMD_ATTR_TGID);
+    init_template(&raw->templates[2], raw->family_id, CGROUPSTATS_CMD_GET,
+                  CGROUPSTATS_CMD_ATTR_FD);
+
+    raw->buffers = (char*)malloc(RAW_NETLINK_RECV_BATCH *
+                                 RAW_NETLINK_RECV_SIZE);
+    raw->messages = (struct mmsghdr*)calloc(RAW_NETLINK_RECV_BATCH,
+                                            sizeof(struct mmsghdr));
+    raw->iovecs = (struct iovec*)calloc(RAW_NETLINK_RECV_BATCH,
+                                        sizeof(struct iovec));
+    if (!raw->buffers || !raw->messages || !raw->iovecs) {
+        fprintf(stderr, "Unable to allocate netlink receive buffers\n");
+        goto error;
+    }
+    for (int i = 0; i < RAW_NETLINK_RECV_BATCH; i++) {
+        raw->iovecs[i].iov_base = raw->buffers + i * RAW_NETLINK_RECV_SIZE;
+        raw->iovecs[i].iov_len = RAW_NETLINK_RECV_SIZE;
+        raw->messages[i].msg_hdr.msg_iov = &raw->iovecs[i];
+        raw->messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    return 0;
+
+error:
+    raw_netlink_destroy(raw);
+    return 1;
+}
+
+void raw_netlink_put_query(const struct RawNetlink *raw, char *p,
+                           int command_type, int value, unsigned int seq) {
+    struct RawRequest *request = (struct RawRequest*)p;
+    *request = raw->templates[template_index(command_type)];
+    request->header.nlmsg_seq = seq;
+    request->value = value;
+}
+
+int raw_netlink_send(struct RawNetlink *raw, const char *data, size_t len,
+                     size_t datagram_len) {
+    struct mmsghdr messages[RAW_NETLINK_SEND_BATCH];
+    struct iovec iovecs[RAW_NETLINK_SEND_BATCH];
+    /* datagrams end on query boundaries */
+    datagram_len -= datagram_len % RAW_REQUEST_LEN;
+    while (len) {
+        int n = 0;
+        memset(messages, 0, sizeof(messages));
+        for (; n < RAW_NETLINK_SEND_BATCH && len; n++) {
+            size_t chunk = len < datagram_len ? len : datagram_len;
+            iovecs[n].iov_base = (void*)data;
+            iovecs[n].iov_len = chunk;
+            messages[n].msg_hdr.msg_iov = &iovecs[n];
+            messages[n].msg_hdr.msg_iovlen = 1;
+            data += chunk;
+            len -= chunk;
+        }
+        for (int sent = 0; sent < n; ) {
+            int ret = sendmmsg(raw->fd, messages + sent, n - sent, 0);
+            raw->n_send_calls++;
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -errno;
+            }
+            sent += ret;
+        }
+    }
+    return 0;
+}
+
+int raw_netlink_receive(struct RawNetlink *raw) {
+    for (int i = 0; i < RAW_NETLINK_RECV_BATCH; i++) {
+        raw->messages[i].msg_hdr.msg_flags = 0;
+    }
+    int n;
+    do {
+        n = recvmmsg(raw->fd, raw->messages, RAW_NETLINK_RECV_BATCH,
+                     MSG_DONTWAIT, NULL);
+    } while (n < 0 && errno == EINTR);
+    raw->n_receive_calls++;
+    if (n < 0) {
+        if (errno == EAGAIN) {
+            return 0;
+        }
+        if (errno == ENOBUFS) {
+            /* replies were dropped, their queries end up lost */
+            return 0;
+        }
+        perror("Failed to receive message");
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        if (raw->messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            /* never decoded, the query ends up lost */
+            raw->messages[i].msg_len = 0;
+            raw->n_truncated++;
+        }
+    }
+    return n;
+}
+
+struct nlmsghdr* raw_netlink_datagram(const struct RawNetlink *raw, int i,
+                                      int *len) {
+    *len = raw->messages[i].msg_len;
+    return (struct nlmsghdr*)raw->iovecs[i].iov_base;
+}
+
+void raw_netlink_destroy(struct RawNetlink *raw) {
+    if (raw->fd >= 0) {
+        close(raw->fd);
+        raw->fd = -1;
+    }
+    free(raw->buffers);
+    raw->buffers = NULL;
+    free(raw->messages);
+    raw->messages = NULL;
+    free(raw->iovecs);
+    raw->iovecs = NULL;
+}
\ No newline at end of file
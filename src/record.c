@@ -0,0 +1,281 @@
+#include "record.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FIELD(name, type) \
+    { #name, offsetof(struct TaskStatistics, name), \
+      sizeof(((struct TaskStatistics*)0)->name), type }
+#define STAT(name, type) \
+    { #name, offsetof(struct TaskStatistics, stats.name), \
+      sizeof(((struct taskstats*)0)->name), type }
+#define CGROUP(name) \
+    { #name, offsetof(struct TaskStatistics, cgroup.name), \
+      sizeof(((struct cgroupstats*)0)->name), RECORD_FIELD_UINT }
+#define PROC(name, type) \
+    { "proc_" #name, offsetof(struct TaskStatistics, proc.name), \
+      sizeof(((struct ProcSupplement*)0)->name), type }
+
+const struct RecordField record_fields[] = {
+    FIELD(timestamp, RECORD_FIELD_INT),
+    FIELD(target, RECORD_FIELD_INT),
+    FIELD(pid, RECORD_FIELD_INT),
+    FIELD(tgid, RECORD_FIELD_INT),
+    FIELD(tick, RECORD_FIELD_UINT),
+    FIELD(match, RECORD_FIELD_INT),
+    FIELD(generation, RECORD_FIELD_UINT),
+
+    /* 1) Common and basic accounting fields */
+    STAT(version, RECORD_FIELD_UINT),
+    STAT(ac_exitcode, RECORD_FIELD_UINT),
+    STAT(ac_flag, RECORD_FIELD_UINT),
+    STAT(ac_nice, RECORD_FIELD_UINT),
+    STAT(ac_comm, RECORD_FIELD_STR),
+    STAT(ac_sched, RECORD_FIELD_UINT),
+    STAT(ac_uid, RECORD_FIELD_UINT),
+    STAT(ac_gid, RECORD_FIELD_UINT),
+    STAT(ac_pid, RECORD_FIELD_UINT),
+    STAT(ac_ppid, RECORD_FIELD_UINT),
+    STAT(ac_btime, RECORD_FIELD_UINT),
+    STAT(ac_etime, RECORD_FIELD_UINT),
+    STAT(ac_utime, RECORD_FIELD_UINT),
+    STAT(ac_stime, RECORD_FIELD_UINT),
+    STAT(ac_minflt, RECORD_FIELD_UINT),
+    STAT(ac_majflt, RECORD_FIELD_UINT),
+
+    /* 2) Delay accounting fields */
+    STAT(cpu_count, RECORD_FIELD_UINT),
+    STAT(cpu_delay_total, RECORD_FIELD_UINT),
+    STAT(blkio_count, RECORD_FIELD_UINT),
+    STAT(blkio_delay_total, RECORD_FIELD_UINT),
+    STAT(swapin_count, RECORD_FIELD_UINT),
+    STAT(swapin_delay_total, RECORD_FIELD_UINT),
+    STAT(cpu_run_real_total, RECORD_FIELD_UINT),
+    STAT(cpu_run_virtual_total, RECORD_FIELD_UINT),
+
+    /* 3) Extended accounting fields */
+    STAT(coremem, RECORD_FIELD_UINT),
+    STAT(virtmem, RECORD_FIELD_UINT),
+    STAT(hiwater_rss, RECORD_FIELD_UINT),
+    STAT(hiwater_vm, RECORD_FIELD_UINT),
+    STAT(read_char, RECORD_FIELD_UINT),
+    STAT(write_char, RECORD_FIELD_UINT),
+    STAT(read_syscalls, RECORD_FIELD_UINT),
+    STAT(write_syscalls, RECORD_FIELD_UINT),
+    STAT(read_bytes, RECORD_FIELD_UINT),
+    STAT(write_bytes, RECORD_FIELD_UINT),
+    STAT(cancelled_write_bytes, RECORD_FIELD_UINT),
+
+    /* 4) Per-task and per-thread statistics */
+    STAT(nvcsw, RECORD_FIELD_UINT),
+    STAT(nivcsw, RECORD_FIELD_UINT),
+
+    /* 5) Time accounting for SMT machines */
+    STAT(ac_utimescaled, RECORD_FIELD_UINT),
+    STAT(ac_stimescaled, RECORD_FIELD_UINT),
+    STAT(cpu_scaled_run_real_total, RECORD_FIELD_UINT),
+
+    /* 6) Extended delay accounting fields for memory reclaim */
+    STAT(freepages_count, RECORD_FIELD_UINT),
+    STAT(freepages_delay_total, RECORD_FIELD_UINT),
+#if TASKSTATS_VERSION > 8
+    STAT(thrashing_count, RECORD_FIELD_UINT),
+    STAT(thrashing_delay_total, RECORD_FIELD_UINT),
+#endif
+#if TASKSTATS_VERSION > 9
+    STAT(ac_btime64, RECORD_FIELD_UINT),
+#endif
+#if TASKSTATS_VERSION > 10
+    STAT(compact_count, RECORD_FIELD_UINT),
+    STAT(compact_delay_total, RECORD_FIELD_UINT),
+#endif
+#if TASKSTATS_VERSION > 11
+    STAT(ac_tgid, RECORD_FIELD_UINT),
+    STAT(ac_tgetime, RECORD_FIELD_UINT),
+    STAT(ac_exe_dev, RECORD_FIELD_UINT),
+    STAT(ac_exe_inode, RECORD_FIELD_UINT),
+#endif
+#if TASKSTATS_VERSION > 12
+    STAT(wpcopy_count, RECORD_FIELD_UINT),
+    STAT(wpcopy_delay_total, RECORD_FIELD_UINT),
+#endif
+#if TASKSTATS_VERSION > 13
+#error "record_fields does not cover this struct taskstats, add its fields"
+#endif
+
+    /* task states of cgroup targets */
+    CGROUP(nr_sleeping),
+    CGROUP(nr_running),
+    CGROUP(nr_stopped),
+    CGROUP(nr_uninterruptible),
+    CGROUP(nr_io_wait),
+
+    /* /proc files of --proc-stats, proc_valid tells which were read */
+    PROC(rss, RECORD_FIELD_UINT),
+    PROC(run_time, RECORD_FIELD_UINT),
+    PROC(wait_time, RECORD_FIELD_UINT),
+    PROC(cpu, RECORD_FIELD_INT),
+    PROC(valid, RECORD_FIELD_INT),
+};
+#undef FIELD
+#undef STAT
+#undef CGROUP
+#undef PROC
+
+const int record_n_fields = sizeof(record_fields) / sizeof(record_fields[0]);
+
+static size_t header_size(int n_targets) {
+    size_t size = sizeof(struct RecordFileHeader) +
+                  record_n_fields * sizeof(struct RecordField) +
+                  n_targets * sizeof(struct RecordTarget);
+    return (size + RECORD_ALIGN - 1) / RECORD_ALIGN * RECORD_ALIGN;
+}
+
+int record_write_header(FILE *file, const struct TargetList *targets,
+                        enum RecordEncoding encoding) {
+    struct RecordFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+    header.format_version = RECORD_FORMAT_VERSION;
+    header.taskstats_version = TASKSTATS_VERSION;
+    header.header_size = header_size(targets->n_targets);
+    header.record_size = sizeof(struct TaskStatistics);
+    header.n_fields = record_n_fields;
+    header.n_targets = targets->n_targets;
+    header.encoding = encoding;
+
+    size_t written = 0;
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(record_fields, sizeof(struct RecordField), record_n_fields,
+               file) != (size_t)record_n_fields) {
+        return 1;
+    }
+    written += sizeof(header) + record_n_fields * sizeof(struct RecordField);
+    for (int i = 0; i < targets->n_targets; i++) {
+        const struct Target *target = target_list_get(targets, i);
+        struct RecordTarget entry = {
+            .command_type = target->command_type,
+            .pid = target->pid
+        };
+        if (fwrite(&entry, sizeof(entry), 1, file) != 1) {
+            return 1;
+        }
+        written += sizeof(entry);
+    }
+    static const char padding[RECORD_ALIGN];
+    return fwrite(padding, 1, header.header_size - written, file) !=
+           header.header_size - written;
+}
+
+int record_write(FILE *file, const struct TaskStatistics *stats) {
+    return fwrite(stats, sizeof(*stats), 1, file) != 1;
+}
+
+/* every field lies within a record, with a size its type can be read in */
+static int check_fields(const struct RecordFileHeader *header,
+                        const struct RecordField *fields) {
+    for (uint32_t i = 0; i < header->n_fields; i++) {
+        const struct RecordField *field = &fields[i];
+        if (field->size == 0 ||
+            (size_t)field->offset + field->size > header->record_size) {
+            return 1;
+        }
+        if (field->type == RECORD_FIELD_STR) {
+            continue;
+        }
+        if ((field->type != RECORD_FIELD_UINT &&
+             field->type != RECORD_FIELD_INT) ||
+            (field->size != 1 && field->size != 2 && field->size != 4 &&
+             field->size != 8)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int record_reader_open(struct RecordReader *reader, const char *path) {
+    memset(reader, 0, sizeof(*reader));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(struct RecordFileHeader)) {
+        close(fd);
+        return 1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 1;
+    }
+    reader->map = map;
+    reader->map_size = st.st_size;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    const struct RecordFileHeader *header =
+        (const struct RecordFileHeader*)map;
+    size_t tables = sizeof(*header) +
+                    header->n_fields * sizeof(struct RecordField) +
+                    header->n_targets * sizeof(struct RecordTarget);
+    if (memcmp(header->magic, RECORD_MAGIC, sizeof(header->magic)) ||
+        header->format_version != RECORD_FORMAT_VERSION ||
+        header->record_size == 0 || header->header_size < tables ||
+        header->header_size > reader->map_size ||
+        check_fields(header, (const struct RecordField*)(header + 1))) {
+        record_reader_close(reader);
+        return 1;
+    }
+    reader->header = header;
+    reader->fields = (const struct RecordField*)(header + 1);
+    reader->targets = (const struct RecordTarget*)(
+        reader->fields + header->n_fields);
+    reader->records = (const char*)map + header->header_size;
+    reader->data_size = reader->map_size - header->header_size;
+    /* a capture cut short by a crash may end with a partial record */
+    if (header->encoding == RECORD_ENCODING_RAW) {
+        reader->n_records = reader->data_size / header->record_size;
+    }
+    return 0;
+}
+
+void record_reader_close(struct RecordReader *reader) {
+    if (reader->map) {
+        munmap(reader->map, reader->map_size);
+    }
+    memset(reader, 0, sizeof(*reader));
+}
+
+const struct RecordField* record_reader_field(const struct RecordReader *reader,
+                                              const char *name) {
+    for (uint32_t i = 0; i < reader->header->n_fields; i++) {
+        if (!strncmp(reader->fields[i].name, name, RECORD_FIELD_NAME_LEN)) {
+            return &reader->fields[i];
+        }
+    }
+    return NULL;
+}
+
+uint64_t record_field_uint(const struct RecordField *field, const void *record) {
+    const char *p = (const char*)record + field->offset;
+    switch (field->size) {
+        case 1: return *(const uint8_t*)p;
+        case 2: { uint16_t v; memcpy(&v, p, 2); return v; }
+        case 4: { uint32_t v; memcpy(&v, p, 4); return v; }
+        case 8: { uint64_t v; memcpy(&v, p, 8); return v; }
+        default: return 0;
+    }
+}
+
+int64_t record_field_int(const struct RecordField *field, const void *record) {
+    const char *p = (const char*)record + field->offset;
+    switch (field->size) {
+        case 1: return *(const int8_t*)p;
+        case 2: { int16_t v; memcpy(&v, p, 2); return v; }
+        case 4: { int32_t v; memcpy(&v, p, 4); return v; }
+        case 8: { int64_t v; memcpy(&v, p, 8); return v; }
+        default: return 0;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,101 @@
+#include "shm.h"
+#include <errno.h>
+#include <stdlib.h>
+
+int shm_export_init(struct ShmExport *shm, const char *name, time_t period) {
+    memset(shm, 0, sizeof(*shm));
+    if (name[0] == '/') {
+        name++;
+    }
+    char *path = (char*)malloc(strlen(name) + 2);
+    if (!path) {
+        return 1;
+    }
+    sprintf(path, "/%s", name);
+    int fd = shm_open(path, O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to create the shared memory %s: %s\n",
+                path, strerror(errno));
+        free(path);
+        return 1;
+    }
+    /* from here on the segment is ours to unlink */
+    shm->name = path;
+    shm->size = sizeof(struct ShmHeader) + SHM_SLOTS * sizeof(struct ShmSlot);
+    if (ftruncate(fd, shm->size)) {
+        fprintf(stderr, "Unable to size the shared memory %s: %s\n",
+                shm->name, strerror(errno));
+        close(fd);
+        goto error;
+    }
+    shm->map = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                    0);
+    close(fd);
+    if (shm->map == MAP_FAILED) {
+        shm->map = NULL;
+        fprintf(stderr, "Unable to map the shared memory %s: %s\n",
+                shm->name, strerror(errno));
+        goto error;
+    }
+    shm->header = (struct ShmHeader*)shm->map;
+    shm->slots = (struct ShmSlot*)(shm->header + 1);
+    shm->header->record_size = sizeof(struct TaskStatistics);
+    shm->header->history = SHM_HISTORY;
+    shm->header->n_slots = SHM_SLOTS;
+    shm->header->slot_size = sizeof(struct ShmSlot);
+    shm->header->period = period;
+    shm->header->writer_pid = getpid();
+    /* readers check the magic last */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(shm->header->magic, SHM_MAGIC, 8);
+    return 0;
+
+error:
+    shm_export_destroy(shm);
+    return 1;
+}
+
+void shm_export_publish(struct ShmExport *shm,
+                        const struct TaskStatistics *stats,
+                        int command_type, int pid) {
+    if (stats->target >= SHM_SLOTS) {
+        shm->n_skipped++;
+        return;
+    }
+    struct ShmSlot *slot = &shm->slots[stats->target];
+    if ((uint32_t)stats->target >= shm->header->n_targets) {
+        /* targets are numbered in order, so are the slots taken */
+        for (uint32_t i = shm->header->n_targets;
+             i <= (uint32_t)stats->target; i++) {
+            shm->slots[i].command_type = -1;
+        }
+        slot->command_type = command_type;
+        slot->pid = pid;
+        __atomic_store_n(&shm->header->n_targets, stats->target + 1,
+                         __ATOMIC_RELEASE);
+    }
+    if (slot->command_type != command_type || slot->pid != pid) {
+        slot->command_type = command_type;
+        slot->pid = pid;
+    }
+    struct ShmEntry *entry = &slot->entries[slot->head % SHM_HISTORY];
+    __atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    entry->stats = *stats;
+    __atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&slot->head, slot->head + 1, __ATOMIC_RELEASE);
+    shm->n_published++;
+}
+
+void shm_export_destroy(struct ShmExport *shm) {
+    if (shm->map) {
+        munmap(shm->map, shm->size);
+        shm->map = NULL;
+    }
+    if (shm->name) {
+        /* readers that have it mapped keep the last records */
+        shm_unlink(shm->name);
+        free(shm->name);
+        shm->name = NULL;
+    }
+}
\ No newline at end of file
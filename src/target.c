@@ -0,0 +1,156 @@
+#include "target.h"
+#include <fcntl.h>
+#include <linux/taskstats.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void target_list_init(struct TargetList *list) {
+    memset(list, 0, sizeof(*list));
+}
+
+/* everything but the generation, which tells the reuses of the index apart */
+static void target_init(struct Target *target, int command_type, int pid) {
+    target->command_type = command_type;
+    target->pid = pid;
+    target->group = -1;
+    target->path = NULL;
+    target->pidfd = -1;
+    target->scanned = 0;
+    target->match = 0;
+    proc_files_init(&target->files);
+    target->interval = 1;
+    target->next_tick = target->last_tick = 0;
+    target->busy = 0;
+    target->has_sample = 0;
+    __atomic_store_n(&target->alive, 1, __ATOMIC_RELAXED);
+}
+
+int target_list_add(struct TargetList *list, int command_type, int pid) {
+    if (list->n_free) {
+        int idx = list->free[--list->n_free];
+        struct Target *target = target_list_get(list, idx);
+        target->generation++;
+        target_init(target, command_type, pid);
+        return idx;
+    }
+    int idx = list->n_targets;
+    int chunk = idx >> TARGET_CHUNK_SHIFT;
+    if (chunk >= TARGET_MAX_CHUNKS) {
+        fprintf(stderr, "Too many targets, at most %d are supported\n",
+                TARGET_MAX_CHUNKS * TARGET_CHUNK_SIZE);
+        return -1;
+    }
+    if (!list->chunks[chunk]) {
+        list->chunks[chunk] = (struct Target*)calloc(TARGET_CHUNK_SIZE,
+                                                     sizeof(struct Target));
+        if (!list->chunks[chunk]) {
+            return -1;
+        }
+    }
+    target_init(target_list_get(list, idx), command_type, pid);
+    __atomic_store_n(&list->n_targets, idx + 1, __ATOMIC_RELEASE);
+    return idx;
+}
+
+int target_list_release(struct TargetList *list, int idx) {
+    if (list->n_free == list->free_cap) {
+        int cap = list->free_cap ? list->free_cap * 2 : 64;
+        int *grown = (int*)realloc(list->free, cap * sizeof(int));
+        if (!grown) {
+            return 1;
+        }
+        list->free = grown;
+        list->free_cap = cap;
+    }
+    list->free[list->n_free++] = idx;
+    return 0;
+}
+
+/* the cgroup directory stays open, the kernel is queried by its fd */
+int target_list_add_cgroup(struct TargetList *list, const char *path) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open the cgroup %s\n", path);
+        return -1;
+    }
+    char *name = strdup(path);
+    int idx = name ? target_list_add(list, TARGET_CGROUP, fd) : -1;
+    if (idx < 0) {
+        free(name);
+        close(fd);
+        return -1;
+    }
+    target_list_get(list, idx)->path = name;
+    return idx;
+}
+
+/*
+ * Read targets from a file, one per line: "pid N", "tgid N", "cgroup PATH"
+ * or a bare N which is taken as a pid. Empty lines and lines starting with
+ * '#' are skipped.
+ */
+int target_list_load(struct TargetList *list, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Unable open the target file %s\n", path);
+        return 1;
+    }
+    char line[256];
+    int lineno = 0;
+    int ret = 0;
+    while (fgets(line, sizeof(line), file)) {
+        lineno++;
+        char kind[16];
+        char cgroup_path[256];
+        int pid;
+        char *p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\0') {
+            continue;
+        }
+        if (sscanf(p, "cgroup %255s", cgroup_path) == 1) {
+            ret = target_list_add_cgroup(list, cgroup_path) < 0;
+        } else if (sscanf(p, "%15s %d", kind, &pid) == 2) {
+            if (!strcmp(kind, "pid")) {
+                ret = target_list_add(list, TASKSTATS_CMD_ATTR_PID, pid) < 0;
+            } else if (!strcmp(kind, "tgid")) {
+                ret = target_list_add(list, TASKSTATS_CMD_ATTR_TGID, pid) < 0;
+            } else {
+                ret = 1;
+            }
+        } else if (sscanf(p, "%d", &pid) == 1) {
+            ret = target_list_add(list, TASKSTATS_CMD_ATTR_PID, pid) < 0;
+        } else {
+            ret = 1;
+        }
+        if (ret) {
+            fprintf(stderr, "%s:%d: invalid target\n", path, lineno);
+            break;
+        }
+    }
+    fclose(file);
+    return ret;
+}
+
+void target_list_free(struct TargetList *list) {
+    for (int i = 0; i < list->n_targets; i++) {
+        struct Target *target = target_list_get(list, i);
+        if (target->command_type == TARGET_CGROUP) {
+            close(target->pid);
+            free(target->path);
+        }
+        if (target->pidfd >= 0) {
+            close(target->pidfd);
+        }
+        proc_files_close(&target->files);
+    }
+    for (int i = 0; i < TARGET_MAX_CHUNKS; i++) {
+        free(list->chunks[i]);
+        list->chunks[i] = NULL;
+    }
+    list->n_targets = 0;
+    free(list->free);
+    list->free = NULL;
+    list->n_free = list->free_cap = 0;
+}
\ No newline at end of file
@@ -1,181 +1,330 @@
 #include "taskstats.h"
+#include <linux/genetlink.h>
+#include <netlink/attr.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include "format.h"
 #include "utils.h"
 
 double average_ms(unsigned long long total, unsigned long long count);
 unsigned long long average_ns(unsigned long long total,
                               unsigned long long count);
 
-void print_task_stats(const struct TaskStatistics* stats,
-                      int human_readable) {
-    const struct taskstats* s = &stats->stats;
-    time_t cur_time = get_ns_timestamp();
+void task_stats_parse_aggregate(struct nlattr* aggregate,
+                                struct TaskStatistics* stats) {
+    struct nlattr* attr;
+    int remaining;
+    nla_for_each_nested(attr, aggregate, remaining) {
+        switch (attr->nla_type) {
+            case TASKSTATS_TYPE_PID:
+                stats->pid = nla_get_u32(attr);
+                break;
+            case TASKSTATS_TYPE_TGID:
+                stats->tgid = nla_get_u32(attr);
+                break;
+            case TASKSTATS_TYPE_STATS:
+                nla_memcpy(&stats->stats, attr, sizeof(stats->stats));
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static inline int attr_ok(const struct nlattr* attr, int remaining) {
+    return remaining >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN &&
+           attr->nla_len <= remaining;
+}
+
+static inline const struct nlattr* attr_next(const struct nlattr* attr,
+                                             int* remaining) {
+    *remaining -= NLA_ALIGN(attr->nla_len);
+    return (const struct nlattr*)((const char*)attr +
+                                  NLA_ALIGN(attr->nla_len));
+}
+
+static inline const void* attr_data(const struct nlattr* attr) {
+    return (const char*)attr + NLA_HDRLEN;
+}
+
+/*
+ * copies at most size bytes, older kernels send a shorter struct. memmove
+ * keeps the copy in libc: gcc inlines memcpy as a rep movsq or a word loop,
+ * both a lot slower from the 4 byte aligned attribute data
+ */
+static inline void attr_copy(void* to, size_t size,
+                             const struct nlattr* attr) {
+    size_t len = attr->nla_len - NLA_HDRLEN;
+    memmove(to, attr_data(attr), len < size ? len : size);
+}
+
+void task_stats_parse_reply(const struct nlmsghdr* hdr,
+                            struct TaskStatistics* stats) {
+    const struct genlmsghdr* genl = (const struct genlmsghdr*)NLMSG_DATA(hdr);
+    const struct nlattr* attr = (const struct nlattr*)((const char*)genl +
+                                                       GENL_HDRLEN);
+    int remaining = hdr->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    for (; attr_ok(attr, remaining); attr = attr_next(attr, &remaining)) {
+        int type = attr->nla_type & NLA_TYPE_MASK;
+        /* attribute types of cgroup replies overlap the taskstats ones */
+        if (genl->cmd == CGROUPSTATS_CMD_NEW) {
+            if (type == CGROUPSTATS_TYPE_CGROUP_STATS) {
+                attr_copy(&stats->cgroup, sizeof(stats->cgroup), attr);
+            }
+            continue;
+        }
+        if (type != TASKSTATS_TYPE_AGGR_PID &&
+            type != TASKSTATS_TYPE_AGGR_TGID) {
+            continue;
+        }
+        const struct nlattr* nested = (const struct nlattr*)attr_data(attr);
+        int nested_remaining = attr->nla_len - NLA_HDRLEN;
+        for (; attr_ok(nested, nested_remaining);
+             nested = attr_next(nested, &nested_remaining)) {
+            switch (nested->nla_type & NLA_TYPE_MASK) {
+                case TASKSTATS_TYPE_PID:
+                    memcpy(&stats->pid, attr_data(nested), sizeof(__u32));
+                    break;
+                case TASKSTATS_TYPE_TGID:
+                    memcpy(&stats->tgid, attr_data(nested), sizeof(__u32));
+                    break;
+                case TASKSTATS_TYPE_STATS:
+                    attr_copy(&stats->stats, sizeof(stats->stats), nested);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+/* %-25s labels of the report */
+#define label(p, name) format_str_left(p, name, 25)
+
+/* the time of the sample, held flight recorder records keep theirs */
+static char* format_header(char* p, time_t cur_time) {
     int prefix_sec = cur_time / 1000000000;
     int ms = (cur_time % 1000000000) / 1000000;
     int us = (cur_time % 1000000) / 1000;
     int ns = cur_time % 1000;
-    printf("\n\n=========== (%d) %d ms %d us %d ns ===========\n", prefix_sec, ms, us, ns);
-    printf("\nBasic task statistics\n");
-    printf("---------------------\n");
-    printf("%-25s%d\n", "Stats version:", s->version);
-    printf("%-25s%d\n", "Exit code:", s->ac_exitcode);
-    printf("%-25s0x%x\n", "Flags:", s->ac_flag);
-    printf("%-25s%d\n", "Nice value:", s->ac_nice);
-    printf("%-25s%s\n", "Command name:", s->ac_comm);
-    printf("%-25s%d\n", "Scheduling discipline:", s->ac_sched);
-    printf("%-25s%d\n", "UID:", s->ac_uid);
-    printf("%-25s%d\n", "GID:", s->ac_gid);
-    printf("%-25s%d\n", "PID:", s->ac_pid);
-    printf("%-25s%d\n", "PPID:", s->ac_ppid);
-    if (human_readable) {
-        time_t begin_time = s->ac_btime;
-        printf("%-25s%s", "Begin time:", ctime(&begin_time));
-    } else {
-        printf("%-25s%d sec\n", "Begin time:", s->ac_btime);
+    p = format_str(p, "\n\n=========== (");
+    p = format_int(p, prefix_sec);
+    p = format_str(p, ") ");
+    p = format_int(p, ms);
+    p = format_str(p, " ms ");
+    p = format_int(p, us);
+    p = format_str(p, " us ");
+    p = format_int(p, ns);
+    return format_str(p, " ns ===========\n");
+}
+
+static inline char* format_int_line(char* p, const char* name, int value) {
+    p = format_int(label(p, name), value);
+    *p++ = '\n';
+    return p;
+}
+
+static inline char* format_u64_line(char* p, const char* name,
+                                    unsigned long long value,
+                                    const char* unit) {
+    p = format_str(format_u64(label(p, name), value), unit);
+    *p++ = '\n';
+    return p;
+}
+
+/* one row of the delay accounting table */
+static char* format_delay_row(char* p, const char* name,
+                              const unsigned long long* values, int n,
+                              int human_readable) {
+    const double ms_per_ns = 1e6;
+    p = format_str(p, name);
+    p = format_u64_right(p, values[0], 15);
+    for (int i = 1; i < n; i++) {
+        if (!human_readable) {
+            p = format_u64_right(p, i == 2 ?
+                                 average_ns(values[1], values[0]) : values[i],
+                                 15);
+        } else {
+            p = format_fixed3(p, i == 2 ?
+                              average_ms(values[1], values[0]) :
+                              values[i] / ms_per_ns, 15);
+        }
     }
-    printf("%-25s%llu usec\n", "Elapsed time:", s->ac_etime);
-    printf("%-25s%llu usec\n", "User CPU time:", s->ac_utime);
-    printf("%-25s%llu usec\n", "System CPU time:", s->ac_stime);
-    printf("%-25s%llu\n", "Minor page faults:", s->ac_minflt);
-    printf("%-25s%llu\n", "Major page faults:", s->ac_majflt);
-    printf("%-25s%llu usec\n", "Scaled user time:", s->ac_utimescaled);
-    printf("%-25s%llu usec\n", "Scaled system time:", s->ac_stimescaled);
-    printf("\nDelay accounting\n");
-    printf("----------------\n");
-    printf("       %15s%15s%15s%15s%15s%15s\n",
-           "Count",
-           human_readable ? "Delay (ms)" : "Delay (ns)",
-           "Average delay",
-           "Real delay",
-           "Scaled real",
-           "Virtual delay");
-    if (!human_readable) {
-        printf("CPU    %15llu%15llu%15llu%15llu%15llu%15llu\n",
-               s->cpu_count,
-               s->cpu_delay_total,
-               average_ns(s->cpu_delay_total, s->cpu_count),
-               s->cpu_run_real_total,
-               s->cpu_scaled_run_real_total,
-               s->cpu_run_virtual_total);
-        printf("IO     %15llu%15llu%15llu\n",
-               s->blkio_count,
-               s->blkio_delay_total,
-               average_ns(s->blkio_delay_total, s->blkio_count));
-        printf("Swap   %15llu%15llu%15llu\n",
-               s->swapin_count,
-               s->swapin_delay_total,
-               average_ns(s->swapin_delay_total, s->swapin_count));
-        printf("Reclaim%15llu%15llu%15llu\n",
-               s->freepages_count,
-               s->freepages_delay_total,
-               average_ns(s->freepages_delay_total, s->freepages_count));
+    *p++ = '\n';
+    return p;
+}
+
+char* task_stats_format_report(const struct TaskStatistics* stats,
+                               int human_readable, char* p) {
+    const struct taskstats* s = &stats->stats;
+    p = format_header(p, stats->timestamp);
+    p = format_str(p, "\nBasic task statistics\n");
+    p = format_str(p, "---------------------\n");
+    p = format_int_line(p, "Stats version:", s->version);
+    p = format_int_line(p, "Exit code:", s->ac_exitcode);
+    p = format_str(label(p, "Flags:"), "0x");
+    p = format_hex(p, s->ac_flag);
+    *p++ = '\n';
+    p = format_int_line(p, "Nice value:", s->ac_nice);
+    p = format_str(format_str(label(p, "Command name:"), s->ac_comm), "\n");
+    p = format_int_line(p, "Scheduling discipline:", s->ac_sched);
+    p = format_int_line(p, "UID:", s->ac_uid);
+    p = format_int_line(p, "GID:", s->ac_gid);
+    p = format_int_line(p, "PID:", s->ac_pid);
+    p = format_int_line(p, "PPID:", s->ac_ppid);
+    if (human_readable) {
+        /* the begin time of a task stays, so does its date */
+        static __thread time_t begin_time = -1;
+        static __thread char date[32];
+        if (begin_time != s->ac_btime) {
+            begin_time = s->ac_btime;
+            ctime_r(&begin_time, date);
+        }
+        p = format_str(label(p, "Begin time:"), date);
     } else {
-        const double ms_per_ns = 1e6;
-        printf("CPU    %15llu%15.3f%15.3f%15.3f%15.3f%15.3f\n",
-               s->cpu_count,
-               s->cpu_delay_total / ms_per_ns,
-               average_ms(s->cpu_delay_total, s->cpu_count),
-               s->cpu_run_real_total / ms_per_ns,
-               s->cpu_scaled_run_real_total / ms_per_ns,
-               s->cpu_run_virtual_total / ms_per_ns);
-        printf("IO     %15llu%15.3f%15.3f\n",
-               s->blkio_count,
-               s->blkio_delay_total / ms_per_ns,
-               average_ms(s->blkio_delay_total, s->blkio_count));
-        printf("Swap   %15llu%15.3f%15.3f\n",
-               s->swapin_count,
-               s->swapin_delay_total / ms_per_ns,
-               average_ms(s->swapin_delay_total, s->swapin_count));
-        printf("Reclaim%15llu%15.3f%15.3f\n",
-               s->freepages_count,
-               s->freepages_delay_total / ms_per_ns,
-               average_ms(s->freepages_delay_total, s->freepages_count));
+        p = format_str(format_int(label(p, "Begin time:"), s->ac_btime),
+                       " sec\n");
     }
-    printf("\nExtended accounting fields\n");
-    printf("--------------------------\n");
+    p = format_u64_line(p, "Elapsed time:", s->ac_etime, " usec");
+    p = format_u64_line(p, "User CPU time:", s->ac_utime, " usec");
+    p = format_u64_line(p, "System CPU time:", s->ac_stime, " usec");
+    p = format_u64_line(p, "Minor page faults:", s->ac_minflt, "");
+    p = format_u64_line(p, "Major page faults:", s->ac_majflt, "");
+    p = format_u64_line(p, "Scaled user time:", s->ac_utimescaled, " usec");
+    p = format_u64_line(p, "Scaled system time:", s->ac_stimescaled,
+                        " usec");
+    p = format_str(p, "\nDelay accounting\n");
+    p = format_str(p, "----------------\n");
+    p = format_str(p, "       ");
+    p = format_str_right(p, "Count", 15);
+    p = format_str_right(p, human_readable ? "Delay (ms)" : "Delay (ns)", 15);
+    p = format_str_right(p, "Average delay", 15);
+    p = format_str_right(p, "Real delay", 15);
+    p = format_str_right(p, "Scaled real", 15);
+    p = format_str_right(p, "Virtual delay", 15);
+    *p++ = '\n';
+    /* count, total, average (computed), then the run times of the CPU */
+    const unsigned long long cpu[] = {
+        s->cpu_count, s->cpu_delay_total, 0, s->cpu_run_real_total,
+        s->cpu_scaled_run_real_total, s->cpu_run_virtual_total
+    };
+    const unsigned long long io[] = { s->blkio_count, s->blkio_delay_total };
+    const unsigned long long swap[] = {
+        s->swapin_count, s->swapin_delay_total
+    };
+    const unsigned long long reclaim[] = {
+        s->freepages_count, s->freepages_delay_total
+    };
+    p = format_delay_row(p, "CPU    ", cpu, 6, human_readable);
+    p = format_delay_row(p, "IO     ", io, 3, human_readable);
+    p = format_delay_row(p, "Swap   ", swap, 3, human_readable);
+    p = format_delay_row(p, "Reclaim", reclaim, 3, human_readable);
+    p = format_str(p, "\nExtended accounting fields\n");
+    p = format_str(p, "--------------------------\n");
     if (human_readable && s->ac_stime) {
-        printf("%-25s%.3f MB\n", "Average RSS usage:",
-               (double)s->coremem / s->ac_stime);
-        printf("%-25s%.3f MB\n", "Average VM usage:",
-               (double)s->virtmem / s->ac_stime);
+        p = format_fixed3(label(p, "Average RSS usage:"),
+                          (double)s->coremem / s->ac_stime, 0);
+        p = format_str(p, " MB\n");
+        p = format_fixed3(label(p, "Average VM usage:"),
+                          (double)s->virtmem / s->ac_stime, 0);
+        p = format_str(p, " MB\n");
     } else {
-        printf("%-25s%llu MB\n", "Accumulated RSS usage:", s->coremem);
-        printf("%-25s%llu MB\n", "Accumulated VM usage:", s->virtmem);
+        p = format_u64_line(p, "Accumulated RSS usage:", s->coremem, " MB");
+        p = format_u64_line(p, "Accumulated VM usage:", s->virtmem, " MB");
     }
-    printf("%-25s%llu KB\n", "RSS high water mark:", s->hiwater_rss);
-    printf("%-25s%llu KB\n", "VM high water mark:", s->hiwater_vm);
-    printf("%-25s%llu\n", "IO bytes read:", s->read_char);
-    printf("%-25s%llu\n", "IO bytes written:", s->write_char);
-    printf("%-25s%llu\n", "IO read syscalls:", s->read_syscalls);
-    printf("%-25s%llu\n", "IO write syscalls:", s->write_syscalls);
-    printf("\nPer-task/thread statistics\n");
-    printf("--------------------------\n");
-    printf("%-25s%llu\n", "Voluntary switches:", s->nvcsw);
-    printf("%-25s%llu\n", "Involuntary switches:", s->nivcsw);
+    p = format_u64_line(p, "RSS high water mark:", s->hiwater_rss, " KB");
+    p = format_u64_line(p, "VM high water mark:", s->hiwater_vm, " KB");
+    p = format_u64_line(p, "IO bytes read:", s->read_char, "");
+    p = format_u64_line(p, "IO bytes written:", s->write_char, "");
+    p = format_u64_line(p, "IO read syscalls:", s->read_syscalls, "");
+    p = format_u64_line(p, "IO write syscalls:", s->write_syscalls, "");
+    p = format_str(p, "\nPer-task/thread statistics\n");
+    p = format_str(p, "--------------------------\n");
+    p = format_u64_line(p, "Voluntary switches:", s->nvcsw, "");
+    p = format_u64_line(p, "Involuntary switches:", s->nivcsw, "");
 #if TASKSTATS_VERSION > 8
     if (s->version > 8) {
-        printf("%-25s%llu\n", "Thrashing count:", s->thrashing_count);
-        printf("%-25s%llu\n", "Thrashing delay total:", s->thrashing_delay_total);
+        p = format_u64_line(p, "Thrashing count:", s->thrashing_count, "");
+        p = format_u64_line(p, "Thrashing delay total:",
+                            s->thrashing_delay_total, "");
     }
 #endif
+    const struct ProcSupplement* proc = &stats->proc;
+    if (proc->valid) {
+        p = format_str(p, "\nProc files\n");
+        p = format_str(p, "----------\n");
+    }
+    if (proc->valid & 1 << PROC_FILE_STAT) {
+        p = format_u64_line(p, "Current RSS:", proc->rss >> 10, " KB");
+        p = format_int_line(p, "Run queue of CPU:", proc->cpu);
+    }
+    if (proc->valid & 1 << PROC_FILE_SCHEDSTAT) {
+        p = format_u64_line(p, "Time on CPU:", proc->run_time, " ns");
+        p = format_u64_line(p, "Run queue wait:", proc->wait_time, " ns");
+    }
+    return p;
 }
 
-char* task_stats2str(const struct TaskStatistics* stats, char* buf, size_t len) {
-    char * const buf_orig = buf;
+void print_task_stats(const struct TaskStatistics* stats,
+                      int human_readable) {
+    char buf[TASK_STATS_REPORT_LEN];
+    char* end = task_stats_format_report(stats, human_readable, buf);
+    fwrite(buf, 1, end - buf, stdout);
+}
+
+char* task_stats_format(const struct TaskStatistics* stats, char* p) {
     const struct taskstats* s = &stats->stats;
-    int l;
-#define snprintllu(d) do{l = snprintf(buf, len, "%llu\t", d); buf += l; len -= l;}while(0)
+#define putllu(d) do{p = format_u64(p, d); *p++ = '\t';}while(0)
     /* 1) Common and basic accounting fields: */
 	/* The version number of this struct. This field is always set to
 	 * TAKSTATS_VERSION, which is defined in <linux/taskstats.h>.
 	 * Each time the struct is changed, the value should be incremented.
 	 */
-	// snprintllu(s->version);
+	// putllu(s->version);
 
   	/* The exit code of a task. */
-	// snprintllu(s->ac_exitcode);		/* Exit status */
+	// putllu(s->ac_exitcode);		/* Exit status */
 
   	/* The accounting flags of a task as defined in <linux/acct.h>
 	 * Defined values are AFORK, ASU, ACOMPAT, ACORE, and AXSIG.
 	 */
-	// snprintllu(s->ac_flag);		/* Record flags */
+	// putllu(s->ac_flag);		/* Record flags */
 
   	/* The value of task_nice() of a task. */
-	// snprintllu(s->ac_nice);		/* task_nice */
+	// putllu(s->ac_nice);		/* task_nice */
 
   	/* The name of the command that started this task. */
 	// char	ac_comm[TS_COMM_LEN];	/* Command name */
-    l = snprintf(buf, len, "%s\t", s->ac_comm);
-    buf += l;
-    len -= l;
+    p = format_str(p, s->ac_comm);
+    *p++ = '\t';
 
   	/* The scheduling discipline as set in task->policy field. */
-	// snprintllu(s->ac_sched);		/* Scheduling discipline */
+	// putllu(s->ac_sched);		/* Scheduling discipline */
 
-	// snprintllu(s->ac_pad[3]);
-	// snprintllu(s->ac_uid);			/* User ID */
-	// snprintllu(s->ac_gid);			/* Group ID */
-	// snprintllu(s->ac_pid);			/* Process ID */
-	// snprintllu(s->ac_ppid);		/* Parent process ID */
+	// putllu(s->ac_pad[3]);
+	// putllu(s->ac_uid);			/* User ID */
+	// putllu(s->ac_gid);			/* Group ID */
+	// putllu(s->ac_pid);			/* Process ID */
+	// putllu(s->ac_ppid);		/* Parent process ID */
 
   	/* The time when a task begins, in [secs] since 1970. */
-	snprintllu(s->ac_btime);		/* Begin time [sec since 1970] */
+	putllu(s->ac_btime);		/* Begin time [sec since 1970] */
 
   	/* The elapsed time of a task, in [usec]. */
-	snprintllu(s->ac_etime);		/* Elapsed time [usec] */
+	putllu(s->ac_etime);		/* Elapsed time [usec] */
 
   	/* The user CPU time of a task, in [usec]. */
-	snprintllu(s->ac_utime);		/* User CPU time [usec] */
+	putllu(s->ac_utime);		/* User CPU time [usec] */
 
   	/* The system CPU time of a task, in [usec]. */
-	snprintllu(s->ac_stime);		/* System CPU time [usec] */
+	putllu(s->ac_stime);		/* System CPU time [usec] */
 
   	/* The minor page fault count of a task, as set in task->min_flt. */
-	snprintllu(s->ac_minflt);		/* Minor Page Fault Count */
+	putllu(s->ac_minflt);		/* Minor Page Fault Count */
 
 	/* The major page fault count of a task, as set in task->maj_flt. */
-	snprintllu(s->ac_majflt);		/* Major Page Fault Count */
+	putllu(s->ac_majflt);		/* Major Page Fault Count */
 
     /* 2) Delay accounting fields: */
 	/* Delay accounting fields start
@@ -194,20 +343,20 @@ char* task_stats2str(const struct TaskStatistics* stats, char* buf, size_t len)
 	/* Delay waiting for cpu, while runnable
 	 * count, delay_total NOT updated atomically
 	 */
-	snprintllu(s->cpu_count);
-	snprintllu(s->cpu_delay_total);
+	putllu(s->cpu_count);
+	putllu(s->cpu_delay_total);
 
 	/* Following four fields atomically updated using task->delays->lock */
 
 	/* Delay waiting for synchronous block I/O to complete
 	 * does not account for delays in I/O submission
 	 */
-	snprintllu(s->blkio_count);
-	snprintllu(s->blkio_delay_total);
+	putllu(s->blkio_count);
+	putllu(s->blkio_delay_total);
 
 	/* Delay waiting for page fault I/O (swap in only) */
-	snprintllu(s->swapin_count);
-	snprintllu(s->swapin_delay_total);
+	putllu(s->swapin_count);
+	putllu(s->swapin_delay_total);
 
 	/* cpu "wall-clock" running time
 	 * On some architectures, value will adjust for cpu time stolen
@@ -215,7 +364,7 @@ char* task_stats2str(const struct TaskStatistics* stats, char* buf, size_t len)
 	 * Value is cumulative, in nanoseconds, without a corresponding count
 	 * and wraps around to zero silently on overflow
 	 */
-	snprintllu(s->cpu_run_real_total);
+	putllu(s->cpu_run_real_total);
 
 	/* cpu "virtual" running time
 	 * Uses time intervals seen by the kernel i.e. no adjustment
@@ -223,7 +372,7 @@ char* task_stats2str(const struct TaskStatistics* stats, char* buf, size_t len)
 	 * Value is cumulative, in nanoseconds, without a corresponding count
 	 * and wraps around to zero silently on overflow
 	 */
-	snprintllu(s->cpu_run_virtual_total);
+	putllu(s->cpu_run_virtual_total);
 	/* Delay accounting fields end */
 	/* version 1 ends here */
 
@@ -236,42 +385,101 @@ char* task_stats2str(const struct TaskStatistics* stats, char* buf, size_t len)
 	 * will have memory usage multiplied by system time. Thus an
 	 * average usage per system time unit can be calculated.
 	 */
-	snprintllu(s->coremem);		/* accumulated RSS usage in MB-usec */
+	putllu(s->coremem);		/* accumulated RSS usage in MB-usec */
 
   	/* Accumulated virtual memory usage in duration of a task.
 	 * Same as acct_rss_mem1 above except that we keep track of VM usage.
 	 */
-	snprintllu(s->virtmem);		/* accumulated VM usage in MB-usec */
+	putllu(s->virtmem);		/* accumulated VM usage in MB-usec */
 
   	/* High watermark of RSS usage in duration of a task, in KBytes. */
-	snprintllu(s->hiwater_rss);		/* High-watermark of RSS usage */
+	putllu(s->hiwater_rss);		/* High-watermark of RSS usage */
 
   	/* High watermark of VM  usage in duration of a task, in KBytes. */
-	snprintllu(s->hiwater_vm);		/* High-water virtual memory usage */
+	putllu(s->hiwater_vm);		/* High-water virtual memory usage */
 
 	/* The following four fields are I/O statistics of a task. */
-	snprintllu(s->read_char);		/* bytes read */
-	snprintllu(s->write_char);		/* bytes written */
-	snprintllu(s->read_syscalls);		/* read syscalls */
-	snprintllu(s->write_syscalls);		/* write syscalls */
+	putllu(s->read_char);		/* bytes read */
+	putllu(s->write_char);		/* bytes written */
+	putllu(s->read_syscalls);		/* read syscalls */
+	putllu(s->write_syscalls);		/* write syscalls */
 
 	/* Extended accounting fields end */
 
     /* 4) Per-task and per-thread statistics */
-	snprintllu(s->nvcsw);			/* Context voluntary switch counter */
-	snprintllu(s->nivcsw);			/* Context involuntary switch counter */
+	putllu(s->nvcsw);			/* Context voluntary switch counter */
+	putllu(s->nivcsw);			/* Context involuntary switch counter */
 
     /* 5) Time accounting for SMT machines */
-	snprintllu(s->ac_utimescaled);		/* utime scaled on frequency etc */
-	snprintllu(s->ac_stimescaled);		/* stime scaled on frequency etc */
-	snprintllu(s->cpu_scaled_run_real_total); /* scaled cpu_run_real_total */
+	putllu(s->ac_utimescaled);		/* utime scaled on frequency etc */
+	putllu(s->ac_stimescaled);		/* stime scaled on frequency etc */
+	putllu(s->cpu_scaled_run_real_total); /* scaled cpu_run_real_total */
 
     /* 6) Extended delay accounting fields for memory reclaim
 	      Delay waiting for memory reclaim */
-	snprintllu(s->freepages_count);
-	snprintllu(s->freepages_delay_total);
-#undef snprintllu
-    return buf_orig;
+	putllu(s->freepages_count);
+	putllu(s->freepages_delay_total);
+#undef putllu
+    return p;
+}
+
+char* task_stats2str(const struct TaskStatistics* stats, char* buf, size_t len) {
+    char line[TASK_STATS_STR_LEN];
+    if (len >= TASK_STATS_STR_LEN) {
+        *task_stats_format(stats, buf) = '\0';
+        return buf;
+    }
+    size_t n = task_stats_format(stats, line) - line;
+    if (len) {
+        n = n < len - 1 ? n : len - 1;
+        memcpy(buf, line, n);
+        buf[n] = '\0';
+    }
+    return buf;
+}
+
+char* cgroup_stats_format_report(const struct TaskStatistics* stats, char* p) {
+    const struct cgroupstats* c = &stats->cgroup;
+    p = format_header(p, stats->timestamp);
+    p = format_str(p, "\nCgroup task states\n");
+    p = format_str(p, "------------------\n");
+    p = format_u64_line(p, "Running:", c->nr_running, "");
+    p = format_u64_line(p, "Sleeping:", c->nr_sleeping, "");
+    p = format_u64_line(p, "Uninterruptible:", c->nr_uninterruptible, "");
+    p = format_u64_line(p, "Stopped:", c->nr_stopped, "");
+    p = format_u64_line(p, "Waiting for IO:", c->nr_io_wait, "");
+    return p;
+}
+
+void print_cgroup_stats(const struct TaskStatistics* stats) {
+    char buf[TASK_STATS_REPORT_LEN];
+    char* end = cgroup_stats_format_report(stats, buf);
+    fwrite(buf, 1, end - buf, stdout);
+}
+
+char* cgroup_stats_format(const struct TaskStatistics* stats, char* p) {
+    const struct cgroupstats* c = &stats->cgroup;
+    const unsigned long long counts[] = {
+        c->nr_running, c->nr_sleeping, c->nr_uninterruptible,
+        c->nr_stopped, c->nr_io_wait
+    };
+    for (int i = 0; i < 5; i++) {
+        p = format_u64(p, counts[i]);
+        *p++ = '\t';
+    }
+    return p;
+}
+
+char* cgroup_stats2str(const struct TaskStatistics* stats, char* buf,
+                       size_t len) {
+    char line[CGROUP_STATS_STR_LEN];
+    size_t n = cgroup_stats_format(stats, line) - line;
+    if (len) {
+        n = n < len - 1 ? n : len - 1;
+        memcpy(buf, line, n);
+        buf[n] = '\0';
+    }
+    return buf;
 }
 
 /* utility function */
@@ -0,0 +1,147 @@
+#include "threads.h"
+#include <linux/taskstats.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int compare_tid(const void *a, const void *b) {
+    return ((const struct ThreadEntry*)a)->tid -
+           ((const struct ThreadEntry*)b)->tid;
+}
+
+static int add_thread(struct ThreadScanner *scanner,
+                      struct ThreadGroupScan *group, struct ThreadEntry *entry) {
+    int idx = target_list_add(scanner->targets, TASKSTATS_CMD_ATTR_PID,
+                              entry->tid);
+    if (idx < 0) {
+        return 1;
+    }
+    struct Target *target = target_list_get(scanner->targets, idx);
+    target->group = group->target;
+    entry->target = idx;
+    entry->generation = target->generation;
+    return 0;
+}
+
+/* merges the current content of /proc/<tgid>/task into the sorted list */
+static int scan_group(struct ThreadScanner *scanner,
+                      struct ThreadGroupScan *group) {
+    int capacity = group->n_threads + 16;
+    struct ThreadEntry *found = (struct ThreadEntry*)malloc(
+        capacity * sizeof(struct ThreadEntry));
+    if (!found) {
+        return 0;
+    }
+    int n_found = 0;
+    struct dirent *entry;
+    rewinddir(group->task_dir);
+    while ((entry = readdir(group->task_dir)) != NULL) {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') {
+            continue;
+        }
+        if (n_found == capacity) {
+            capacity *= 2;
+            struct ThreadEntry *grown = (struct ThreadEntry*)realloc(
+                found, capacity * sizeof(struct ThreadEntry));
+            if (!grown) {
+                break;
+            }
+            found = grown;
+        }
+        found[n_found].tid = atoi(entry->d_name);
+        found[n_found].target = -1;
+        n_found++;
+    }
+    qsort(found, n_found, sizeof(struct ThreadEntry), compare_tid);
+
+    int added = 0;
+    int i = 0, j = 0;
+    while (i < group->n_threads || j < n_found) {
+        struct ThreadEntry *old = i < group->n_threads ?
+                                  &group->threads[i] : NULL;
+        struct ThreadEntry *cur = j < n_found ? &found[j] : NULL;
+        if (old && (!cur || old->tid < cur->tid)) {
+            /* the thread has exited since the previous scan */
+            struct Target *target = old->target >= 0 ?
+                target_list_get(scanner->targets, old->target) : NULL;
+            if (target && target->generation == old->generation) {
+                __atomic_store_n(&target->alive, 0, __ATOMIC_RELAXED);
+            }
+            i++;
+            continue;
+        }
+        if (old && old->tid == cur->tid && old->target >= 0 &&
+            target_is_current(target_list_get(scanner->targets, old->target),
+                              old->generation)) {
+            *cur = *old;
+        } else if (!add_thread(scanner, group, cur)) {
+            added++;
+        }
+        i += old && old->tid == cur->tid;
+        j++;
+    }
+
+    free(group->threads);
+    group->threads = found;
+    group->n_threads = n_found;
+    return added;
+}
+
+int thread_scanner_init(struct ThreadScanner *scanner,
+                        struct TargetList *targets, time_t interval) {
+    memset(scanner, 0, sizeof(*scanner));
+    scanner->targets = targets;
+    scanner->interval = interval;
+    scanner->requested = 1;
+
+    int n_targets = targets->n_targets;
+    scanner->groups = (struct ThreadGroupScan*)calloc(
+        n_targets ? n_targets : 1, sizeof(struct ThreadGroupScan));
+    if (!scanner->groups) {
+        return 1;
+    }
+    for (int i = 0; i < n_targets; i++) {
+        struct Target *target = target_list_get(targets, i);
+        if (target->command_type != TASKSTATS_CMD_ATTR_TGID) {
+            continue;
+        }
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/task", target->pid);
+        struct ThreadGroupScan *group = &scanner->groups[scanner->n_groups];
+        group->task_dir = opendir(path);
+        if (!group->task_dir) {
+            fprintf(stderr, "Unable to list threads of %d\n", target->pid);
+            return 1;
+        }
+        group->target = i;
+        group->tgid = target->pid;
+        scanner->n_groups++;
+    }
+    return 0;
+}
+
+int thread_scanner_poll(struct ThreadScanner *scanner, time_t now) {
+    if (!scanner->requested && now < scanner->next_scan) {
+        return 0;
+    }
+    int added = 0;
+    for (int i = 0; i < scanner->n_groups; i++) {
+        struct ThreadGroupScan *group = &scanner->groups[i];
+        if (target_list_get(scanner->targets, group->target)->alive) {
+            added += scan_group(scanner, group);
+        }
+    }
+    scanner->requested = 0;
+    scanner->next_scan = now + scanner->interval;
+    return added;
+}
+
+void thread_scanner_free(struct ThreadScanner *scanner) {
+    for (int i = 0; i < scanner->n_groups; i++) {
+        closedir(scanner->groups[i].task_dir);
+        free(scanner->groups[i].threads);
+    }
+    free(scanner->groups);
+    scanner->groups = NULL;
+    scanner->n_groups = 0;
+}
\ No newline at end of file
@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+#include "ticker.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "utils.h"
+
+static int arm(struct Ticker *ticker, time_t deadline) {
+    struct itimerspec spec = {
+        .it_interval = { 0, 0 },
+        .it_value = { deadline / 1000000000, deadline % 1000000000 }
+    };
+    return timerfd_settime(ticker->fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static time_t max_spin(const struct Ticker *ticker) {
+    return ticker->period / 2 < TICKER_MAX_SPIN ?
+           ticker->period / 2 : TICKER_MAX_SPIN;
+}
+
+/* grows the window at once on a late wakeup, shrinks it slowly otherwise */
+static void adapt_spin(struct Ticker *ticker, time_t late) {
+    time_t target = late + late / 4 + TICKER_MIN_SPIN;
+    if (target > ticker->spin) {
+        ticker->spin = target;
+    } else {
+        ticker->spin -= (ticker->spin - target) / 16;
+    }
+    if (ticker->spin > max_spin(ticker)) {
+        ticker->spin = max_spin(ticker);
+    }
+}
+
+/* runs the calling thread with real-time priority on the chosen CPU */
+static void enter_fifo(struct Ticker *ticker) {
+    if (ticker->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(ticker->cpu, &set);
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (ret) {
+            fprintf(stderr, "Unable to pin the sampler to CPU %d: %s\n",
+                    ticker->cpu, strerror(ret));
+        }
+    }
+    struct sched_param param = { .sched_priority = TICKER_FIFO_PRIORITY };
+    int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (ret) {
+        fprintf(stderr, "Unable to use SCHED_FIFO, ticking with normal "
+                "priority: %s\n", strerror(ret));
+    }
+}
+
+int ticker_init(struct Ticker *ticker, enum TickerMode mode, time_t period,
+                int cpu) {
+    memset(ticker, 0, sizeof(*ticker));
+    ticker->mode = mode;
+    ticker->period = period;
+    ticker->cpu = cpu;
+    ticker->spin = mode == TICKER_SLEEP ? 0 : TICKER_MIN_SPIN;
+    ticker->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (ticker->fd < 0) {
+        perror("Unable to create timerfd");
+        return 1;
+    }
+    return 0;
+}
+
+int ticker_start(struct Ticker *ticker) {
+    if (ticker->mode == TICKER_FIFO) {
+        enter_fifo(ticker);
+    }
+    /* the first tick is due right away */
+    ticker->next = get_monotonic_timestamp();
+    ticker->last = 0;
+    return arm(ticker, ticker->next);
+}
+
+int ticker_stop(struct Ticker *ticker) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    return timerfd_settime(ticker->fd, 0, &spec, NULL);
+}
+
+int ticker_wait(struct Ticker *ticker) {
+    uint64_t expirations;
+    if (read(ticker->fd, &expirations, sizeof(expirations)) !=
+            sizeof(expirations)) {
+        return errno == EAGAIN ? 0 : -1;
+    }
+    time_t now = get_monotonic_timestamp();
+    if (ticker->mode != TICKER_SLEEP) {
+        time_t fired = now - (ticker->next - ticker->spin);
+        adapt_spin(ticker, fired > 0 ? fired : 0);
+        time_t spin_start = now;
+        while (now < ticker->next) {
+            cpu_relax();
+            now = get_monotonic_timestamp();
+        }
+        ticker->spin_total += now - spin_start;
+    }
+
+    time_t late = now > ticker->next ? now - ticker->next : 0;
+    ticker->late = late;
+    ticker->late_total += late;
+    if (late > ticker->late_max) {
+        ticker->late_max = late;
+    }
+    if (ticker->last) {
+        time_t period = now - ticker->last;
+        ticker->period_total += period;
+        if (!ticker->period_min || period < ticker->period_min) {
+            ticker->period_min = period;
+        }
+        if (period > ticker->period_max) {
+            ticker->period_max = period;
+        }
+    }
+    ticker->last = now;
+    ticker->n_ticks++;
+
+    /* deadlines that passed while we were late are skipped, not bunched */
+    int passed = 1 + late / ticker->period;
+    ticker->n_missed += passed - 1;
+    ticker->next += passed * ticker->period;
+    if (arm(ticker, ticker->next - ticker->spin)) {
+        return -1;
+    }
+    return passed;
+}
+
+void ticker_print_stats(const struct Ticker *ticker) {
+    static const char *names[] = { "sleep", "hybrid", "fifo" };
+    if (!ticker->n_ticks) {
+        return;
+    }
+    unsigned long long n_periods = ticker->n_ticks > 1 ?
+                                   ticker->n_ticks - 1 : 1;
+    fprintf(stderr, "%s ticks: period avg %.1f min %.1f max %.1f us, "
+            "lateness avg %.1f max %.1f us, spin %.1f us per tick\n",
+            names[ticker->mode],
+            ticker->period_total / n_periods / MICRO_SECOND,
+            ticker->period_min * 1. / MICRO_SECOND,
+            ticker->period_max * 1. / MICRO_SECOND,
+            ticker->late_total / ticker->n_ticks / MICRO_SECOND,
+            ticker->late_max * 1. / MICRO_SECOND,
+            ticker->spin_total / ticker->n_ticks / MICRO_SECOND);
+}
+
+void ticker_destroy(struct Ticker *ticker) {
+    if (ticker->fd >= 0) {
+        close(ticker->fd);
+        ticker->fd = -1;
+    }
+}
\ No newline at end of file
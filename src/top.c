@@ -0,0 +1,177 @@
+#include "top.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "format.h"
+
+static const char *sort_names[] = {
+    "cpu_delay", "blkio_delay", "swapin_delay"
+};
+
+static double sort_key(enum TopSort sort, const struct TaskRates *rates) {
+    switch (sort) {
+        case TOP_BLKIO_DELAY:
+            return rates->blkio_delay;
+        case TOP_SWAPIN_DELAY:
+            return rates->swapin_delay;
+        default:
+            return rates->cpu_delay;
+    }
+}
+
+static void swap(struct TaskRates *a, struct TaskRates *b) {
+    struct TaskRates t = *a;
+    *a = *b;
+    *b = t;
+}
+
+static void sift_up(struct TopTable *top, int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (sort_key(top->sort, &top->heap[parent]) <=
+            sort_key(top->sort, &top->heap[i])) {
+            return;
+        }
+        swap(&top->heap[parent], &top->heap[i]);
+        i = parent;
+    }
+}
+
+static void sift_down(struct TopTable *top, int i, int n) {
+    while (1) {
+        int smallest = i;
+        int left = 2 * i + 1, right = left + 1;
+        if (left < n && sort_key(top->sort, &top->heap[left]) <
+                        sort_key(top->sort, &top->heap[smallest])) {
+            smallest = left;
+        }
+        if (right < n && sort_key(top->sort, &top->heap[right]) <
+                         sort_key(top->sort, &top->heap[smallest])) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        swap(&top->heap[i], &top->heap[smallest]);
+        i = smallest;
+    }
+}
+
+int top_sort_parse(const char *name, enum TopSort *sort) {
+    for (int i = 0; i < (int)(sizeof(sort_names) / sizeof(sort_names[0]));
+         i++) {
+        if (!strcmp(name, sort_names[i])) {
+            *sort = (enum TopSort)i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int top_table_init(struct TopTable *top, int k, enum TopSort sort,
+                   int refresh) {
+    memset(top, 0, sizeof(*top));
+    top->k = k;
+    top->sort = sort;
+    top->refresh = refresh;
+    rate_tracker_init(&top->rates);
+    top->heap = (struct TaskRates*)malloc(k * sizeof(struct TaskRates));
+    return top->heap == NULL;
+}
+
+int top_table_due(const struct TopTable *top,
+                  const struct TaskStatistics *stats) {
+    return top->n_tasks && stats->tick != top->tick;
+}
+
+void top_table_add(struct TopTable *top, const struct TaskStatistics *stats) {
+    if (stats->tick != top->tick) {
+        top->tick = stats->tick;
+        top->n_heap = 0;
+        top->n_tasks = 0;
+        top->total = 0;
+    }
+    struct TaskRates rates;
+    if (rate_tracker_update(&top->rates, stats, &rates) <= 0) {
+        return;
+    }
+    double key = sort_key(top->sort, &rates);
+    top->n_tasks++;
+    top->total += key;
+    if (top->n_heap < top->k) {
+        top->heap[top->n_heap] = rates;
+        sift_up(top, top->n_heap++);
+    } else if (key > sort_key(top->sort, &top->heap[0])) {
+        top->heap[0] = rates;
+        sift_down(top, 0, top->n_heap);
+    }
+}
+
+void top_table_free(struct TopTable *top) {
+    rate_tracker_free(&top->rates);
+    free(top->heap);
+    top->heap = NULL;
+}
+
+/*
+ * the aggregate of a TGID comes without ac_comm, the K rows shown take it
+ * from /proc instead
+ */
+static void read_comm(int pid, char *comm, size_t len) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    ssize_t n = read(fd, comm, len - 1);
+    close(fd);
+    if (n > 0 && comm[n - 1] == '\n') {
+        n--;
+    }
+    comm[n > 0 ? n : 0] = '\0';
+}
+
+char* top_table_format(struct TopTable *top, char *p) {
+    /* heap sort in place, the smallest keys move to the end */
+    for (int n = top->n_heap - 1; n > 0; n--) {
+        swap(&top->heap[0], &top->heap[n]);
+        sift_down(top, 0, n);
+    }
+    if (top->refresh) {
+        /* cursor home and clear the screen */
+        p = format_str(p, "\033[H\033[2J");
+    }
+    p = format_str(p, "tick ");
+    p = format_u64(p, top->tick);
+    p = format_str(p, ", ");
+    p = format_int(p, top->n_tasks);
+    p = format_str(p, " processes, ");
+    p = format_str(p, sort_names[top->sort]);
+    p = format_str(p, " of all ");
+    p = format_fixed3(p, top->total, 0);
+    p = format_str(p, " ms/s\n");
+    p = format_str(p, "    PID         CPU%   CPU_DELAY BLKIO_DELAY "
+                   "SWAPIN_DELAY  COMMAND\n");
+    for (int i = 0; i < top->n_heap; i++) {
+        struct TaskRates *rates = &top->heap[i];
+        if (!rates->comm[0]) {
+            read_comm(rates->pid, rates->comm, sizeof(rates->comm));
+        }
+        p = format_u64_right(p, rates->pid, 7);
+        p = format_fixed3(p, rates->cpu, 13);
+        p = format_fixed3(p, rates->cpu_delay, 12);
+        p = format_fixed3(p, rates->blkio_delay, 12);
+        p = format_fixed3(p, rates->swapin_delay, 13);
+        *p++ = ' ';
+        *p++ = ' ';
+        p = format_str(p, rates->comm);
+        *p++ = '\n';
+    }
+    *p++ = '\n';
+    top->n_heap = 0;
+    top->n_tables++;
+    return p;
+}
\ No newline at end of file
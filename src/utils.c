@@ -1,4 +1,5 @@
 #include "utils.h"
+#include <errno.h>
 #include <unistd.h>
 
 time_t get_ns_timestamp() {
@@ -8,15 +9,17 @@ time_t get_ns_timestamp() {
     return timestamp;
 }
 
-void sleep_until(time_t t_target_ns) {
-    do {
-        time_t t_cur_ns = get_ns_timestamp();
-        if (t_target_ns - t_cur_ns < 50 * MICRO_SECOND) break;
-        usleep(40);
-    } while (1);
+time_t get_monotonic_timestamp() {
+    struct timespec current_time;
+    clock_gettime(CLOCK_MONOTONIC, &current_time);
+    return current_time.tv_sec * 1000000000 + current_time.tv_nsec;
+}
 
-    do {
-        time_t t_cur_ns = get_ns_timestamp();
-        if (t_target_ns <= t_cur_ns) break;
-    } while (1);
+/* t_target_ns is a get_monotonic_timestamp() deadline */
+void sleep_until(time_t t_target_ns) {
+    struct timespec target = {
+        t_target_ns / 1000000000, t_target_ns % 1000000000
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, NULL) ==
+           EINTR);
 }
\ No newline at end of file
@@ -0,0 +1,296 @@
+#include "window.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "format.h"
+
+#define COUNTER(name) { #name, offsetof(struct TaskStatistics, stats.name) }
+#define PROC(name) \
+    { "proc_" #name, offsetof(struct TaskStatistics, proc.name) }
+
+/* in the order of the text columns */
+static const struct {
+    const char *name;
+    size_t offset;
+} counters[WINDOW_MAX_FIELDS] = {
+    COUNTER(ac_etime),
+    COUNTER(ac_utime),
+    COUNTER(ac_stime),
+    COUNTER(ac_minflt),
+    COUNTER(ac_majflt),
+    COUNTER(cpu_count),
+    COUNTER(cpu_delay_total),
+    COUNTER(blkio_count),
+    COUNTER(blkio_delay_total),
+    COUNTER(swapin_count),
+    COUNTER(swapin_delay_total),
+    COUNTER(cpu_run_real_total),
+    COUNTER(cpu_run_virtual_total),
+    COUNTER(coremem),
+    COUNTER(virtmem),
+    COUNTER(hiwater_rss),
+    COUNTER(hiwater_vm),
+    COUNTER(read_char),
+    COUNTER(write_char),
+    COUNTER(read_syscalls),
+    COUNTER(write_syscalls),
+    COUNTER(nvcsw),
+    COUNTER(nivcsw),
+    COUNTER(ac_utimescaled),
+    COUNTER(ac_stimescaled),
+    COUNTER(cpu_scaled_run_real_total),
+    COUNTER(freepages_count),
+    COUNTER(freepages_delay_total),
+    PROC(rss),
+    PROC(run_time),
+    PROC(wait_time)
+};
+
+static const double quantiles[WINDOW_N_QUANTILES] = { 0.5, 0.9, 0.99 };
+static const char *quantile_names[WINDOW_N_QUANTILES] = {
+    "p50", "p90", "p99"
+};
+
+static void sort5(double *v, int n) {
+    for (int i = 1; i < n; i++) {
+        double x = v[i];
+        int j = i;
+        for (; j > 0 && v[j - 1] > x; j--) {
+            v[j] = v[j - 1];
+        }
+        v[j] = x;
+    }
+}
+
+void quantile_init(struct Quantile *quantile, double p) {
+    memset(quantile, 0, sizeof(*quantile));
+    quantile->p = p;
+}
+
+/* piecewise-parabolic prediction of marker i moved by d */
+static double parabolic(const struct Quantile *q, int i, int d) {
+    const double *h = q->heights;
+    const int *n = q->positions;
+    return h[i] + (double)d / (n[i + 1] - n[i - 1]) *
+           ((n[i] - n[i - 1] + d) * (h[i + 1] - h[i]) / (n[i + 1] - n[i]) +
+            (n[i + 1] - n[i] - d) * (h[i] - h[i - 1]) / (n[i] - n[i - 1]));
+}
+
+void quantile_add(struct Quantile *quantile, double x) {
+    double *h = quantile->heights;
+    int *n = quantile->positions;
+    double *desired = quantile->desired;
+    double p = quantile->p;
+    if (quantile->count < 5) {
+        h[quantile->count++] = x;
+        if (quantile->count == 5) {
+            sort5(h, 5);
+            for (int i = 0; i < 5; i++) {
+                n[i] = i;
+            }
+            desired[0] = 0;
+            desired[1] = 2 * p;
+            desired[2] = 4 * p;
+            desired[3] = 2 + 2 * p;
+            desired[4] = 4;
+        }
+        return;
+    }
+    const double increments[5] = { 0, p / 2, p, (1 + p) / 2, 1 };
+    int k;
+    if (x < h[0]) {
+        h[0] = x;
+        k = 0;
+    } else if (x >= h[4]) {
+        h[4] = x;
+        k = 3;
+    } else {
+        for (k = 0; k < 3 && x >= h[k + 1]; k++) {
+        }
+    }
+    for (int i = k + 1; i < 5; i++) {
+        n[i]++;
+    }
+    for (int i = 0; i < 5; i++) {
+        desired[i] += increments[i];
+    }
+    quantile->count++;
+    /* moves the middle markers towards their desired positions */
+    for (int i = 1; i < 4; i++) {
+        double off = desired[i] - n[i];
+        if ((off >= 1 && n[i + 1] - n[i] > 1) ||
+            (off <= -1 && n[i - 1] - n[i] < -1)) {
+            int d = off > 0 ? 1 : -1;
+            double height = parabolic(quantile, i, d);
+            if (h[i - 1] < height && height < h[i + 1]) {
+                h[i] = height;
+            } else {
+                h[i] += d * (h[i + d] - h[i]) / (n[i + d] - n[i]);
+            }
+            n[i] += d;
+        }
+    }
+}
+
+double quantile_get(const struct Quantile *quantile) {
+    if (!quantile->count) {
+        return 0;
+    }
+    if (quantile->count >= 5) {
+        return quantile->heights[2];
+    }
+    /* too few values for the markers, these are exact */
+    double sorted[5];
+    memcpy(sorted, quantile->heights, sizeof(sorted));
+    sort5(sorted, quantile->count);
+    return sorted[(int)(quantile->p * (quantile->count - 1) + 0.5)];
+}
+
+void window_aggregator_init(struct WindowAggregator *agg, time_t width,
+                            int proc_stats) {
+    memset(agg, 0, sizeof(*agg));
+    agg->width = width;
+    agg->n_fields = proc_stats ? WINDOW_MAX_FIELDS : WINDOW_N_FIELDS;
+}
+
+struct TaskWindow* window_aggregator_get(struct WindowAggregator *agg,
+                                         int target) {
+    if (target >= agg->n_windows) {
+        int n = agg->n_windows ? agg->n_windows : 16;
+        while (n <= target) {
+            n *= 2;
+        }
+        struct TaskWindow *grown = (struct TaskWindow*)realloc(
+            agg->windows, n * sizeof(struct TaskWindow));
+        if (!grown) {
+            return NULL;
+        }
+        memset(grown + agg->n_windows, 0,
+               (n - agg->n_windows) * sizeof(*grown));
+        agg->windows = grown;
+        agg->n_windows = n;
+    }
+    return &agg->windows[target];
+}
+
+static time_t window_start(const struct WindowAggregator *agg,
+                           time_t timestamp) {
+    return timestamp - timestamp % agg->width;
+}
+
+int task_window_due(const struct WindowAggregator *agg,
+                    const struct TaskWindow *window,
+                    const struct TaskStatistics *stats) {
+    return window->n_samples &&
+           (window_start(agg, stats->timestamp) != window->start ||
+            stats->generation != window->generation);
+}
+
+static void reset(struct TaskWindow *window, time_t start) {
+    window->start = start;
+    window->n_samples = 0;
+    for (int i = 0; i < WINDOW_MAX_FIELDS; i++) {
+        struct FieldWindow *field = &window->fields[i];
+        field->min = field->max = field->last = 0;
+        field->sum = 0;
+        for (int j = 0; j < WINDOW_N_QUANTILES; j++) {
+            quantile_init(&field->deltas[j], quantiles[j]);
+        }
+    }
+}
+
+void task_window_add(struct WindowAggregator *agg, struct TaskWindow *window,
+                     const struct TaskStatistics *stats) {
+    time_t start = window_start(agg, stats->timestamp);
+    if (!window->n_samples || start != window->start ||
+        stats->generation != window->generation) {
+        reset(window, start);
+    }
+    int pid = stats->pid ? stats->pid : stats->tgid;
+    if (pid != window->pid || stats->generation != window->generation) {
+        /* another task behind the target, its counters are no successors */
+        window->has_previous = 0;
+        window->pid = pid;
+        window->generation = stats->generation;
+    }
+    memcpy(window->comm, stats->stats.ac_comm, sizeof(window->comm));
+    window->comm[sizeof(window->comm) - 1] = '\0';
+    for (int i = 0; i < agg->n_fields; i++) {
+        struct FieldWindow *field = &window->fields[i];
+        unsigned long long value;
+        memcpy(&value, (const char*)stats + counters[i].offset,
+               sizeof(value));
+        if (!window->n_samples || value < field->min) {
+            field->min = value;
+        }
+        if (!window->n_samples || value > field->max) {
+            field->max = value;
+        }
+        field->last = value;
+        field->sum += value;
+        /* a counter going back has no delta, as after a PID reuse */
+        if (window->has_previous && value >= window->previous[i]) {
+            for (int j = 0; j < WINDOW_N_QUANTILES; j++) {
+                quantile_add(&field->deltas[j],
+                             value - window->previous[i]);
+            }
+        }
+        window->previous[i] = value;
+    }
+    window->has_previous = 1;
+    window->n_samples++;
+}
+
+void window_aggregator_free(struct WindowAggregator *agg) {
+    free(agg->windows);
+    agg->windows = NULL;
+    agg->n_windows = 0;
+}
+
+char* task_window_format(const struct WindowAggregator *agg,
+                         const struct TaskWindow *window, char *p) {
+    p = format_u64(p, window->start);
+    *p++ = '\t';
+    p = format_int(p, window->pid);
+    *p++ = '\t';
+    p = format_str(p, window->comm);
+    *p++ = '\t';
+    p = format_int(p, window->n_samples);
+    for (int i = 0; i < agg->n_fields; i++) {
+        const struct FieldWindow *field = &window->fields[i];
+        *p++ = '\t';
+        p = format_u64(p, field->min);
+        *p++ = '\t';
+        p = format_u64(p, field->max);
+        *p++ = '\t';
+        p = format_fixed3(p, field->sum / window->n_samples, 0);
+        *p++ = '\t';
+        p = format_u64(p, field->last);
+        for (int j = 0; j < WINDOW_N_QUANTILES; j++) {
+            *p++ = '\t';
+            p = format_fixed3(p, quantile_get(&field->deltas[j]), 0);
+        }
+    }
+    return p;
+}
+
+char* task_window_format_columns(const struct WindowAggregator *agg,
+                                 char *p) {
+    static const char *stats[] = { "min", "max", "mean", "last" };
+    p = format_str(p, "timestamp\tpid\tcomm\tsamples");
+    for (int i = 0; i < agg->n_fields; i++) {
+        for (int j = 0; j < 4; j++) {
+            *p++ = '\t';
+            p = format_str(p, counters[i].name);
+            *p++ = '_';
+            p = format_str(p, stats[j]);
+        }
+        for (int j = 0; j < WINDOW_N_QUANTILES; j++) {
+            *p++ = '\t';
+            p = format_str(p, counters[i].name);
+            p = format_str(p, "_delta_");
+            p = format_str(p, quantile_names[j]);
+        }
+    }
+    return p;
+}
\ No newline at end of file
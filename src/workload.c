@@ -0,0 +1,198 @@
+#include "workload.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include "utils.h"
+
+/* width of the label and of the value columns of the summary */
+#define LABEL_WIDTH 22
+#define VALUE_WIDTH 14
+
+void workloads_init(struct Workloads *workloads) {
+    memset(workloads, 0, sizeof(*workloads));
+}
+
+static char* join(int argc, char *argv[]) {
+    size_t len = 1;
+    for (int i = 0; i < argc; i++) {
+        len += strlen(argv[i]) + 1;
+    }
+    char *name = (char*)malloc(len);
+    if (!name) {
+        return NULL;
+    }
+    char *p = name;
+    for (int i = 0; i < argc; i++) {
+        if (i) {
+            *p++ = ' ';
+        }
+        p = stpcpy(p, argv[i]);
+    }
+    *p = '\0';
+    return name;
+}
+
+int workloads_spawn(struct Workloads *workloads, int argc, char *argv[],
+                    const char *redirect_out, int n_planned) {
+    int i = workloads->n_workloads;
+    if (i == MAX_WORKLOADS) {
+        fprintf(stderr, "At most %d commands can be run\n", MAX_WORKLOADS);
+        return 1;
+    }
+    char out[4096];
+    if (redirect_out) {
+        if (n_planned > 1) {
+            snprintf(out, sizeof(out), "%s.%d", redirect_out, i + 1);
+        } else {
+            snprintf(out, sizeof(out), "%s", redirect_out);
+        }
+    }
+    workloads->names[i] = join(argc, argv);
+    if (!workloads->names[i]) {
+        fprintf(stderr, "Unable to allocate command name\n");
+        return 1;
+    }
+    if (command_spawn(&workloads->commands[i], argc, argv,
+                      redirect_out ? out : NULL)) {
+        free(workloads->names[i]);
+        workloads->names[i] = NULL;
+        return 1;
+    }
+    workloads->targets[i] = -1;
+    workloads->n_workloads++;
+    return 0;
+}
+
+int workloads_find(const struct Workloads *workloads, int target) {
+    for (int i = 0; i < workloads->n_workloads; i++) {
+        if (workloads->targets[i] == target) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void workloads_update(struct Workloads *workloads,
+                      const struct TaskStatistics *stats) {
+    int i = workloads_find(workloads, stats->target);
+    if (i >= 0) {
+        workloads->last[i] = *stats;
+        workloads->has_last[i] = 1;
+    } else if (stats->pid && stats->tgid) {
+        /* a thread of a workload sampled with --threads */
+        for (int j = 0; j < workloads->n_workloads; j++) {
+            if (workloads->commands[j].pid == stats->tgid) {
+                i = j;
+                break;
+            }
+        }
+    }
+    if (i < 0) {
+        return;
+    }
+    const struct taskstats *s = &stats->stats;
+    if (s->hiwater_rss > workloads->hiwater_rss[i]) {
+        workloads->hiwater_rss[i] = s->hiwater_rss;
+    }
+    if (s->hiwater_vm > workloads->hiwater_vm[i]) {
+        workloads->hiwater_vm[i] = s->hiwater_vm;
+    }
+}
+
+static void print_exit(FILE *file, const struct Workloads *workloads) {
+    fprintf(file, "%-*s", LABEL_WIDTH, "exit");
+    for (int i = 0; i < workloads->n_workloads; i++) {
+        const struct Command *command = &workloads->commands[i];
+        char text[32];
+        if (!command->reaped) {
+            strcpy(text, "running");
+        } else if (command->status == -1) {
+            strcpy(text, "unknown");
+        } else if (WIFSIGNALED(command->status)) {
+            snprintf(text, sizeof(text), "signal %d",
+                     WTERMSIG(command->status));
+        } else {
+            snprintf(text, sizeof(text), "%d", WEXITSTATUS(command->status));
+        }
+        fprintf(file, "%*s", VALUE_WIDTH, text);
+    }
+    fprintf(file, "\n");
+}
+
+/* a row of values, with the change of the second to the first for two */
+static void print_row(FILE *file, const struct Workloads *workloads,
+                      const char *label, const double *values,
+                      int precision) {
+    fprintf(file, "%-*s", LABEL_WIDTH, label);
+    for (int i = 0; i < workloads->n_workloads; i++) {
+        if (workloads->has_last[i]) {
+            fprintf(file, "%*.*f", VALUE_WIDTH, precision, values[i]);
+        } else {
+            fprintf(file, "%*s", VALUE_WIDTH, "-");
+        }
+    }
+    if (workloads->n_workloads == 2 && workloads->has_last[0] &&
+        workloads->has_last[1] && values[0]) {
+        fprintf(file, "%+*.1f%%", VALUE_WIDTH - 1,
+                (values[1] - values[0]) * 100. / values[0]);
+    }
+    fprintf(file, "\n");
+}
+
+void workloads_print_summary(FILE *file, const struct Workloads *workloads) {
+    int n = workloads->n_workloads;
+    for (int i = 0; i < n; i++) {
+        fprintf(file, "#%d pid %d: %s\n", i + 1, workloads->commands[i].pid,
+                workloads->names[i]);
+    }
+    fprintf(file, "%-*s", LABEL_WIDTH, "workload");
+    for (int i = 0; i < n; i++) {
+        char text[16];
+        snprintf(text, sizeof(text), "#%d", i + 1);
+        fprintf(file, "%*s", VALUE_WIDTH, text);
+    }
+    fprintf(file, n == 2 ? "%*s\n" : "\n", VALUE_WIDTH, "change");
+    print_exit(file, workloads);
+
+    double values[MAX_WORKLOADS] = { 0 };
+#define ROW(label, precision, expr) \
+    do { \
+        for (int i = 0; i < n; i++) { \
+            const struct taskstats *s = &workloads->last[i].stats; \
+            (void)s; \
+            values[i] = (expr); \
+        } \
+        print_row(file, workloads, label, values, precision); \
+    } while (0)
+
+    ROW("elapsed s", 3, s->ac_etime / 1e6);
+    ROW("user CPU s", 3, s->ac_utime / 1e6);
+    ROW("system CPU s", 3, s->ac_stime / 1e6);
+    ROW("CPU %", 1, s->ac_etime ?
+        (s->ac_utime + s->ac_stime) * 100. / s->ac_etime : 0);
+    ROW("CPU delay ms", 3, s->cpu_delay_total / 1e6);
+    ROW("block IO delay ms", 3, s->blkio_delay_total / 1e6);
+    ROW("swapin delay ms", 3, s->swapin_delay_total / 1e6);
+    ROW("freepages delay ms", 3, s->freepages_delay_total / 1e6);
+    ROW("read KiB", 1, s->read_char / 1024.);
+    ROW("written KiB", 1, s->write_char / 1024.);
+    ROW("read syscalls", 0, (double)s->read_syscalls);
+    ROW("write syscalls", 0, (double)s->write_syscalls);
+    ROW("RSS high water MiB", 1, workloads->hiwater_rss[i] / 1024.);
+    ROW("VM high water MiB", 1, workloads->hiwater_vm[i] / 1024.);
+    ROW("minor faults", 0, (double)s->ac_minflt);
+    ROW("major faults", 0, (double)s->ac_majflt);
+    ROW("voluntary switches", 0, (double)s->nvcsw);
+    ROW("involuntary switches", 0, (double)s->nivcsw);
+#undef ROW
+    fflush(file);
+}
+
+void workloads_destroy(struct Workloads *workloads) {
+    for (int i = 0; i < workloads->n_workloads; i++) {
+        command_destroy(&workloads->commands[i]);
+        free(workloads->names[i]);
+        workloads->names[i] = NULL;
+    }
+    workloads->n_workloads = 0;
+}
\ No newline at end of file
@@ -0,0 +1,128 @@
+/* round trip of the delta encoding and decoding of corrupt captures */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "delta.h"
+#include "record.h"
+
+static int failed = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+        failed = 1; \
+    } \
+} while (0)
+
+static FILE *open_capture(char *path) {
+    strcpy(path, "/tmp/mn_delta_test.XXXXXX");
+    int fd = mkstemp(path);
+    return fd < 0 ? NULL : fdopen(fd, "w");
+}
+
+static void fill(struct TaskStatistics *stats, int target, int i) {
+    memset(stats, 0, sizeof(*stats));
+    stats->target = target;
+    stats->pid = 1000 + target;
+    stats->tick = i;
+    stats->timestamp = 1000000000LL * (i + 1);
+    stats->stats.ac_utime = 100 * i * (target + 1);
+    snprintf(stats->stats.ac_comm, sizeof(stats->stats.ac_comm), "task%d",
+             target);
+}
+
+static void test_round_trip(const struct TargetList *targets) {
+    char path[64];
+    FILE *file = open_capture(path);
+    CHECK(file != NULL);
+    if (!file) {
+        return;
+    }
+    struct DeltaEncoder enc;
+    CHECK(!record_write_header(file, targets, RECORD_ENCODING_DELTA));
+    CHECK(!delta_encoder_init(&enc, file));
+    struct TaskStatistics stats;
+    for (int i = 0; i < 8; i++) {
+        fill(&stats, i & 1, i);
+        CHECK(!delta_encoder_write(&enc, &stats));
+    }
+    CHECK(!delta_encoder_finish(&enc));
+    fclose(file);
+
+    struct RecordReader reader;
+    struct DeltaDecoder dec;
+    if (record_reader_open(&reader, path)) {
+        CHECK(!"capture readable");
+        unlink(path);
+        return;
+    }
+    CHECK(!delta_decoder_init(&dec, &reader));
+    const void *record;
+    int n = 0;
+    while ((record = delta_decoder_next(&dec)) != NULL) {
+        fill(&stats, n & 1, n);
+        CHECK(!memcmp(record, &stats, sizeof(stats)));
+        n++;
+    }
+    CHECK(n == 8);
+    delta_decoder_free(&dec);
+    record_reader_close(&reader);
+    unlink(path);
+}
+
+/* a block holding a single keyframe of the given tag */
+static void test_corrupt_tag(const struct TargetList *targets, uint64_t tag) {
+    char path[64];
+    FILE *file = open_capture(path);
+    CHECK(file != NULL);
+    if (!file) {
+        return;
+    }
+    char frame[16 + sizeof(struct TaskStatistics)];
+    int len = 0;
+    while (tag >= 0x80) {
+        frame[len++] = (char)(tag | 0x80);
+        tag >>= 7;
+    }
+    frame[len++] = (char)tag;
+    struct TaskStatistics stats;
+    fill(&stats, 0, 0);
+    memcpy(frame + len, &stats, sizeof(stats));
+    len += sizeof(stats);
+
+    struct DeltaBlockHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = DELTA_BLOCK_MAGIC;
+    header.size = len;
+    header.n_frames = 1;
+    CHECK(!record_write_header(file, targets, RECORD_ENCODING_DELTA));
+    CHECK(fwrite(&header, sizeof(header), 1, file) == 1);
+    CHECK(fwrite(frame, 1, len, file) == (size_t)len);
+    fclose(file);
+
+    struct RecordReader reader;
+    struct DeltaDecoder dec;
+    if (record_reader_open(&reader, path)) {
+        CHECK(!"capture readable");
+        unlink(path);
+        return;
+    }
+    CHECK(!delta_decoder_init(&dec, &reader));
+    CHECK(delta_decoder_next(&dec) == NULL);
+    delta_decoder_free(&dec);
+    record_reader_close(&reader);
+    unlink(path);
+}
+
+int main() {
+    /* the captures list no targets, they are not needed to decode */
+    static struct TargetList targets;
+    test_round_trip(&targets);
+    /* target 2^31, negative as an int, and one past any TargetList */
+    test_corrupt_tag(&targets, 1ULL << 32);
+    test_corrupt_tag(&targets, 1ULL << 62);
+    test_corrupt_tag(&targets,
+                     (uint64_t)TARGET_MAX_CHUNKS * TARGET_CHUNK_SIZE << 1);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
\ No newline at end of file
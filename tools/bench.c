@@ -0,0 +1,665 @@
+/*
+ * Microbenchmarks of the sampling pipeline: queue, formatter, reply
+ * parser, tick timing, and an end to end run against a built-in workload.
+ * Results are printed as tab separated "benchmark parameter value unit"
+ * lines so that runs of two builds can be compared by a script.
+ */
+#include <dirent.h>
+#include <fcntl.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
+#include <netlink/genl/genl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "format.h"
+#include "histogram.h"
+#include "queue.h"
+#include "target.h"
+#include "taskstats.h"
+#include "ticker.h"
+#include "utils.h"
+
+#define POP_BATCH 64
+
+static long scale = 1;
+static const char *filter;
+static int n_failed;    /* checks of the results that failed */
+
+static int selected(const char *name) {
+    return !filter || strstr(name, filter);
+}
+
+static void report(const char *name, const char *parameter, double value,
+                   const char *unit) {
+    printf("%s\t%s\t%.3f\t%s\n", name, parameter, value, unit);
+    fflush(stdout);
+}
+
+/* the benchmarked code gave a wrong result, mn_bench exits with failure */
+static void check(int ok, const char *name, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "%s: %s\n", name, what);
+        n_failed++;
+    }
+}
+
+static void fill_task_stats(struct TaskStatistics *stats, int i) {
+    memset(stats, 0, sizeof(*stats));
+    stats->pid = 1000 + i;
+    stats->timestamp = get_ns_timestamp();
+    stats->stats.version = TASKSTATS_VERSION;
+    stats->stats.ac_pid = stats->pid;
+    strcpy(stats->stats.ac_comm, "bench");
+    stats->stats.ac_etime = 123456789ULL * i;
+    stats->stats.ac_utime = 987654ULL * i;
+    stats->stats.ac_stime = 45678ULL * i;
+    stats->stats.cpu_count = 17ULL * i;
+    stats->stats.cpu_delay_total = 1234567ULL * i;
+    stats->stats.read_char = 4096ULL * i;
+    stats->stats.write_char = 8192ULL * i;
+    stats->stats.nvcsw = 3ULL * i;
+}
+
+struct ProducerArgs {
+    struct ConcurrentQueue *que;
+    long n_records;
+    int id;
+};
+
+/* the records of a producer carry its id and their sequence number */
+static void *produce(void *arg) {
+    struct ProducerArgs *args = (struct ProducerArgs*)arg;
+    struct TaskStatistics stats;
+    fill_task_stats(&stats, 1);
+    stats.target = args->id;
+    for (long i = 0; i < args->n_records; i++) {
+        stats.stats.ac_minflt = i;
+        concurrent_queue_push(args->que, &stats);
+    }
+    return NULL;
+}
+
+static void bench_queue(int n_producers) {
+    struct ConcurrentQueue que;
+    if (concurrent_queue_init(&que, DEFAULT_QUEUE_SIZE, QUEUE_FULL_BLOCK)) {
+        return;
+    }
+    long per_producer = 2000000 * scale / n_producers;
+    struct ProducerArgs args[n_producers];
+    long next[n_producers];
+    pthread_t threads[n_producers];
+    struct TaskStatistics *batch = (struct TaskStatistics*)malloc(
+        POP_BATCH * sizeof(struct TaskStatistics));
+
+    time_t t_start = get_monotonic_timestamp();
+    for (int i = 0; i < n_producers; i++) {
+        args[i] = (struct ProducerArgs){ &que, per_producer, i };
+        next[i] = 0;
+        pthread_create(&threads[i], NULL, &produce, &args[i]);
+    }
+    long n_popped = 0;
+    int in_order = 1;
+    while (n_popped < per_producer * n_producers) {
+        int n = concurrent_queue_pop_batch(&que, batch, POP_BATCH);
+        /* every record once, in the order of its producer */
+        for (int i = 0; i < n; i++) {
+            int id = batch[i].target;
+            if (id < 0 || id >= n_producers ||
+                (long)batch[i].stats.ac_minflt != next[id]++) {
+                in_order = 0;
+            }
+        }
+        n_popped += n;
+    }
+    time_t t_end = get_monotonic_timestamp();
+    for (int i = 0; i < n_producers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    check(in_order && n_popped == per_producer * n_producers,
+          "queue_push_pop", "records lost, repeated or out of order");
+
+    char parameter[32];
+    snprintf(parameter, sizeof(parameter), "producers=%d", n_producers);
+    report("queue_push_pop", parameter,
+           n_popped * 1e3 / (t_end - t_start), "Mrecords/s");
+    free(batch);
+    concurrent_queue_destroy(&que);
+}
+
+static void bench_format() {
+    struct TaskStatistics stats;
+    fill_task_stats(&stats, 7);
+    char buf[200];
+    long n = 1000000 * scale;
+    time_t t_start = get_monotonic_timestamp();
+    for (long i = 0; i < n; i++) {
+        stats.stats.ac_utime = i;
+        task_stats2str(&stats, buf, sizeof(buf));
+    }
+    report("task_stats2str", "-",
+           (get_monotonic_timestamp() - t_start) * 1. / n, "ns/record");
+    /* the first columns: comm, begin and elapsed time, user and system */
+    char expected[128];
+    snprintf(expected, sizeof(expected), "bench\t0\t%llu\t%ld\t%llu\t",
+             (unsigned long long)stats.stats.ac_etime, n - 1,
+             (unsigned long long)stats.stats.ac_stime);
+    check(!strncmp(buf, expected, strlen(expected)), "task_stats2str",
+          "unexpected columns");
+
+    /* the human readable dump goes to stdout, send it nowhere */
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    if (!freopen("/dev/null", "w", stdout)) {
+        return;
+    }
+    n = 50000 * scale;
+    t_start = get_monotonic_timestamp();
+    for (long i = 0; i < n; i++) {
+        print_task_stats(&stats, 1);
+    }
+    fflush(stdout);
+    time_t t_end = get_monotonic_timestamp();
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    clearerr(stdout);
+    report("print_task_stats", "-", (t_end - t_start) * 1. / n, "ns/record");
+
+    /* what mn does with a popped batch: format all, then one write() */
+    struct OutputBuffer out;
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd < 0 || output_buffer_init(&out, fd, OUTPUT_BUFFER_SIZE)) {
+        return;
+    }
+    n = 50000 * scale;
+    t_start = get_monotonic_timestamp();
+    for (long i = 0; i < n; i++) {
+        char *p = output_buffer_reserve(&out, TASK_STATS_REPORT_LEN);
+        output_buffer_commit(&out, task_stats_format_report(&stats, 1, p));
+        if (i % POP_BATCH == POP_BATCH - 1) {
+            output_buffer_flush(&out);
+        }
+    }
+    output_buffer_flush(&out);
+    report("report_batch", "-",
+           (get_monotonic_timestamp() - t_start) * 1. / n, "ns/record");
+    output_buffer_free(&out);
+    close(fd);
+}
+
+/* a reply as the kernel sends it for TASKSTATS_CMD_ATTR_PID */
+static struct nl_msg *canned_reply() {
+    struct nl_msg *msg = nlmsg_alloc();
+    if (!msg) {
+        return NULL;
+    }
+    struct TaskStatistics stats;
+    fill_task_stats(&stats, 3);
+    genlmsg_put(msg, NL_AUTO_PID, 1, 0x15, 0, 0, TASKSTATS_CMD_NEW,
+                TASKSTATS_VERSION);
+    struct nlattr *aggregate = nla_nest_start(msg, TASKSTATS_TYPE_AGGR_PID);
+    /* libnl flags nests, the kernel does not */
+    aggregate->nla_type &= ~NLA_F_NESTED;
+    nla_put_u32(msg, TASKSTATS_TYPE_PID, stats.pid);
+    nla_put(msg, TASKSTATS_TYPE_STATS, sizeof(stats.stats), &stats.stats);
+    nla_nest_end(msg, aggregate);
+    return msg;
+}
+
+/* the attribute walk of the engine's reply callback */
+static void bench_parse() {
+    struct nl_msg *msg = canned_reply();
+    if (!msg) {
+        return;
+    }
+    struct nlmsghdr *hdr = nlmsg_hdr(msg);
+    struct TaskStatistics stats, expected;
+    fill_task_stats(&expected, 3);
+    long n = 2000000 * scale;
+    unsigned long long check_sum = 0;
+    time_t t_start = get_monotonic_timestamp();
+    for (long i = 0; i < n; i++) {
+        memset(&stats, 0, sizeof(stats));
+        struct genlmsghdr *gnlh = (struct genlmsghdr*)nlmsg_data(hdr);
+        struct nlattr *attr = genlmsg_attrdata(gnlh, 0);
+        int remaining = genlmsg_attrlen(gnlh, 0);
+        nla_for_each_attr(attr, attr, remaining, remaining) {
+            if (attr->nla_type == TASKSTATS_TYPE_AGGR_PID) {
+                task_stats_parse_aggregate(attr, &stats);
+            }
+        }
+        check_sum += stats.stats.ac_utime;
+    }
+    time_t t_end = get_monotonic_timestamp();
+    report("parse_task_stats", "libnl", (t_end - t_start) * 1. / n,
+           "ns/reply");
+    check(stats.pid == expected.pid &&
+          !memcmp(&stats.stats, &expected.stats, sizeof(stats.stats)),
+          "parse_task_stats", "libnl walk read another record");
+
+    t_start = get_monotonic_timestamp();
+    for (long i = 0; i < n; i++) {
+        memset(&stats, 0, sizeof(stats));
+        task_stats_parse_reply(hdr, &stats);
+        check_sum += stats.stats.ac_utime;
+    }
+    t_end = get_monotonic_timestamp();
+    report("parse_task_stats", "in_place", (t_end - t_start) * 1. / n,
+           "ns/reply");
+    check(check_sum == 2 * n * expected.stats.ac_utime &&
+          stats.pid == expected.pid &&
+          !memcmp(&stats.stats, &expected.stats, sizeof(stats.stats)),
+          "parse_task_stats", "in place parse read another record");
+    nlmsg_free(msg);
+}
+
+static void report_lateness(const char *name, time_t period,
+                            const struct Histogram *late, time_t cpu) {
+    char parameter[32];
+    snprintf(parameter, sizeof(parameter), "period_us=%ld",
+             (long)(period / MICRO_SECOND));
+    char metric[64];
+    snprintf(metric, sizeof(metric), "%s_p50", name);
+    report(metric, parameter, histogram_percentile(late, 50) * 1e-3, "us");
+    snprintf(metric, sizeof(metric), "%s_p99", name);
+    report(metric, parameter, histogram_percentile(late, 99) * 1e-3, "us");
+    snprintf(metric, sizeof(metric), "%s_cpu", name);
+    report(metric, parameter, cpu * 100. / (late->n * period), "%");
+}
+
+static time_t thread_cpu_time() {
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void bench_sleep_until(time_t period) {
+    struct Histogram *late = (struct Histogram*)calloc(1, sizeof(*late));
+    long n = 200 * scale;
+    time_t cpu = thread_cpu_time();
+    time_t deadline = get_monotonic_timestamp();
+    for (long i = 0; i < n; i++) {
+        deadline += period;
+        sleep_until(deadline);
+        histogram_record(late, get_monotonic_timestamp() - deadline);
+    }
+    report_lateness("sleep_until_lateness", period, late,
+                    thread_cpu_time() - cpu);
+    free(late);
+}
+
+static void bench_ticker(enum TickerMode mode, time_t period) {
+    static const char *names[] = {
+        "tick_sleep_lateness", "tick_hybrid_lateness", "tick_fifo_lateness"
+    };
+    struct Ticker ticker;
+    if (ticker_init(&ticker, mode, period, -1)) {
+        return;
+    }
+    struct Histogram *late = (struct Histogram*)calloc(1, sizeof(*late));
+    long n = 200 * scale;
+    time_t cpu = thread_cpu_time();
+    ticker_start(&ticker);
+    struct pollfd pfd = { .fd = ticker.fd, .events = POLLIN };
+    while ((long)ticker.n_ticks < n) {
+        poll(&pfd, 1, -1);
+        if (ticker_wait(&ticker) > 0) {
+            histogram_record(late, ticker.late);
+        }
+    }
+    report_lateness(names[mode], period, late, thread_cpu_time() - cpu);
+    free(late);
+    ticker_destroy(&ticker);
+}
+
+/* the allocation loop of loop-cal.c, repeated until killed */
+static void run_workload() {
+    volatile double sink = 0;
+    while (1) {
+        for (int i = 0; i < 100000; i++) {
+            double *arr = (double*)malloc(i * sizeof(double));
+            for (int j = 0; j < i; j++) {
+                arr[j] = i * 1. / 3;
+            }
+            sink += i ? arr[i - 1] : 0;
+            free(arr);
+        }
+    }
+}
+
+static void *drain_queue(void *arg) {
+    struct ConcurrentQueue *que = (struct ConcurrentQueue*)arg;
+    struct TaskStatistics *batch = (struct TaskStatistics*)malloc(
+        POP_BATCH * sizeof(struct TaskStatistics));
+    while (concurrent_queue_pop_batch(que, batch, POP_BATCH) > 0);
+    free(batch);
+    return NULL;
+}
+
+/* kill(-1) or kill(0) would signal far more than the idlers */
+static void stop_idlers(pid_t *idlers, int n_idlers) {
+    for (int i = 0; i < n_idlers; i++) {
+        if (idlers[i] <= 0) {
+            continue;
+        }
+        kill(idlers[i], SIGKILL);
+        waitpid(idlers[i], NULL, 0);
+    }
+}
+
+/* processes of the user, which RLIMIT_NPROC counts */
+static long count_user_processes() {
+    DIR *proc = opendir("/proc");
+    if (!proc) {
+        return 0;
+    }
+    long n = 0;
+    uid_t uid = getuid();
+    struct dirent *entry;
+    struct stat st;
+    while ((entry = readdir(proc)) != NULL) {
+        if (entry->d_name[0] >= '0' && entry->d_name[0] <= '9' &&
+            !fstatat(dirfd(proc), entry->d_name, &st, 0) &&
+            st.st_uid == uid) {
+            n++;
+        }
+    }
+    closedir(proc);
+    return n;
+}
+
+/* a number read from a cgroup file, -1 if missing or "max" */
+static long read_cgroup_value(const char *dir, const char *cgroup,
+                              const char *name) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s%s/%s", dir, cgroup, name);
+    FILE *file = fopen(path, "r");
+    long value = -1;
+    if (file) {
+        if (fscanf(file, "%ld", &value) != 1) {
+            value = -1;
+        }
+        fclose(file);
+    }
+    return value;
+}
+
+/* pids.max less pids.current of our cgroup, -1 without a limit */
+static long cgroup_pids_room() {
+    char line[512];
+    FILE *file = fopen("/proc/self/cgroup", "r");
+    if (!file) {
+        return -1;
+    }
+    long room = -1;
+    while (fgets(line, sizeof(line), file)) {
+        /* the unified hierarchy, or the pids controller of cgroup v1 */
+        const char *dir = "/sys/fs/cgroup";
+        char *cgroup = strstr(line, ":pids:");
+        if (cgroup) {
+            dir = "/sys/fs/cgroup/pids";
+            cgroup += 6;
+        } else if (!strncmp(line, "0::", 3)) {
+            cgroup = line + 3;
+        } else {
+            continue;
+        }
+        cgroup[strcspn(cgroup, "\n")] = '\0';
+        long max = read_cgroup_value(dir, cgroup, "pids.max");
+        long current = read_cgroup_value(dir, cgroup, "pids.current");
+        if (max >= 0 && current >= 0 &&
+            (room < 0 || max - current < room)) {
+            room = max > current ? max - current : 0;
+        }
+    }
+    fclose(file);
+    return room;
+}
+
+/*
+ * whether n more processes can be forked under RLIMIT_NPROC and pids.max,
+ * with some room left for the threads of the benchmark and the rest
+ */
+static int can_fork(long n) {
+    const long margin = 64;
+    struct rlimit limit;
+    if (getuid() != 0 && !getrlimit(RLIMIT_NPROC, &limit) &&
+        limit.rlim_cur != RLIM_INFINITY &&
+        (long)limit.rlim_cur - count_user_processes() < n + margin) {
+        return 0;
+    }
+    long room = cgroup_pids_room();
+    return room < 0 || room >= n + margin;
+}
+
+struct StopArgs {
+    pid_t pid;
+    time_t duration;
+    pid_t *idlers;
+    int n_idlers;
+};
+
+static void *stop_workload(void *arg) {
+    struct StopArgs *args = (struct StopArgs*)arg;
+    sleep_until(get_monotonic_timestamp() + args->duration);
+    kill(args->pid, SIGKILL);
+    /* reaped here, the engine keeps sampling a zombie */
+    waitpid(args->pid, NULL, 0);
+    stop_idlers(args->idlers, args->n_idlers);
+    return NULL;
+}
+
+/*
+ * samples a fresh workload process for a while at the given period, with
+ * n_idlers sleeping processes as further targets
+ */
+static int bench_end_to_end(time_t period, enum NetlinkTransport transport,
+                            int n_idlers, int n_workers) {
+    pid_t *idlers = (pid_t*)calloc(n_idlers + 1, sizeof(pid_t));
+    if (!idlers) {
+        return 1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        run_workload();
+    }
+    if (pid < 0) {
+        free(idlers);
+        return 1;
+    }
+    struct TargetList targets;
+    target_list_init(&targets);
+    target_list_add(&targets, TASKSTATS_CMD_ATTR_PID, pid);
+    for (int i = 0; i < n_idlers; i++) {
+        idlers[i] = fork();
+        if (idlers[i] == 0) {
+            pause();
+            _exit(0);
+        }
+        if (idlers[i] < 0) {
+            /* out of processes, e.g. at pids.max or RLIMIT_NPROC */
+            perror("Unable to fork an idler");
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            stop_idlers(idlers, i);
+            free(idlers);
+            target_list_free(&targets);
+            return 1;
+        }
+        target_list_add(&targets, TASKSTATS_CMD_ATTR_PID, idlers[i]);
+    }
+    struct ConcurrentQueue que;
+    struct QueryEngine *engine = (struct QueryEngine*)malloc(sizeof(*engine));
+    if (concurrent_queue_init(&que, DEFAULT_QUEUE_SIZE, QUEUE_FULL_BLOCK) ||
+        !engine || query_engine_init(engine, &que, &targets, period,
+                                     TICKER_SLEEP, -1, transport,
+                                     n_workers)) {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        stop_idlers(idlers, n_idlers);
+        free(idlers);
+        free(engine);
+        return 1;
+    }
+
+    pthread_t consumer, stopper;
+    struct StopArgs stop = { pid, 500 * MILL_SECOND * scale, idlers,
+                             n_idlers };
+    pthread_create(&consumer, NULL, &drain_queue, &que);
+    pthread_create(&stopper, NULL, &stop_workload, &stop);
+    time_t cpu = thread_cpu_time();
+    time_t t_start = get_monotonic_timestamp();
+    query_engine_run(engine);
+    time_t t_end = get_monotonic_timestamp();
+    cpu = thread_cpu_time() - cpu;
+    pthread_join(stopper, NULL);
+    concurrent_queue_close(&que);
+    pthread_join(consumer, NULL);
+
+    free(idlers);
+
+    char parameter[64];
+    int len = snprintf(parameter, sizeof(parameter),
+                       "period_us=%ld,%s,targets=%d",
+                       (long)(period / MICRO_SECOND),
+                       transport == NETLINK_RAW ? "raw" : "libnl",
+                       n_idlers + 1);
+    if (n_workers > 1) {
+        snprintf(parameter + len, sizeof(parameter) - len, ",workers=%d",
+                 n_workers);
+    }
+    report("e2e_samples", parameter,
+           engine->n_received * 1e9 / (t_end - t_start), "samples/s");
+    report("e2e_missed_ticks", parameter,
+           engine->n_overruns * 100. / (engine->n_ticks + engine->n_overruns),
+           "%");
+    report("e2e_round_trip_p99", parameter,
+           histogram_percentile(
+               &engine->latency.stages[STAGE_ROUND_TRIP], 99) * 1e-3, "us");
+    if (n_workers == 1) {
+        /* the tick thread only, the workers' time is not in there */
+        report("e2e_sampler_cpu", parameter, cpu * 100. / (t_end - t_start),
+               "%");
+        report("e2e_cpu_per_sample", parameter,
+               engine->n_received ? cpu * 1. / engine->n_received : 0,
+               "ns/sample");
+    } else {
+        report("e2e_stolen", parameter,
+               engine->n_stolen * 100. / (engine->n_sent ? engine->n_sent : 1),
+               "%");
+    }
+
+    query_engine_destroy(engine);
+    free(engine);
+    concurrent_queue_destroy(&que);
+    target_list_free(&targets);
+    return 0;
+}
+
+static void print_usage() {
+    printf("Microbenchmarks of mn\n"
+           "\n"
+           "Usage: mn_bench [--quick] [FILTER]\n"
+           "\n"
+           "Runs the benchmarks whose name contains FILTER, all by default, "
+           "and prints\none \"benchmark parameter value unit\" line per "
+           "result. The end to end\nbenchmarks need the rights mn itself "
+           "needs. The queue, format and parse\nbenchmarks check their "
+           "results and the exit status is 1 if one is wrong.\n"
+           "\n"
+           "Options:\n"
+           "  --help           Print this usage\n"
+           "  --quick          Run a tenth of the iterations\n");
+}
+
+int main(int argc, char **argv) {
+    int quick = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--help")) {
+            print_usage();
+            return EXIT_SUCCESS;
+        } else if (!strcmp(argv[i], "--quick")) {
+            quick = 1;
+        } else {
+            filter = argv[i];
+        }
+    }
+    printf("benchmark\tparameter\tvalue\tunit\n");
+
+    scale = quick ? 1 : 10;
+    if (selected("queue_push_pop")) {
+        for (int n = 1; n <= 4; n *= 2) {
+            bench_queue(n);
+        }
+    }
+    if (selected("task_stats2str") || selected("print_task_stats") ||
+        selected("report_batch")) {
+        bench_format();
+    }
+    if (selected("parse_task_stats")) {
+        bench_parse();
+    }
+    scale = quick ? 1 : 5;
+    const time_t periods[] = {
+        1000 * MICRO_SECOND, 250 * MICRO_SECOND, 100 * MICRO_SECOND
+    };
+    for (int i = 0; i < 3; i++) {
+        if (selected("sleep_until")) {
+            bench_sleep_until(periods[i]);
+        }
+        if (selected("tick_sleep")) {
+            bench_ticker(TICKER_SLEEP, periods[i]);
+        }
+        if (selected("tick_hybrid")) {
+            bench_ticker(TICKER_HYBRID, periods[i]);
+        }
+    }
+
+    scale = quick ? 1 : 4;
+    if (selected("e2e")) {
+        const time_t e2e_periods[] = {
+            10 * MILL_SECOND, 1 * MILL_SECOND, 250 * MICRO_SECOND,
+            100 * MICRO_SECOND
+        };
+        for (int i = 0; i < 4; i++) {
+            if (bench_end_to_end(e2e_periods[i], NETLINK_LIBNL, 0, 1) ||
+                bench_end_to_end(e2e_periods[i], NETLINK_RAW, 0, 1)) {
+                fprintf(stderr, "end to end benchmark skipped\n");
+                break;
+            }
+        }
+        /* many targets per tick, where the transport costs add up */
+        if (!can_fork(511)) {
+            fprintf(stderr, "end to end benchmark with 512 targets "
+                    "skipped, too few processes left to fork\n");
+        }
+        for (int i = 0; i < 2 && can_fork(511); i++) {
+            if (bench_end_to_end(MILL_SECOND, i ? NETLINK_RAW :
+                                 NETLINK_LIBNL, 511, 1)) {
+                fprintf(stderr, "end to end benchmark skipped\n");
+                break;
+            }
+        }
+        /* a whole host worth of targets, swept by more and more workers */
+        if (!can_fork(4095)) {
+            fprintf(stderr, "end to end benchmark with 4096 targets "
+                    "skipped, too few processes left to fork\n");
+        }
+        for (int n = 1; n <= 8 && can_fork(4095); n *= 2) {
+            if (bench_end_to_end(10 * MILL_SECOND, NETLINK_RAW, 4095, n)) {
+                fprintf(stderr, "end to end benchmark skipped\n");
+                break;
+            }
+        }
+    }
+    return n_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,123 @@
+/*
+ * Converts a binary capture written by mn --out-format=binary or delta
+ * into TSV or CSV text, one line per record with a header line of field
+ * names.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "delta.h"
+#include "record.h"
+
+static void print_usage() {
+    printf("Convert mn binary captures to text\n"
+           "\n"
+           "Usage: mn-convert [--csv|--tsv] FILE\n"
+           "\n"
+           "Options:\n"
+           "  --help           Print this usage\n"
+           "  --tsv            Write tab separated values, the default\n"
+           "  --csv            Write comma separated values\n");
+}
+
+static void print_string(const char *s, size_t len, char sep) {
+    size_t n = strnlen(s, len);
+    int quote = 0;
+    for (size_t i = 0; sep == ',' && i < n; i++) {
+        quote |= s[i] == ',' || s[i] == '"' || s[i] == '\n';
+    }
+    if (quote) {
+        putchar('"');
+        for (size_t i = 0; i < n; i++) {
+            if (s[i] == '"') {
+                putchar('"');
+            }
+            putchar(s[i]);
+        }
+        putchar('"');
+    } else {
+        fwrite(s, 1, n, stdout);
+    }
+}
+
+static void print_record(const struct RecordReader *reader, const char *record,
+                         char sep) {
+    const struct RecordField *fields = reader->fields;
+    for (uint32_t i = 0; i < reader->header->n_fields; i++) {
+        if (i) {
+            putchar(sep);
+        }
+        switch (fields[i].type) {
+            case RECORD_FIELD_UINT:
+                printf("%" PRIu64, record_field_uint(&fields[i], record));
+                break;
+            case RECORD_FIELD_INT:
+                printf("%" PRId64, record_field_int(&fields[i], record));
+                break;
+            case RECORD_FIELD_STR:
+                print_string(record + fields[i].offset, fields[i].size, sep);
+                break;
+            default:
+                break;
+        }
+    }
+    putchar('\n');
+}
+
+int main(int argc, char **argv) {
+    char sep = '\t';
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--help")) {
+            print_usage();
+            return EXIT_SUCCESS;
+        } else if (!strcmp(argv[i], "--csv")) {
+            sep = ',';
+        } else if (!strcmp(argv[i], "--tsv")) {
+            sep = '\t';
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    struct RecordReader reader;
+    if (record_reader_open(&reader, path)) {
+        fprintf(stderr, "Unable to read capture %s\n", path);
+        return EXIT_FAILURE;
+    }
+
+    const struct RecordField *fields = reader.fields;
+    uint32_t n_fields = reader.header->n_fields;
+    for (uint32_t i = 0; i < n_fields; i++) {
+        printf("%s%.*s", i ? (sep == ',' ? "," : "\t") : "",
+               RECORD_FIELD_NAME_LEN, fields[i].name);
+    }
+    putchar('\n');
+
+    if (reader.header->encoding == RECORD_ENCODING_DELTA) {
+        struct DeltaDecoder decoder;
+        if (delta_decoder_init(&decoder, &reader)) {
+            record_reader_close(&reader);
+            return EXIT_FAILURE;
+        }
+        const void *record;
+        while ((record = delta_decoder_next(&decoder)) != NULL) {
+            print_record(&reader, (const char*)record, sep);
+        }
+        delta_decoder_free(&decoder);
+    } else {
+        for (size_t r = 0; r < reader.n_records; r++) {
+            print_record(&reader, (const char*)record_reader_get(&reader, r),
+                         sep);
+        }
+    }
+
+    record_reader_close(&reader);
+    return EXIT_SUCCESS;
+}
\ No newline at end of file